@@ -0,0 +1,96 @@
+#ifndef __MGZ_COMPRESS_ARCHIVE_CD_CACHE_H
+#define __MGZ_COMPRESS_ARCHIVE_CD_CACHE_H
+
+#include "mgz/export.h"
+#include "compress/archive/lib_zip.h"
+#include "io/file.h"
+#include "util/thread.h"
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#define CD_CACHE_MAX_ARCHIVES 256
+#define CD_CACHE_MAX_BYTES (1024*1024*64) // 64 Mo of parsed central directories
+
+// Parsed central directory header. The variable part (file name, extra field
+// and file comment) is not copied : it lives in the raw central directory
+// buffer, starting at data_offset.
+struct central_directory_record {
+  central_directory_header_static static_part;
+  unsigned int data_offset;
+};
+
+// Parsed central directory of an archive, shared by all the readers of this archive.
+// It is never modified once built, so readers do not need any lock.
+struct central_directory {
+  end_of_central_directory_header eocdh;
+  std::vector<unsigned char> cd; // Raw central directory, read at once
+  std::vector<central_directory_record> records;
+  std::map<std::string, int> index; // Entry index by file name
+
+  // Identity of the archive file when it was parsed
+  std::string path;
+  unsigned long device;
+  unsigned long inode;
+  long size;
+  long mtime;
+  long mtime_nsec;
+
+  // Managed by the cache
+  void * mapping; // Read-only mapping of the whole archive, made on demand
+  unsigned long footprint; // Approximative memory used
+  int refs;
+  bool cached;
+};
+
+namespace mgz {
+  namespace compress {
+    namespace archive {
+      // Process-wide cache of parsed central directories, keyed by archive path and checked against the inode,
+      // size and modification time of the file. Least recently used archives are evicted when there are more
+      // than max_archives of them, or when they use more than max_bytes. Thread safe.
+      class MGZ_API central_directory_cache {
+        public:
+          static central_directory_cache & instance();
+
+          // Returns the central directory of an archive, parsing it if it is not cached (or stale). Each call
+          // must be balanced by a call to release().
+          const central_directory * acquire(mgz::io::file & archive);
+          void release(const central_directory * directory);
+
+          // Returns a read-only mapping of the whole archive, shared by all the readers
+          const void * mapping(const central_directory * directory);
+
+          // Forgets an archive (e.g. after rewriting it), or all of them
+          void invalidate(const std::string & path);
+          void clear();
+
+          // Setting max_archives to 0 disables caching
+          void set_limits(unsigned long max_archives, unsigned long max_bytes);
+          unsigned long number_of_archives();
+          unsigned long footprint();
+
+        private:
+          central_directory_cache();
+          ~central_directory_cache();
+
+          central_directory * parse(mgz::io::file & archive);
+          void detach(central_directory * directory);
+          void destroy(central_directory * directory);
+          void evict();
+
+        private:
+          mgz::util::mutex lock_;
+          std::list<central_directory *> lru_; // Most recently used first
+          std::map<std::string, std::list<central_directory *>::iterator> by_path_;
+          unsigned long max_archives_;
+          unsigned long max_bytes_;
+          unsigned long bytes_;
+      };
+    }
+  }
+}
+
+#endif // __MGZ_COMPRESS_ARCHIVE_CD_CACHE_H
@@ -1,11 +1,22 @@
 #ifndef __ZIP_COMMON_H
 #define __ZIP_COMMON_H
 
+#include <istream>
+#include <vector>
+#include "compress/archive/lib_zip.h"
+
+struct central_directory_record;
+
 short rotate(short x, int n);
 void zip_time_to_dos_time(short time, int *hh, int *mm, int *ss);
 short dos_time_to_zip_time(int hh, int mm, int ss);
 void zip_date_to_dos_time(short date, int *yy, int *mm, int *dd);
 short dos_date_to_zip_date(int yy, int mm, int dd);
 
+// Locates the end of central directory record at the end of the archive, and reads it.
+void read_end_of_central_directory(std::istream & is, long archive_size, end_of_central_directory_header & eocdh);
+// Reads the whole central directory described by eocdh at once, and parses its headers in place.
+void read_central_directory(std::istream & is, long archive_size, const end_of_central_directory_header & eocdh, std::vector<unsigned char> & cd, std::vector<central_directory_record> & records);
+
 #endif // __ZIP_COMMON_H
 
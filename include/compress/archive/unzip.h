@@ -3,6 +3,7 @@
 
 #include "mgz/export.h"
 #include "compress/archive/lib_zip.h"
+#include "compress/archive/cd_cache.h"
 #include "io/file.h"
 #include "util/exception.h"
 
@@ -17,6 +18,8 @@ class MGZ_API MalformatedLocalFileHeader {};
 
 class MGZ_API UncompressError {};
 class MGZ_API UnsupportedCompressionMethod {};
+class MGZ_API CantMapArchive {};
+class MGZ_API UnsafeEntryName {};
 
 struct entry {
   unsigned int crc32;
@@ -30,9 +33,17 @@ struct entry {
   unsigned int file_offset;
 };
 
+// Read-only view on the data of an entry, inside the mapped archive.
+struct entry_view {
+  const unsigned char * data;
+  unsigned long size;
+};
+
 namespace mgz {
   namespace compress {
     namespace archive {
+      // The central directory of the archive is taken from central_directory_cache, so opening the same
+      // archive again does not read it again.
       class MGZ_API unzip {
         public:
           unzip(mgz::io::file & archive);
@@ -47,17 +58,23 @@ namespace mgz {
           int number_of_entries();
           entry file_stat_at_index(int i);
 
+          // Returns the index of the entry with the given name, or -1.
+          int index_of(const std::string & file_name);
+
+          // Returns a view on the data of a stored (CM_STORE) entry, without copy. The archive
+          // is mapped once, for all its readers ; views remain valid as long as this unzip object lives.
+          entry_view stored_view_at_index(int i);
+
         private:
-          void read_eocdh();
-          void read_cdh();
           local_file_header read_lfh_at_index(int i);
+          const char * cd_data(const central_directory_record & cdr);
 
         private:
-          std::vector<central_directory_header> cdh_;
-          end_of_central_directory_header eocdh_;
+          const central_directory * directory_; // Shared, read-only
           std::fstream is_;
           int archive_size_;
           mgz::io::file archive_;
+          int fd_;
       };
     }
   }
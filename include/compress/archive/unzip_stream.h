@@ -0,0 +1,64 @@
+#ifndef __MGZ_COMPRESS_ARCHIVE_UNZIP_STREAM_H
+#define __MGZ_COMPRESS_ARCHIVE_UNZIP_STREAM_H
+
+#include "mgz/export.h"
+#include "compress/archive/lib_zip.h"
+#include "compress/archive/unzip.h"
+#include "compress/mgz_stream.h"
+#include "io/file.h"
+#include "util/exception.h"
+
+#include <iostream>
+#include <vector>
+
+namespace mgz {
+  namespace compress {
+    namespace archive {
+      // Forward-only zip reader : entries are read from their local headers, in archive order, so the archive
+      // can be extracted while it is still arriving (pipe, socket, ...). The input is never seeked.
+      // Deflated (and Deflate64) entries followed by a data descriptor are handled by detecting the end of the deflate stream ;
+      // stored entries must have their sizes in the local header.
+      class MGZ_API unzip_stream {
+        public:
+          unzip_stream(std::istream & in);
+          ~unzip_stream();
+
+          // Reads the local header of the next entry, skipping the data of the current one if it was not
+          // inflated. Returns false once the central directory (or the end of the input) is reached.
+          bool next_entry(entry & e);
+
+          // Writes the data of the current entry to out, and returns the entry with its crc and sizes.
+          entry inflate_entry(std::ostream & out);
+
+          // Extracts all the remaining entries under the given directory. Entries with an absolute name, or a name
+          // with a ".." component, would be written outside of it : UnsafeEntryName is thrown for them.
+          void inflate();
+          void inflate(mgz::io::file & to);
+
+        private:
+          bool fill(unsigned long needed);
+          void read_bytes(void * data, unsigned long size);
+          void copy_stored(std::ostream * out);
+          void inflate_deflated(std::ostream * out);
+          void read_data_descriptor();
+          void skip_entry();
+          void free_inflate_state();
+
+        private:
+          std::istream & in_;
+          std::vector<unsigned char> buffer_;
+          unsigned long pos_; // First unread byte in buffer_
+          unsigned long end_; // End of valid data in buffer_
+          unsigned long offset_; // Offset of buffer_[pos_] in the archive
+          std::vector<unsigned char> out_buffer_;
+          mgz_stream stream_;
+          local_file_header_static lfh_;
+          entry current_;
+          bool pending_; // Data of the current entry not read yet
+          bool finished_;
+      };
+    }
+  }
+}
+
+#endif // __MGZ_COMPRESS_ARCHIVE_UNZIP_STREAM_H
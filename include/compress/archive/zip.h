@@ -3,9 +3,12 @@
 
 #include <fstream>
 #include <map>
+#include <set>
+#include <vector>
 
 #include "mgz/export.h"
 #include "io/file.h"
+#include "io/filesystem.h"
 #include "util/exception.h"
 #include "compress/compressor.h"
 #include "compress/archive/lib_zip.h"
@@ -15,10 +18,16 @@ class MGZ_API NonExistingFileToCompressException{};
 class MGZ_API CantOpenStreamException{};
 class MGZ_API CantGetStreamPositionException{};
 class MGZ_API NothingToCompressException{};
+class MGZ_API CantUpdateArchiveException{};
+class MGZ_API CantWriteStreamException{};
 
 #define NOT_INITIALIZED_W 0x6969
 #define NOT_INITIALIZED_L 0x69696969
 #define OUT_BUFFER_SIZE 1024*1024*4 // 4 Mo de buffer de sortie.
+#define AUTO_STORE_SAMPLE_SIZE (1024*64) // Trial compression is done on the first 64 Ko of a file
+#define AUTO_STORE_MIN_SIZE (1024*4) // Under 4 Ko, only the extension of a file is checked
+#define AUTO_STORE_MIN_SAVING 5 // Deflate is kept if it saves at least 5% of the sample
+#define DEDUP_HEAD_SIZE (1024*4) // Files of the same size are told apart by the crc of their first 4 Ko
 
 namespace mgz {
   namespace compress {
@@ -26,31 +35,117 @@ namespace mgz {
       class MGZ_API zip {
         public:
           std::map<std::string,central_directory_header> catalog; // Should be filled using "add" prior to call deflate();
+          std::vector<std::pair<std::string,central_directory_header> > tree_catalog; // Filled by "add_tree", in traversal order
 
           void add_file(mgz::io::file &fileToAdd, const mgz::io::file &base_dir);  
 
+          // Adds a whole directory tree, walking it once : each file is stat'ed a single time and the entries are
+          // kept in traversal order (sorted by name in each directory). Entries rejected by the filter (if any) are
+          // skipped; a rejected directory is skipped with all its content. Symbolic links to files are archived as
+          // the files they point to ; symbolic links to directories are skipped.
+          void add_tree(const mgz::io::file &root, const mgz::io::file &base_dir, mgz::io::fsfilter *filter = NULL);
+
           zip(const mgz::io::file &archive, unsigned short compression_method=CM_DEFLAT, int level=mgz::compress::COMPRESSION_LEVEL_4);
 
+          // Writes the archive to any output stream (pipe, socket, ...) : the sink is only written, never seeked nor
+          // read, and offsets are tracked by the zip itself. Deflated entries use data descriptors; stored entries get
+          // their crc computed before being written. append() and compact() are not available.
+          zip(std::ostream &sink, unsigned short compression_method=CM_DEFLAT, int level=mgz::compress::COMPRESSION_LEVEL_4);
+
           void deflate(); // Do THE job.
 
-          /* TODO.... or not to do...
-             void remove_file(entry);
-             void remove_file_at_index(int i);
-             int number_of_entries();
-             */
+          // Enables or disables (default) the automatic selection of CM_STORE for files that do not compress :
+          // known compressed formats (by extension), or files whose first block does not shrink by at least
+          // min_saving percents. Must be called before add_file().
+          void set_auto_store(bool enabled, unsigned int min_saving = AUTO_STORE_MIN_SAVING);
+
+          // Enables or disables (default) deduplication : files with the same content are compressed once, and the
+          // following ones reuse the compressed data already written in the archive. Not available when streaming.
+          void set_deduplicate(bool enabled);
+
+          // Adds the catalog to an existing archive : entries are written after the last local file, and the
+          // central directory is rewritten in place of the old one, so existing data is never rewritten.
+          // Entries of the archive having the same name than a catalog entry are replaced.
+          // If the archive does not exist yet, this is the same as deflate().
+          void append();
+
+          // Tombstones an entry of the archive, given its name in the archive. The entry is dropped from the
+          // central directory on the next call to append() or compact(), but its data remains in the archive
+          // until compact() is called.
+          void remove_file(const std::string &file_name);
+
+          // Rewrites the archive, keeping only the data of the entries referenced by its central directory.
+          void compact();
 
         private:
           mgz::io::file archive_;
           std::fstream archive_stream_;
+          std::ostream *sink_; // archive_stream_, or the stream given at construction
+          bool streaming_;
+          unsigned long written_; // Current offset in the archive
           unsigned short compression_method_;
           int level_;
+          std::vector<central_directory_header> existing_; // Entries kept from the existing archive, when appending
+          std::set<std::string> removed_; // Tombstoned entries names
+          unsigned long existing_cd_offset_;
+          std::string comment_; // Archive comment of the existing archive, written back with the central directory
+          bool auto_store_;
+          unsigned int min_saving_;
+          bool deduplicate_;
+
+          // Content already written in the archive, when deduplicating
+          struct written_content {
+            std::string path;
+            central_directory_header_static header;
+            unsigned long data_offset;
+          };
+          std::map<unsigned long,unsigned int> dedup_sizes_; // Number of files per size
+          std::map<std::pair<unsigned long,unsigned long>,std::vector<written_content> > dedup_contents_; // By size and head hash
+
+          // Reads the central directory of the existing archive into existing_, without removed entries, nor
+          // entries replaced by the catalog if with_catalog is set.
+          void read_existing_entries(bool with_catalog = true);
+
+          // Writes the local header and data of an entry, given the path of its source file
+          void write_entry(const std::string &path, central_directory_header &cdh);
+
+          // Writes an entry, reusing the data of an entry with the same content if there is one
+          void write_deduplicated_entry(const std::string &path, central_directory_header &cdh);
+
+          // Returns the crc of the first DEDUP_HEAD_SIZE bytes of a file
+          unsigned long head_hash(const std::string &path);
+
+          // Returns true if both files have the same content
+          bool same_content(const std::string &path1, const std::string &path2);
+
+          // Copies data already written in the archive to its end
+          void copy_archive_data(unsigned long offset, unsigned long size);
+
+          // Returns true if the filter (if any) accepts the file found at path
+          bool tree_filter(mgz::io::fsfilter *filter, const std::string &path, const mgz::io::file &root);
+
+          // Adds the content of a directory to tree_catalog, recursively. dir_fd is an open descriptor on the
+          // directory where openat/fstatat are available (it is closed by walk_tree), -1 otherwise.
+          void walk_tree(int dir_fd, const std::string &path, const std::string &zip_dir, const mgz::io::file &root, mgz::io::fsfilter *filter);
+
+          // Writes local headers and data of all the entries of the catalog
+          void write_catalog_entries();
 
           //Initializes a central directory header entry, given an existing file or dir.
           central_directory_header header_from_file(mgz::io::file& fileToAdd, const mgz::io::file& base_dir);
 
-          // Returns the current position in archive currently written (or die !)
+          // Initializes a central directory header entry, given the name of the entry and the status of its file.
+          central_directory_header make_header(const std::string &path, const std::string &zip_name, bool is_dir, unsigned long size, const struct tm &date_time);
+
+          // Returns true if the file should be stored rather than deflated (see set_auto_store)
+          bool should_store(const std::string &path, unsigned long size);
+
+          // Returns the current position in archive currently written
           unsigned long writing_position();
 
+          // Writes to the archive and moves the current position (or die !)
+          void write_bytes(const void *data, unsigned long size);
+
           // Returns flags to be set in PKZIP archive entries, given an level of compression expressed as an int (0..9).
           // Those flags may depend on used compression method
           unsigned short LevelToZipFlag();
@@ -61,11 +156,21 @@ namespace mgz {
           // Writes a local file header in the zip archive stream, and returns the offset of written header
           unsigned long write_local_file_header(const local_file_header& lfh);
 
-          // Compress a file to an archive, given a compressor. Central directory header is updated according to compression results.
-          central_directory_header compress_and_write_data(mgz::compress::compressor &comp, const central_directory_header &cdh);
+          // Compress a file to an archive. Central directory header is updated according to compression results.
+          central_directory_header compress_and_write_data(const std::string &path, const central_directory_header &cdh);
+
+          // Sets crc and sizes of a header by reading its file
+          void crc_of_file(const std::string &path, central_directory_header &cdh);
+
+          // Copies a file as is to the archive. Its local header is patched with the crc and sizes, so that the
+          // entry does not need a data descriptor. Central directory header is updated accordingly.
+          central_directory_header store_and_write_data(const std::string &path, const central_directory_header &cdh);
+
+          // Writes the central directory (existing entries, then the catalog if asked) into the archive stream.
+          void write_central_directory(bool with_catalog = true);
 
-          // Writes the central directory into the archive stream.
-          void write_central_directory();
+          // Writes a central directory file header into the archive stream.
+          void write_central_directory_header(const central_directory_header& cdh);
 
       };
     }
@@ -9,6 +9,7 @@ extern "C" {
 
 int mgz_deflate(mgz_stream *s);
 int mgz_inflate(mgz_stream *s);
+int mgz_inflate64(mgz_stream *s); /* Deflate64 (zip method 9) : 64 KiB window, inflate only */
 
 #ifdef __cplusplus
 }
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <iostream>
 #include <fstream>
 
 #include "mgz/export.h"
@@ -16,7 +17,8 @@ namespace mgz {
       RAW,
       GZIP,
       ZLIB,
-      PKZIP
+      PKZIP,
+      RAW64 // Raw Deflate64 stream (zip method 9), inflate only
     };
 
     class MGZ_API Z {
@@ -30,7 +32,7 @@ namespace mgz {
 
         void deflate(const std::vector<unsigned char> & in, std::vector<unsigned char> & out);
         void deflate(FILE *in, FILE *out);
-        void deflate(std::fstream & in, std::fstream & out);
+        void deflate(std::istream & in, std::ostream & out);
 
         // uncompress
         int inflate_init();
@@ -39,7 +41,7 @@ namespace mgz {
 
         void inflate(const std::vector<unsigned char> & in, std::vector<unsigned char> & out);
         void inflate(FILE *in, FILE *out);
-        void inflate(std::fstream & in, std::fstream & out);
+        void inflate(std::istream & in, std::ostream & out);
       
         unsigned int get_crc32();
         unsigned int get_compressed_size();
@@ -0,0 +1,151 @@
+#ifndef __MGZ_IO_ASYNC_IO_INCLUDE
+#define __MGZ_IO_ASYNC_IO_INCLUDE
+/*!
+ * \file io/async_io.h
+ * \brief Asynchronous file operations
+ */
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "mgz/export.h"
+#include "io/file.h"
+#include "util/thread.h"
+
+namespace mgz {
+  namespace io {
+    /*!
+     * \class async_callback
+     * \brief Receives the result of an operation queued in an mgz::io::async_io
+     */
+    class MGZ_API async_callback {
+      public:
+        virtual ~async_callback() {}
+
+        /*!
+         * \brief Called from async_io::wait, in the waiting thread. New operations may be queued from here.
+         * \param result : The result of the system call (byte count, file descriptor, 0), or -errno on failure
+         */
+        virtual void completed(long result) = 0;
+    };
+
+    /*!
+     * \brief Implementations of mgz::io::async_io
+     */
+    enum async_backend {
+      ASYNC_AUTO,   //!< io_uring when the system provides it, worker threads otherwise
+      ASYNC_THREADS //!< Worker threads running blocking system calls
+    };
+
+    /*!
+     * \class async_io
+     * \brief Queue of asynchronous reads, writes, opens and stats, meant to keep many file operations
+     *        in flight at once.
+     *
+     * On Linux, operations go through an io_uring : they are queued in the submission ring and handed
+     * to the kernel in batches, by submit() or wait(). Elsewhere, or when io_uring is not available,
+     * a thread pool runs the blocking calls. In both cases, callbacks are only called by wait(), from
+     * the waiting thread. Buffers, and status structures, must stay valid until their callback is called.
+     * An async_io is not thread safe : it is meant to be driven by one thread.
+     */
+    class MGZ_API async_io {
+      public:
+        /*!
+         * \param depth : Maximum number of operations in flight
+         * \param backend : The implementation to use
+         */
+        async_io(unsigned int depth = 64, async_backend backend = ASYNC_AUTO);
+
+        /*!
+         * \brief Wait for the operations in flight, without calling their callbacks
+         */
+        ~async_io();
+
+        /*!
+         * \brief Queue a read of length bytes of fd, at offset
+         */
+        void read(int fd, void * buffer, unsigned long length, long long offset, async_callback * callback);
+
+        /*!
+         * \brief Queue a write of length bytes to fd, at offset
+         */
+        void write(int fd, const void * buffer, unsigned long length, long long offset, async_callback * callback);
+
+        /*!
+         * \brief Queue an open ; the callback receives the file descriptor
+         */
+        void open(const std::string & path, int flags, int mode, async_callback * callback);
+
+        /*!
+         * \brief Queue a stat (links followed) ; status is filled before the callback is called
+         */
+        void stat(const std::string & path, file_status * status, async_callback * callback);
+
+        /*!
+         * \brief Hand the queued operations to the system, without waiting
+         */
+        void submit();
+
+        /*!
+         * \brief Wait for all the operations, including the ones queued by callbacks, calling their callbacks
+         */
+        void wait();
+
+        /*!
+         * \brief Number of operations queued or in flight, whose callbacks have not been called
+         */
+        unsigned long pending() const;
+
+        /*!
+         * \brief Maximum number of operations in flight
+         */
+        unsigned int depth() const;
+
+        /*!
+         * \return True if the operations go through an io_uring
+         */
+        bool uses_io_uring() const;
+
+      private:
+        struct operation;
+        struct ring;
+
+        class operation_task : public mgz::util::task {
+          public:
+            operation_task(async_io * io, operation * op) : io_(io), op_(op) {}
+            void run() { io_->run(op_); }
+          private:
+            async_io * io_;
+            operation * op_;
+        };
+
+        struct completion {
+          async_callback * callback;
+          long result;
+        };
+
+        async_io(const async_io &);
+        async_io & operator=(const async_io &);
+
+        operation * acquire();
+        void queue(operation * op);
+        void run(operation * op);
+        void reap(bool block);
+        void finish(operation * op);
+
+      private:
+        unsigned int depth_;
+        ring * ring_;
+        mgz::util::thread_pool * pool_;
+        std::vector<operation *> operations_;
+        std::vector<operation *> free_;
+        std::deque<completion> completed_;
+        unsigned long in_flight_; // Queued or running operations
+        mgz::util::mutex done_lock_;
+        mgz::util::condition done_;
+        std::vector<operation *> done_list_; // Finished by the thread pool, not reaped yet
+    };
+  }
+}
+
+#endif // __MGZ_IO_ASYNC_IO_INCLUDE
@@ -0,0 +1,108 @@
+#ifndef __MGZ_IO_CHECKSUM_CACHE_INCLUDE
+#define __MGZ_IO_CHECKSUM_CACHE_INCLUDE
+/*!
+ * \file io/checksum_cache.h
+ * \brief Persistent cache of file checksums
+ */
+#include <map>
+#include <string>
+#include <vector>
+
+#include "mgz/export.h"
+#include "util/thread.h"
+
+namespace mgz {
+  namespace io {
+    /*!
+     * \brief Checksum algorithms used to compare file contents
+     */
+    enum fs_checksum {
+      CHECKSUM_CRC32,
+      CHECKSUM_SHA1,
+      CHECKSUM_SHA256
+    };
+
+    /*!
+     * \brief Identity of a file content : a file is considered unchanged as long as its
+     *        device, inode, size and modification time (with nanoseconds when available) are.
+     */
+    struct file_identity {
+      unsigned long device;
+      unsigned long inode;
+      long long size;
+      long mtime;
+      long mtime_nsec;
+
+      bool operator<(const file_identity & other) const;
+      bool operator==(const file_identity & other) const;
+    };
+
+    /*!
+     * \class checksum_cache
+     * \brief Checksums of file contents, keyed by file identity, that can be saved and reloaded
+     *        so that repeated diffs only hash the files that changed. Thread safe.
+     */
+    class MGZ_API checksum_cache {
+      public:
+        checksum_cache();
+
+        /*!
+         * \brief Create a cache backed by the given file, loading it if it exists
+         * \param path : The cache file
+         */
+        checksum_cache(const std::string & path);
+
+        /*!
+         * \brief Read the identity of a file
+         * \return False if the file can't be stat'ed
+         */
+        static bool identify(const std::string & path, file_identity & id);
+
+        /*!
+         * \brief Return the checksum of a file, computing and caching it if needed
+         * \param path : The file to hash
+         * \param algorithm : The checksum algorithm
+         * \return The checksum, as a hexadecimal string, or an empty string if the file can't be read
+         */
+        std::string checksum(const std::string & path, fs_checksum algorithm);
+
+        /*!
+         * \brief Return several checksums of a file ; the ones missing from the cache are computed
+         *        together, reading the file once
+         * \param path : The file to hash
+         * \param algorithms : The checksum algorithms
+         * \param hashed : If not NULL, set to true if the file had to be read
+         * \return The checksums, in the order of the algorithms, as hexadecimal strings, or empty strings
+         *         if the file can't be read
+         */
+        std::vector<std::string> checksums(const std::string & path, const std::vector<fs_checksum> & algorithms, bool * hashed = NULL);
+
+        bool lookup(const file_identity & id, fs_checksum algorithm, std::string & digest);
+        void store(const file_identity & id, fs_checksum algorithm, const std::string & digest);
+
+        /*!
+         * \brief Write the cache to its backing file
+         * \return False if there is no backing file or if it can't be written
+         */
+        bool save();
+
+        unsigned long size();
+
+        /*!
+         * \brief Compute the checksum of a file, without any cache
+         * \return The checksum, as a hexadecimal string, or an empty string if the file can't be read
+         */
+        static std::string compute(const std::string & path, fs_checksum algorithm);
+
+      private:
+        void load();
+
+      private:
+        std::string path_;
+        mgz::util::mutex lock_;
+        std::map<std::pair<file_identity, int>, std::string> digests_;
+    };
+  }
+}
+
+#endif // __MGZ_IO_CHECKSUM_CACHE_INCLUDE
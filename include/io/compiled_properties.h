@@ -0,0 +1,95 @@
+#ifndef __MGZ_IO_COMPILED_PROPERTIES_INCLUDE
+#define __MGZ_IO_COMPILED_PROPERTIES_INCLUDE
+/*!
+ * \file io/compiled_properties.h
+ * \brief Binary form of a property list, read by mapping it in memory
+ */
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "mgz/export.h"
+#include "io/checksum_cache.h"
+#include "io/properties.h"
+
+namespace mgz {
+  namespace io {
+    /*!
+     * \class compiled_properties
+     * \brief A property list compiled in a binary file : a table of keys sorted for binary search, a
+     *        table of values and a heap of strings, after a header holding the identity of the file it
+     *        was compiled from. Opening it only maps it : nothing is parsed or copied, and lookups
+     *        read the mapping. The file is only readable on a machine with the same byte order.
+     */
+    class MGZ_API compiled_properties {
+      public:
+        compiled_properties();
+        ~compiled_properties();
+
+        /*!
+         * \brief Write a property list in its binary form
+         * \param p : The property list
+         * \param path : The binary file, replaced atomically
+         * \param source : Identity of the file the list was read from, checked by open ; NULL for none
+         * \return False if the file can't be written
+         */
+        static bool compile(const properties & p, const std::string & path, const file_identity * source = NULL);
+
+        /*!
+         * \brief Map a binary file
+         * \param path : The binary file
+         * \param source : If not empty, the file the list was read from : the binary file is only opened
+         *                 if it was compiled from this file, as it is now
+         * \return False if the file can't be mapped, is not valid, or is stale
+         */
+        bool open(const std::string & path, const std::string & source = "");
+        void close();
+        bool is_open() const;
+
+        /*!
+         * \brief Number of properties
+         */
+        unsigned long size() const;
+
+        /*!
+         * \brief Searches for the property with the specified key
+         * \param key : The property name
+         * \param values : Receives the values, valid until the file is closed
+         * \return False if the property is not set
+         */
+        bool find(const std::string & key, std::vector<property_view> & values) const;
+
+        /*!
+         * \brief Return the property value, or an empty string, as properties::get_property does
+         */
+        std::string get_property(const std::string & key) const;
+
+        /*!
+         * \brief Add all the properties to a property list
+         */
+        void load(properties & p) const;
+
+      private:
+        struct header;
+        struct key_entry;
+        struct value_entry;
+
+        compiled_properties(const compiled_properties &);
+        compiled_properties & operator=(const compiled_properties &);
+
+        property_view string_at(uint32_t offset, uint32_t size) const;
+        void values_of(const key_entry & key, std::vector<property_view> & values) const;
+
+      private:
+        const char * data_;
+        unsigned long size_;
+        bool mapped_;
+        const header * header_;
+        const key_entry * keys_;
+        const value_entry * values_;
+        const char * heap_;
+    };
+  }
+}
+
+#endif // __MGZ_IO_COMPILED_PROPERTIES_INCLUDE
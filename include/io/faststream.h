@@ -20,6 +20,23 @@ namespace mgz {
       in,
       out
     };
+
+    /*!
+     * \brief A window on the content of a faststream open for reading. The data is not
+     *        copied : it belongs to the stream and stays valid until the stream is closed.
+     */
+    struct faststream_view {
+      const unsigned char * data;
+      long size;
+    };
+
+    /*!
+     * \class faststream
+     * \brief Memory mapped file stream. For reading (mgz::io::out), the whole file is
+     *        mapped once on open and read sequentially, by windows of the given number of pages.
+     *        For writing (mgz::io::in), the file is allocated and mapped by large extents and
+     *        the data is written directly in the mapping ; it is cut to its final size on close.
+     */
     class MGZ_API faststream {
       public:
         faststream(const std::string & path, mode m);
@@ -28,13 +45,37 @@ namespace mgz {
         bool open(long i = 1);
         bool close();
         std::vector<unsigned char> read();
+
+        /*!
+         * \brief Return the next window of the file, without copying it
+         * \return The window ; its size is 0 at the end of the file
+         */
+        faststream_view view();
+
+        /*!
+         * \brief Append data to the file
+         * \return The number of bytes written since the file was open
+         */
         long write(const std::vector<unsigned char> & buffer);
+
+        /*!
+         * \brief Return a pointer where the next size bytes can be written. Nothing is written
+         *        until commit() is called ; the pointer is valid until the next reserve or close.
+         * \param size : Number of bytes to reserve
+         */
+        unsigned char * reserve(long size);
+
+        /*!
+         * \brief Append size bytes, written at the pointer returned by the last reserve()
+         */
+        void commit(long size);
         long gcount() const;
 
       private:
         void pages(long i);
         void get_file_size();
-        void flush(bool force = false);
+        void map(long offset, long size, bool writable);
+        void unmap();
 
       private:
         std::string path_;
@@ -46,7 +87,10 @@ namespace mgz {
         long offset_;
         long file_size_;
         long read_size_;
-        std::vector<unsigned char> buffer_;
+        long capacity_; // Allocated size of the file being written
+        unsigned char * mapping_;
+        long mapping_offset_;
+        long mapping_size_;
     };
   }
 }
@@ -10,6 +10,7 @@
  * \date mars 2012
  */
 #include <iostream>
+#include <map>
 #include <string>
 #include <vector>
 #include <sys/types.h>
@@ -68,9 +69,33 @@ namespace mgz {
    * \brief Namespace for mgz io tools
    */
   namespace io {
+#ifdef __WIN32__
+    typedef struct _stat file_status;
+#else
+    typedef struct stat file_status;
+#endif
+
+    class async_io;
+
+    /*!
+     * \brief Digest algorithms of mgz::io::file::digest, to be combined with |
+     */
+    enum file_digest {
+      DIGEST_CRC32 = 1,
+      DIGEST_ADLER32 = 2,
+      DIGEST_MD5 = 4,
+      DIGEST_SHA1 = 8,
+      DIGEST_SHA256 = 16,
+      DIGEST_RIPEMD160 = 32
+    };
+
     /*! \class mgz::io::file
      *
      * An abstract representation of file and directory pathnames.
+     *
+     * The metadata of the file is read once, on first use, and shared by all the predicates
+     * (exist, is_file, is_directory, size...). Methods modifying the file refresh it ; changes
+     * made by other means are only seen after a call to refresh().
      */
     class MGZ_API file {
       public:
@@ -80,11 +105,31 @@ namespace mgz {
          */
         file(std::string path);
 
+        /*!
+         * \brief Create a file with the given path and an already read metadata snapshot
+         * \param path : Path of the file
+         * \param status : Status of the file (links followed)
+         * \param lstatus : Status of the file itself (links not followed)
+         */
+        file(const std::string & path, const file_status & status, const file_status & lstatus);
+
         /*!
          * \brief Create a file with an empty path
          */
         file();
 
+        /*!
+         * \brief List the entries of a directory, with their metadata read while listing
+         * \param directory : Path of the directory
+         * \return The entries, sorted by path ; empty if the directory can't be read
+         */
+        static std::vector<file> list(const std::string & directory);
+
+        /*!
+         * \brief Forget the metadata snapshot : it will be read again on next use
+         */
+        void refresh();
+
         /*!
          * \brief This operator (<<), applied to an output stream, perform an output ot the file path
          */
@@ -399,12 +444,33 @@ namespace mgz {
          */
         uint32_t crc32();
 
+        /*!
+         * \brief Compute several digests of this file, reading it only once. When several algorithms
+         *        are requested, each one runs in its own thread, over a shared ring of blocks.
+         * \param algorithms : A combination of mgz::io::file_digest values
+         * \param parallel : If false, all the digests are computed by the calling thread, one block at a time
+         * \return The hexadecimal digests, by algorithm
+         * \throws FileShouldExistException if the file does not exist.
+         * \throws FileShouldNotBeFolderException if the file represents an existing directory
+         */
+        std::map<file_digest, std::string> digest(int algorithms, bool parallel = true);
+
+        /*!
+         * \brief Compute the crc32 checksums of several files, reading them concurrently
+         * \param files : The files
+         * \param io : The queue used to read the files ; its depth bounds the number of files read at once
+         * \return The checksums, in the order of the files
+         * \throws FileShouldExistException if a file can't be read
+         * \throws FileShouldNotBeFolderException if a file is a directory
+         */
+        static std::vector<uint32_t> crc32(std::vector<file> & files, async_io & io);
+
         mode_t get_mode();
         mode_t get_lmode();
 
       private:
         std::string tilde_to_home(std::string path);
-        void initialize_status();
+        bool load_status();
         bool is_type(mode_t);
         bool is_ltype(mode_t);
 
@@ -412,13 +478,8 @@ namespace mgz {
         std::string filepath_;
 
         bool status_set_;
-#ifdef __WIN32__
-        struct _stat status_;
-        struct _stat lstatus_;
-#else
-        struct stat status_;
-        struct stat lstatus_;
-#endif
+        file_status status_;
+        file_status lstatus_;
     };
   }
 }
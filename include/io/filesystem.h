@@ -1,5 +1,5 @@
 #ifndef __MGZ_IO_FILESYSTEM_INCLUDE
-#define __MGZ_IO__FILESYSTEM_INCLUDE
+#define __MGZ_IO_FILESYSTEM_INCLUDE
 /*!
  * \file io/filesystem.h
  * \brief Filesystem manipulation
@@ -13,6 +13,8 @@
 
 #include "mgz/export.h"
 #include "io/file.h"
+#include "io/checksum_cache.h"
+#include "io/walker.h"
 #include "util/units.h"
 
 /*! \namespace mgz
@@ -30,7 +32,9 @@ namespace mgz {
       RIGHT_ONLY,
       BOTH,
       FORCE_REPLACE,
-      NONE
+      NONE,
+      IDENTICAL, // Present on both sides, same content (fs::get_content_diff)
+      MODIFIED   // Present on both sides, different content (fs::get_content_diff)
     };
     struct fs_diff {
       file left;
@@ -59,6 +63,66 @@ namespace mgz {
         }
     };
 
+    /*!
+     * \class fs_iterator
+     * \brief Forward iterator over a directory tree, reading directories as it goes.
+     *
+     * Only one directory handle per level of the current path is kept open, so memory does not grow
+     * with the size of the tree, and the first entries are available before the tree is fully read.
+     * Entries are returned in directory order. Symbolic links to directories are not followed.
+     * Copies of an iterator share their position.
+     */
+    class MGZ_API fs_iterator {
+      public:
+        /*!
+         * \brief The end iterator
+         */
+        fs_iterator();
+
+        /*!
+         * \param root : The directory to list
+         * \param recursive : Descend into subdirectories
+         * \param relative : Return paths relative to the root
+         * \param keep_dir : Also return directories
+         * \param filter : Entries rejected by this mgz::io::fsfilter (given as RIGHT_ONLY differences) are
+         *                 skipped, and rejected directories are not descended into
+         */
+        fs_iterator(const std::string & root, bool recursive = true, bool relative = false, bool keep_dir = false, fsfilter * filter = NULL);
+        fs_iterator(const fs_iterator & other);
+        fs_iterator & operator=(const fs_iterator & other);
+        ~fs_iterator();
+
+        file & operator*();
+        file * operator->();
+        fs_iterator & operator++();
+        bool operator==(const fs_iterator & other) const;
+        bool operator!=(const fs_iterator & other) const;
+
+        /*!
+         * \brief Type and paths of the current entry
+         */
+        const walk_entry & entry() const;
+
+        /*!
+         * \brief Do not descend into the current directory
+         */
+        void prune();
+
+        /*!
+         * \brief Return true if a directory of the tree could not be read
+         */
+        bool failed() const;
+
+      private:
+        struct state;
+
+        void release();
+        bool at_end() const;
+
+      private:
+        state * state_;
+    };
+
     class MGZ_API fs {
       public:
         fs(std::string);
@@ -103,6 +167,22 @@ namespace mgz {
          */
         std::vector<fs_diff> get_diff(fs dest, bool keep_version, fsfilter *filter = NULL);
 
+        /*!
+         * \brief Return a vector of differences between this abstract filesystem and a given one, where
+         *        files present on both sides are reported as IDENTICAL or MODIFIED instead of BOTH.
+         *
+         * Files with different sizes are modified, files with the same size and modification time are
+         * identical ; the remaining pairs are hashed in parallel.
+         * \param dest : The abstract filesystem to compare
+         * \param keep_version : If false, the two file systems are compared, without taking care of version in the file names
+         * \param algorithm : The checksum used to compare contents
+         * \param cache : A mgz::io::checksum_cache, to avoid hashing files again in later diffs
+         * \param filter : A mgz::io::fsfilter object, given the classified differences
+         * \return A vector of differences
+         */
+        std::vector<fs_diff> get_content_diff(fs dest, bool keep_version = true, fs_checksum algorithm = CHECKSUM_SHA1,
+            checksum_cache *cache = NULL, fsfilter *filter = NULL);
+
         /*!
          * \brief Return a vector of files from this abstract file system
          * \param recursive : Search files recursivly
@@ -122,6 +202,16 @@ namespace mgz {
          */
         std::vector<file> all_files(bool recursive, bool relative);
 
+        /*!
+         * \brief Return a vector of files from this abstract file system, listed by several threads
+         * \param recursive : Search files recursivly
+         * \param relative : Keep path relative in the output vector
+         * \param threads : Number of threads, 0 for one per online processor ; the other threads
+         *        are only started once enough directories are queued
+         * \return A vector of files
+         */
+        std::vector<file> all_files(bool recursive, bool relative, unsigned int threads);
+
         std::vector<file> content();
 
         /*!
@@ -131,10 +221,13 @@ namespace mgz {
         bool remove_content();
 
         /*!
-         * \brief Copy the content of the current abstract filesystem to destination
+         * \brief Copy the content of the current abstract filesystem to destination.
+         *        Directories are created first, then files are copied concurrently.
+         * \param destination : The destination filesystem
+         * \param threads : Number of files copied at once, 0 for one per online processor
          * \return True on success, false otherwise
          */
-        bool copy_content(const fs & destination);
+        bool copy_content(const fs & destination, unsigned int threads = 0);
 
         /*!
          * \brief the root path string of this abstract filesystem
@@ -158,25 +251,32 @@ namespace mgz {
        */
       std::vector<file> all_files_filtered(/*const*/ fsfilter &filter, bool keep_ignored=false);
 
+      /*!
+       * \brief Return an iterator over the files of this abstract file system, read lazily
+       * \param recursive : Search files recursivly
+       * \param relative : Keep path relative
+       * \param filter : Skip the entries rejected by this filter, and the content of rejected directories
+       * \return An iterator, to compare with fs::end()
+       */
+      fs_iterator begin(bool recursive = true, bool relative = false, fsfilter *filter = NULL);
+      static fs_iterator end();
+
       private:
-        static bool search_predicate_with_version(file, file);
-        static bool search_predicate_without_version(file, file);
+        static std::string diff_key(file f, bool keep_version);
+        static std::vector<fs_diff> filter_diff(const std::vector<fs_diff> & diff, fsfilter *filter);
+        std::vector<fs_diff> join(fs & dest, bool keep_version);
 
         void set_root_path(std::string path); 
 
-        int getdir_(std::string root, bool recursive, bool relative, bool keep_dir);
-        int getdir_(bool recursive, bool relative, bool keep_dir);
+        int getdir_(std::string root, bool recursive, bool relative, bool keep_dir, unsigned int threads = 1);
+        int getdir_(bool recursive, bool relative, bool keep_dir, unsigned int threads = 1);
         std::vector<file> files_;
     };
   }
 }
 
-#define MGZ_FS_MERGE(a,b)  a##b
-#define MGZ_FS_VECTOR(a) MGZ_FS_MERGE(__mgz_util_fs__vector, a)
-#define MGZ_FS_UNIQUE_VECTOR MGZ_FS_VECTOR(__LINE__)
-
 #define FS_EACH_FILE(F, P, REC, REL) \
-  std::vector<mgz::io::file> MGZ_FS_UNIQUE_VECTOR = mgz::io::fs(P).all_files(REC, REL); for(std::vector<mgz::io::file>::iterator F = MGZ_FS_UNIQUE_VECTOR.begin(); F < MGZ_FS_UNIQUE_VECTOR.end(); F++)
+  for(mgz::io::fs_iterator F(P, REC, REL); F != mgz::io::fs_iterator(); ++F)
 
 #define EACH_FILES(F, P) FS_EACH_FILE(F, P, false, false)
 #define EACH_FILES_R(F, P) FS_EACH_FILE(F, P, true, false)
@@ -0,0 +1,78 @@
+#ifndef __MGZ_IO_LINE_READER_INCLUDE
+#define __MGZ_IO_LINE_READER_INCLUDE
+/*!
+ * \file io/line_reader.h
+ * \brief Buffered reading of text files, line by line
+ */
+#include <string>
+#include <vector>
+
+#include "mgz/export.h"
+
+namespace mgz {
+  namespace io {
+    /*!
+     * \brief A line returned by mgz::io::line_reader, without its end of line. The data is not
+     *        copied : it belongs to the reader and stays valid until the next call to next().
+     */
+    struct line_view {
+      const char * data;
+      unsigned long size;
+
+      std::string str() const { return std::string(data, size); }
+    };
+
+    /*!
+     * \class line_reader
+     * \brief Reads a file by large blocks and splits it in lines in place, so that no memory is
+     *        allocated per line. Lines end with \\n or \\r\\n ; the last line may have no end of line.
+     */
+    class MGZ_API line_reader {
+      public:
+        /*!
+         * \brief Open a file ; check is_open() before reading
+         * \param path : The file to read
+         */
+        line_reader(const std::string & path);
+
+        /*!
+         * \brief Read from an open file descriptor, from its current position. The descriptor is
+         *        not closed by the reader.
+         */
+        line_reader(int fd);
+
+        ~line_reader();
+
+        bool is_open() const;
+
+        /*!
+         * \brief Return the next line
+         * \param line : Receives the line
+         * \return False at the end of the file, or on error
+         */
+        bool next(line_view & line);
+
+        /*!
+         * \brief Return true if the file could not be read
+         */
+        bool failed() const;
+
+      private:
+        line_reader(const line_reader &);
+        line_reader & operator=(const line_reader &);
+
+        long fill();
+
+      private:
+        int fd_;
+        bool owned_;
+        bool failed_;
+        bool eof_;
+        std::vector<char> buffer_;
+        unsigned long start_; // First byte of buffer_ not returned yet
+        unsigned long end_;   // End of the data read in buffer_
+    };
+  }
+}
+
+#endif // __MGZ_IO_LINE_READER_INCLUDE
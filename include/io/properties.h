@@ -17,6 +17,7 @@
 
 #include "mgz/export.h"
 #include "io/file.h"
+#include "io/checksum_cache.h"
 
 #define PROPERTIES_SEPARATOR ','
 
@@ -35,7 +36,24 @@ namespace mgz {
     
     class MGZ_API PropertyFileNotFoundException {};
     class MGZ_API PropertyFileOpenException {};
+
+    /*!
+     * \brief A key or a value stored in a mgz::io::properties. The data is not copied : it stays
+     *        valid until the property list is modified.
+     */
+    struct property_view {
+      const char * data;
+      unsigned long size;
+
+      std::string str() const { return std::string(data, size); }
+    };
     
+    /*!
+     * \class properties
+     * \brief A set of properties, each one with a list of values. Keys and values are copied once
+     *        in an arena owned by the list, and keys are found through a hash table, so that
+     *        lookups and appends do not copy the values.
+     */
     class MGZ_API properties {
       public:
         /*!
@@ -47,6 +65,34 @@ namespace mgz {
          * \param file : The abstract pathname file
          */
         properties(mgz::io::file file);
+        properties(const properties & other);
+        properties & operator=(const properties & other);
+        ~properties();
+
+        /*!
+         * \brief Searches for the property with the specified key, without copying its values.
+         * \param key : The property name
+         * \return The values, valid until the property list is modified, or NULL if the property is not set
+         */
+        const std::vector<property_view> * find(const std::string & key) const;
+
+        /*!
+         * \brief Make room for the given number of properties, before adding many of them
+         */
+        void reserve(unsigned long count);
+
+        /*!
+         * \brief Return the keys, sorted, valid until the property list is modified
+         */
+        std::vector<property_view> keys() const;
+
+        /*!
+         * \brief Append values to a property, as they are (they are not trimmed)
+         * \param key : The property name
+         * \param values : The values
+         * \param count : Number of values
+         */
+        void add_values(const property_view & key, const property_view * values, unsigned long count);
 
         /*!
          * \brief Searches for the property with the specified key in this property list.
@@ -101,11 +147,22 @@ namespace mgz {
         void add_properties(std::string key, std::vector<std::string> values);
 
         /*!
-         * \brief Create a property list by reading it from the input abstract pathname
+         * \brief Add the properties read from the input abstract pathname. Lines are parsed in
+         *        place and their keys and values copied directly in the property list.
          * \param file : The abstract pathname file
          */
         void load(mgz::io::file file);
 
+        /*!
+         * \brief Add the properties read from the input abstract pathname, through a compiled
+         *        cache (mgz::io::compiled_properties) : if the cache was compiled from the file as it
+         *        is now, it is read instead of the file ; otherwise the file is parsed and the cache
+         *        written again.
+         * \param file : The abstract pathname file
+         * \param cache : The compiled cache
+         */
+        void load(mgz::io::file file, mgz::io::file cache);
+
         /*!
          * \brief Writes this property list (key and element pairs) in this Properties table to the file denoted by the given abstract pathname
          * \param file : The abstract pathname file
@@ -123,6 +180,14 @@ namespace mgz {
          */
         void load_xml(mgz::io::file file);
 
+        /*!
+         * \brief Add the properties read from the XML input abstract pathname, through a compiled
+         *        cache, as load(file, cache) does
+         * \param file : The abstract pathname file
+         * \param cache : The compiled cache
+         */
+        void load_xml(mgz::io::file file, mgz::io::file cache);
+
         /*!
          * \brief Emits an XML document representing all of the properties contained in this table.
          * \param file : The abstract pathname file
@@ -145,15 +210,43 @@ namespace mgz {
 		/*!
          * \brief Returns the total number of entries (single or multi-valued).
          */
-		int count_all_props() {return datas.size();}
+		int count_all_props() const {return count_;}
 		
       private:
+        struct entry {
+          entry() : hash(0), used(false) {}
+
+          unsigned long hash;
+          property_view key;
+          std::vector<property_view> values;
+          bool used;
+        };
+
         std::vector<std::string> split(const std::string &s, char delim);
         std::vector<std::string> &split(const std::string &s, char delim, std::vector<std::string> &elems);
         std::string join(std::vector<std::string> vector, char delim);
 
+        long index_of(const char * key, unsigned long size) const;
+        unsigned long insert(const char * key, unsigned long size);
+        void append(unsigned long index, const char * value, unsigned long size);
+        void release_values(unsigned long index);
+        void rehash(unsigned long size);
+        std::vector<const entry *> sorted() const;
+        property_view intern(const char * data, unsigned long size);
+        void compact();
+        void swap(properties & other);
+        void merge(const properties & other);
+        bool load_compiled(mgz::io::file & file, mgz::io::file & cache);
+        static void store_compiled(const properties & parsed, mgz::io::file & file, mgz::io::file & cache, const file_identity * before);
+
       private:
-        std::map<std::string, std::vector<std::string> > datas;
+        std::vector<entry> table_; // Open addressing, linear probing ; the size is a power of 2
+        unsigned long count_;
+        std::vector<char *> blocks_; // The arena : keys and values are never moved while they are used
+        char * current_;
+        unsigned long current_used_;
+        unsigned long arena_bytes_; // Bytes copied in the arena
+        unsigned long garbage_; // Bytes of the arena no longer used by a key or a value
         mgz::io::file propertiesFile;
     };
   }
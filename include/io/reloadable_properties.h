@@ -0,0 +1,164 @@
+#ifndef __MGZ_IO_RELOADABLE_PROPERTIES_INCLUDE
+#define __MGZ_IO_RELOADABLE_PROPERTIES_INCLUDE
+/*!
+ * \file io/reloadable_properties.h
+ * \brief Properties file reloaded when it changes
+ */
+#include <map>
+#include <string>
+#include <vector>
+
+#include "mgz/export.h"
+#include "io/checksum_cache.h"
+#include "io/file.h"
+#include "io/properties.h"
+#include "util/thread.h"
+
+namespace mgz {
+  namespace io {
+    /*!
+     * \class property_listener
+     * \brief Receives the changes of a property of a mgz::io::reloadable_properties
+     */
+    class MGZ_API property_listener {
+      public:
+        virtual ~property_listener() {}
+
+        /*!
+         * \brief Called, from the thread that reloaded the file, when the values of a property changed
+         * \param key : The property name
+         * \param values : The new values, valid during the call, or NULL if the property was removed
+         */
+        virtual void changed(const std::string & key, const std::vector<property_view> * values) = 0;
+    };
+
+    /*!
+     * \class reloadable_properties
+     * \brief A properties file, reloaded when it changes.
+     *
+     * Each version of the file is parsed in a new mgz::io::properties, which is never modified once
+     * published : the current version is replaced by an atomic pointer swap. Readers take the current
+     * version with a reloadable_properties::reader, without locking : a reader only increments and
+     * decrements a counter, and a replaced version is only deleted once the readers that could have
+     * seen it are gone. The file is watched by a thread, with inotify when available, and by
+     * comparing its identity (mgz::io::file_identity) at a fixed interval otherwise. A version that
+     * can't be read or parsed is ignored : the previous one stays current.
+     */
+    class MGZ_API reloadable_properties {
+      public:
+        /*!
+         * \class reader
+         * \brief Gives access to the current version for the lifetime of the reader. Meant to be short
+         *        lived : a reload waits for the readers of the version it replaces.
+         */
+        class MGZ_API reader {
+          public:
+            reader(const reloadable_properties & source);
+            ~reader();
+
+            const properties & operator*() const { return *properties_; }
+            const properties * operator->() const { return properties_; }
+
+          private:
+            reader(const reader &);
+            reader & operator=(const reader &);
+
+          private:
+            const reloadable_properties & source_;
+            unsigned long slot_;
+            const properties * properties_;
+        };
+
+        /*!
+         * \brief Load the file ; it is not watched until start() is called
+         * \param file : The properties file
+         * \throws PropertyFileNotFoundException if the file does not exist
+         * \throws PropertyFileOpenException if the file can't be read
+         */
+        reloadable_properties(const mgz::io::file & file);
+
+        /*!
+         * \brief Stop watching the file
+         */
+        ~reloadable_properties();
+
+        /*!
+         * \brief Watch the file from a thread, reloading it when it changes
+         * \param interval : Milliseconds between two checks of the file identity. With inotify, this only
+         *                   bounds the delay when an event is missed.
+         */
+        void start(unsigned int interval = 1000);
+
+        /*!
+         * \brief Stop watching the file
+         */
+        void stop();
+
+        /*!
+         * \brief Parse the file and publish it, then notify the listeners of the changed properties
+         * \return False if the file could not be read ; the current version is kept
+         */
+        bool reload();
+
+        /*!
+         * \brief Return the first value of a property in the current version, as properties::get_property does
+         */
+        std::string get_property(const std::string & key) const;
+
+        /*!
+         * \brief Call the listener each time the values of the property change. The listener must
+         *        outlive this object, or be unsubscribed.
+         */
+        void subscribe(const std::string & key, property_listener * listener);
+        void unsubscribe(property_listener * listener);
+
+        /*!
+         * \brief Number of versions published since the creation, the first one included
+         */
+        unsigned long version() const;
+
+        /*!
+         * \brief Return true if the file is watched with inotify rather than by polling its identity
+         */
+        bool uses_inotify() const;
+
+      private:
+        class watch_task : public mgz::util::task {
+          public:
+            watch_task(reloadable_properties * p) : properties_(p) {}
+            void run() { properties_->watch(); }
+          private:
+            reloadable_properties * properties_;
+        };
+
+        reloadable_properties(const reloadable_properties &);
+        reloadable_properties & operator=(const reloadable_properties &);
+
+        void publish(properties * next);
+        void wait_readers(unsigned long slot);
+        void notify(const properties & previous, const properties & current);
+        void watch();
+        bool changed();
+
+      private:
+        mgz::io::file file_;
+        properties * volatile current_;
+        volatile unsigned long epoch_; // Its parity selects the reader counter used by new readers
+        mutable volatile long readers_[2];
+        volatile unsigned long version_;
+        mgz::util::mutex reload_lock_; // Serializes reloads
+        mgz::util::mutex listeners_lock_;
+        std::multimap<std::string, property_listener *> listeners_;
+        file_identity identity_; // Identity of the file last loaded
+        bool identified_;
+        unsigned int interval_;
+        volatile bool stopping_;
+        int notify_fd_; // inotify descriptor, -1 when polling
+        int wake_fds_[2]; // Pipe waking the watcher up when it must stop
+        mgz::util::thread_pool * watcher_;
+        watch_task task_;
+    };
+  }
+}
+
+#endif // __MGZ_IO_RELOADABLE_PROPERTIES_INCLUDE
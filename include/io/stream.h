@@ -28,6 +28,19 @@ namespace mgz {
      * \return The same as is
      */
     MGZ_API std::istream& __cdecl get_line(std::istream & is, std::string & t);
+
+    /*!
+     * \brief Copies length bytes of fd_in, starting at offset, to the current
+     *        position of fd_out. When the system supports it (copy_file_range,
+     *        sendfile), data is copied by the kernel and never transits through
+     *        user space buffers.
+     * \param fd_in : File descriptor to read from (its position is not used)
+     * \param offset : Offset of the first byte to copy in fd_in
+     * \param fd_out : File descriptor to write to
+     * \param length : Number of bytes to copy
+     * \return The number of bytes copied, or -1 on error
+     */
+    MGZ_API long __cdecl copy_fd(int fd_in, long offset, int fd_out, long length);
   }
 }
 #endif // __MGZ_IO_STREAM_H
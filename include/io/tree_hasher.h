@@ -0,0 +1,81 @@
+#ifndef __MGZ_IO_TREE_HASHER_INCLUDE
+#define __MGZ_IO_TREE_HASHER_INCLUDE
+/*!
+ * \file io/tree_hasher.h
+ * \brief Checksums of all the files of a directory tree
+ */
+#include <string>
+#include <vector>
+
+#include "mgz/export.h"
+#include "io/checksum_cache.h"
+#include "io/filesystem.h"
+#include "util/thread.h"
+
+namespace mgz {
+  namespace io {
+    /*!
+     * \brief Checksums of a file found by mgz::io::tree_hasher
+     */
+    struct tree_checksum {
+      std::string path;                 //!< Path of the file, relative to the root
+      std::vector<std::string> digests; //!< Hexadecimal checksums, in the order of the algorithms ; empty if the file can't be read
+    };
+
+    /*!
+     * \class tree_hasher
+     * \brief Computes the checksums of all the files of a tree on a thread pool.
+     *
+     * Checksums are looked up in a mgz::io::checksum_cache first : with a cache saved by a previous
+     * run, only the files whose identity (device, inode, size, modification time) changed are read.
+     * The files that are read are read once, whatever the number of algorithms.
+     */
+    class MGZ_API tree_hasher {
+      public:
+        /*!
+         * \param cache : The cache to use and to fill, NULL for none. The caller saves it.
+         * \param threads : Number of files hashed at once, 0 for one per online processor
+         */
+        tree_hasher(checksum_cache * cache = NULL, unsigned int threads = 0);
+
+        /*!
+         * \brief Compute the checksums of the files of a tree
+         * \param root : The directory to hash
+         * \param algorithms : The checksum algorithms
+         * \param result : Receives the checksums, sorted by path
+         * \param filter : Files rejected by this mgz::io::fsfilter (given as RIGHT_ONLY differences) are
+         *                 skipped, and rejected directories are not descended into
+         * \return False if a directory or a file could not be read
+         */
+        bool hash(const std::string & root, const std::vector<fs_checksum> & algorithms, std::vector<tree_checksum> & result,
+            fsfilter * filter = NULL);
+
+        /*!
+         * \brief Number of files read by the last call to hash ; the others came from the cache
+         */
+        unsigned long hashed() const;
+
+      private:
+        class hash_task : public mgz::util::task {
+          public:
+            hash_task(checksum_cache * cache, const std::string & path, const std::vector<fs_checksum> * algorithms, tree_checksum * result) :
+              cache_(cache), path_(path), algorithms_(algorithms), result_(result), hashed_(false) {}
+            void run() { result_->digests = cache_->checksums(path_, *algorithms_, &hashed_); }
+            bool hashed() const { return hashed_; }
+          private:
+            checksum_cache * cache_;
+            std::string path_;
+            const std::vector<fs_checksum> * algorithms_;
+            tree_checksum * result_;
+            bool hashed_;
+        };
+
+      private:
+        checksum_cache * cache_;
+        unsigned int threads_;
+        unsigned long hashed_;
+    };
+  }
+}
+
+#endif // __MGZ_IO_TREE_HASHER_INCLUDE
@@ -0,0 +1,123 @@
+#ifndef __MGZ_IO_WALKER_INCLUDE
+#define __MGZ_IO_WALKER_INCLUDE
+/*!
+ * \file io/walker.h
+ * \brief Directory tree traversal
+ */
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "mgz/export.h"
+#include "io/file.h"
+#include "util/thread.h"
+
+namespace mgz {
+  namespace io {
+    /*!
+     * \brief An entry found by mgz::io::walker
+     */
+    struct walk_entry {
+      std::string path;     //!< Path of the entry : the root joined with the relative path
+      std::string relative; //!< Path of the entry, relative to the root
+      bool is_directory;    //!< True for directories, and symbolic links to directories
+      bool is_symlink;
+      bool has_status;      //!< True when status and lstatus were read while listing (see walker::set_read_status)
+      file_status status;   //!< Status of the entry (links followed)
+      file_status lstatus;  //!< Status of the entry itself (links not followed)
+    };
+
+    /*!
+     * \class walk_callback
+     * \brief Receives the entries found by mgz::io::walker. Calls are serialized, so
+     *        implementations do not need to be thread safe.
+     */
+    class MGZ_API walk_callback {
+      public:
+        virtual ~walk_callback() {}
+
+        /*!
+         * \brief Called for each entry
+         * \return For a directory, false prevents the walker from descending into it
+         */
+        virtual bool entry(const walk_entry & e) = 0;
+    };
+
+    /*!
+     * \class walker
+     * \brief Lists a directory tree using several threads.
+     *
+     * The calling thread starts listing alone ; the other threads are only started once enough
+     * directories are queued, so small trees never pay for them. Each thread lists directories from
+     * its own queue, and steals pending directories from the other queues when it runs out of work. Entry types are taken from readdir when the system
+     * provides them, so most entries are never stat'ed. Symbolic links to directories are
+     * reported but not followed. The order of the entries is not specified.
+     */
+    class MGZ_API walker {
+      public:
+        /*!
+         * \param root : The directory to list
+         * \param threads : Number of threads, 0 for one per online processor
+         */
+        walker(const std::string & root, unsigned int threads = 0);
+
+        /*!
+         * \brief List the tree, calling the callback for each entry
+         * \param recursive : Descend into subdirectories
+         * \return False if a directory could not be opened
+         */
+        bool walk(walk_callback & callback, bool recursive = true);
+
+        /*!
+         * \brief Read the status of every entry while listing, relative to the open directory
+         * \param read : True to fill walk_entry::status and walk_entry::lstatus
+         */
+        void set_read_status(bool read);
+
+      private:
+        struct pending_dir {
+          std::string path;
+          std::string relative;
+        };
+
+        struct queue {
+          mgz::util::mutex lock;
+          std::deque<pending_dir> dirs;
+        };
+
+        class worker_task : public mgz::util::task {
+          public:
+            worker_task(walker * w, unsigned int index) : walker_(w), index_(index) {}
+            void run() { walker_->work(index_); }
+          private:
+            walker * walker_;
+            unsigned int index_;
+        };
+
+        void start_workers();
+        void work(unsigned int index);
+        bool next(unsigned int index, pending_dir & dir);
+        void push(unsigned int index, const pending_dir & dir);
+        void list(unsigned int index, const pending_dir & dir);
+        bool report(const walk_entry & e);
+
+      private:
+        std::string root_;
+        unsigned int threads_;
+        bool recursive_;
+        bool read_status_;
+        walk_callback * callback_;
+        std::vector<queue *> queues_;
+        std::vector<worker_task> tasks_;
+        mgz::util::thread_pool * pool_; // Started by the calling thread, once enough directories are queued
+        mgz::util::mutex callback_lock_;
+        mgz::util::mutex idle_lock_;
+        mgz::util::condition idle_;
+        unsigned long generation_; // Incremented each time a directory is queued
+        long pending_; // Queued or being listed directories
+        bool failed_;
+    };
+  }
+}
+
+#endif // __MGZ_IO_WALKER_INCLUDE
@@ -0,0 +1,126 @@
+#ifndef __MGZ_UTIL_THREAD_H
+#define __MGZ_UTIL_THREAD_H
+
+#include "mgz/export.h"
+
+#include <deque>
+#include <vector>
+
+#ifdef __WIN32__
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace mgz {
+  namespace util {
+    // Non recursive mutex
+    class MGZ_API mutex {
+      public:
+        mutex();
+        ~mutex();
+
+        void lock();
+        void unlock();
+
+      private:
+        mutex(const mutex &);
+        mutex & operator=(const mutex &);
+
+        friend class condition;
+
+#ifdef __WIN32__
+        CRITICAL_SECTION mutex_;
+#else
+        pthread_mutex_t mutex_;
+#endif
+    };
+
+    // Locks a mutex for the lifetime of the object
+    class MGZ_API scoped_lock {
+      public:
+        scoped_lock(mutex & m) : mutex_(m) {
+          mutex_.lock();
+        }
+        ~scoped_lock() {
+          mutex_.unlock();
+        }
+
+      private:
+        scoped_lock(const scoped_lock &);
+        scoped_lock & operator=(const scoped_lock &);
+
+        mutex & mutex_;
+    };
+
+    // Condition variable, used with a locked mutex
+    class MGZ_API condition {
+      public:
+        condition();
+        ~condition();
+
+        void wait(mutex & m);
+        void signal();
+        void broadcast();
+
+      private:
+        condition(const condition &);
+        condition & operator=(const condition &);
+
+#ifdef __WIN32__
+        CONDITION_VARIABLE condition_;
+#else
+        pthread_cond_t condition_;
+#endif
+    };
+
+    // Unit of work run by a thread_pool
+    class MGZ_API task {
+      public:
+        virtual ~task() {}
+        virtual void run() = 0;
+    };
+
+    // Fixed set of worker threads running submitted tasks in FIFO order.
+    // Tasks are not owned by the pool, must outlive their execution and must not throw.
+    class MGZ_API thread_pool {
+      public:
+        // 0 : one thread per online processor
+        thread_pool(unsigned int threads = 0);
+        ~thread_pool(); // Waits for the submitted tasks
+
+        void submit(task * t);
+        // Blocks until every submitted task has run
+        void wait();
+
+        unsigned int size() const;
+        static unsigned int cpu_count();
+
+      private:
+        thread_pool(const thread_pool &);
+        thread_pool & operator=(const thread_pool &);
+
+#ifdef __WIN32__
+        static DWORD WINAPI worker(LPVOID pool);
+#else
+        static void * worker(void * pool);
+#endif
+        void work();
+
+      private:
+        mutex lock_;
+        condition available_;
+        condition done_;
+        std::deque<task *> tasks_;
+        unsigned long pending_; // Queued or running tasks
+        bool stopping_;
+#ifdef __WIN32__
+        std::vector<HANDLE> threads_;
+#else
+        std::vector<pthread_t> threads_;
+#endif
+    };
+  }
+}
+
+#endif // __MGZ_UTIL_THREAD_H
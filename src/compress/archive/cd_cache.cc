@@ -0,0 +1,227 @@
+#include "config.h"
+#include "compress/archive/cd_cache.h"
+#include "compress/archive/unzip.h"
+#include "compress/archive/internal/common.h"
+#include "util/exception.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fstream>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+namespace mgz {
+  namespace compress {
+    namespace archive {
+      static mgz::util::mutex instance_lock;
+      static central_directory_cache * cache_instance = NULL;
+
+      central_directory_cache & central_directory_cache::instance() {
+        mgz::util::scoped_lock lock(instance_lock);
+        if(NULL == cache_instance) {
+          cache_instance = new central_directory_cache();
+        }
+        return *cache_instance;
+      }
+
+      central_directory_cache::central_directory_cache() : max_archives_(CD_CACHE_MAX_ARCHIVES), max_bytes_(CD_CACHE_MAX_BYTES), bytes_(0) {}
+
+      central_directory_cache::~central_directory_cache() {
+        clear();
+      }
+
+      static void identify(const std::string & path, central_directory & directory) {
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+        if(0 != stat(path.c_str(), &st)) {
+          THROW(UncompressError, "Can't open archive %s", path.c_str());
+        }
+        directory.path = path;
+        directory.device = st.st_dev;
+        directory.inode = st.st_ino;
+        directory.size = st.st_size;
+        directory.mtime = st.st_mtime;
+#if defined(__APPLE__)
+        directory.mtime_nsec = st.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+        directory.mtime_nsec = st.st_mtim.tv_nsec;
+#else
+        directory.mtime_nsec = 0;
+#endif
+      }
+
+      static bool same_file(const central_directory & a, const central_directory & b) {
+        return a.device == b.device && a.inode == b.inode && a.size == b.size && a.mtime == b.mtime && a.mtime_nsec == b.mtime_nsec;
+      }
+
+      central_directory * central_directory_cache::parse(mgz::io::file & archive) {
+        central_directory * directory = new central_directory();
+        directory->mapping = NULL;
+        directory->refs = 1;
+        directory->cached = false;
+        try {
+          identify(archive.get_path(), *directory);
+          std::ifstream is(archive.get_path().c_str(), std::ios::binary | std::ios::in);
+          read_end_of_central_directory(is, directory->size, directory->eocdh);
+          read_central_directory(is, directory->size, directory->eocdh, directory->cd, directory->records);
+        } catch(...) {
+          delete directory;
+          throw;
+        }
+
+        directory->footprint = sizeof(central_directory) + directory->path.size() + directory->cd.size() +
+          directory->records.size() * sizeof(central_directory_record);
+        for(unsigned int i = 0; i < directory->records.size(); i++) {
+          const central_directory_record & record = directory->records[i];
+          std::string name(reinterpret_cast<const char*>(&directory->cd[0]) + record.data_offset, record.static_part.file_name_length);
+          directory->footprint += name.size() + 64; // Map node overhead
+          directory->index.insert(std::make_pair(name, i)); // The first entry wins if a name is repeated
+        }
+        return directory;
+      }
+
+      const central_directory * central_directory_cache::acquire(mgz::io::file & archive) {
+        central_directory current;
+        identify(archive.get_path(), current);
+        {
+          mgz::util::scoped_lock lock(lock_);
+          std::map<std::string, std::list<central_directory *>::iterator>::iterator it = by_path_.find(current.path);
+          if(it != by_path_.end() && same_file(**(it->second), current)) {
+            central_directory * directory = *(it->second);
+            lru_.splice(lru_.begin(), lru_, it->second);
+            directory->refs++;
+            return directory;
+          }
+        }
+
+        // Parsing is done without holding the lock
+        central_directory * directory = parse(archive);
+
+        mgz::util::scoped_lock lock(lock_);
+        std::map<std::string, std::list<central_directory *>::iterator>::iterator it = by_path_.find(directory->path);
+        if(it != by_path_.end()) {
+          if(same_file(**(it->second), *directory)) { // Parsed concurrently by another reader
+            destroy(directory);
+            directory = *(it->second);
+            lru_.splice(lru_.begin(), lru_, it->second);
+            directory->refs++;
+            return directory;
+          }
+          detach(*(it->second));
+        }
+        if(0 < max_archives_) {
+          lru_.push_front(directory);
+          by_path_[directory->path] = lru_.begin();
+          directory->cached = true;
+          bytes_ += directory->footprint;
+          evict();
+        }
+        return directory;
+      }
+
+      void central_directory_cache::release(const central_directory * directory) {
+        if(NULL == directory) {
+          return;
+        }
+        central_directory * d = const_cast<central_directory *>(directory);
+        mgz::util::scoped_lock lock(lock_);
+        d->refs--;
+        if(0 == d->refs && !d->cached) {
+          destroy(d);
+        }
+      }
+
+      const void * central_directory_cache::mapping(const central_directory * directory) {
+        central_directory * d = const_cast<central_directory *>(directory);
+        mgz::util::scoped_lock lock(lock_);
+        if(NULL != d->mapping) {
+          return d->mapping;
+        }
+#ifdef HAVE_SYS_MMAN_H
+        int fd = ::open(d->path.c_str(), O_RDONLY | O_BINARY);
+        if(-1 == fd || 0 >= d->size) {
+          if(-1 != fd) {
+            ::close(fd);
+          }
+          THROW(CantMapArchive, "Can't map archive %s", d->path.c_str());
+        }
+        void * data = mmap(NULL, d->size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(MAP_FAILED == data) {
+          THROW(CantMapArchive, "Can't map archive %s", d->path.c_str());
+        }
+        d->mapping = data;
+        return d->mapping;
+#else
+        THROW(CantMapArchive, "Memory mapped archives are not supported on this system");
+#endif
+      }
+
+      void central_directory_cache::detach(central_directory * directory) {
+        std::map<std::string, std::list<central_directory *>::iterator>::iterator it = by_path_.find(directory->path);
+        if(it != by_path_.end() && *(it->second) == directory) {
+          lru_.erase(it->second);
+          by_path_.erase(it);
+        }
+        bytes_ -= directory->footprint;
+        directory->cached = false;
+        if(0 == directory->refs) {
+          destroy(directory);
+        }
+      }
+
+      void central_directory_cache::destroy(central_directory * directory) {
+#ifdef HAVE_SYS_MMAN_H
+        if(NULL != directory->mapping) {
+          munmap(directory->mapping, directory->size);
+        }
+#endif
+        delete directory;
+      }
+
+      void central_directory_cache::evict() {
+        while(!lru_.empty() && (lru_.size() > max_archives_ || bytes_ > max_bytes_)) {
+          detach(lru_.back());
+        }
+      }
+
+      void central_directory_cache::invalidate(const std::string & path) {
+        mgz::util::scoped_lock lock(lock_);
+        std::map<std::string, std::list<central_directory *>::iterator>::iterator it = by_path_.find(path);
+        if(it != by_path_.end()) {
+          detach(*(it->second));
+        }
+      }
+
+      void central_directory_cache::clear() {
+        mgz::util::scoped_lock lock(lock_);
+        while(!lru_.empty()) {
+          detach(lru_.back());
+        }
+      }
+
+      void central_directory_cache::set_limits(unsigned long max_archives, unsigned long max_bytes) {
+        mgz::util::scoped_lock lock(lock_);
+        max_archives_ = max_archives;
+        max_bytes_ = max_bytes;
+        evict();
+      }
+
+      unsigned long central_directory_cache::number_of_archives() {
+        mgz::util::scoped_lock lock(lock_);
+        return lru_.size();
+      }
+
+      unsigned long central_directory_cache::footprint() {
+        mgz::util::scoped_lock lock(lock_);
+        return bytes_;
+      }
+    }
+  }
+}
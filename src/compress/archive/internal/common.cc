@@ -1,4 +1,8 @@
 #include "compress/archive/internal/common.h"
+#include "compress/archive/unzip.h"
+#include "util/exception.h"
+#include <string.h>
+#include <algorithm>
 
 short rotate(short x, int n) {
   return ~(~(x >> n) ^ ((x & ~(~0 << n))<<((sizeof (x)*8)-n)));
@@ -23,3 +27,92 @@ void zip_date_to_dos_time(short date, int *yy, int *mm, int *dd) {
 short dos_date_to_zip_date(int yy, int mm, int dd) {
   return ((yy - 1980)<<9) + (mm<<5) + dd;
 } 
+
+void read_end_of_central_directory(std::istream & is, long archive_size, end_of_central_directory_header & eocdh) {
+  long eocdh_buffer_size = EOCDH_STATIC_LENGTH + EOCDH_COMMENT_MAX_LENGTH;
+  long eocdh_offset = archive_size - eocdh_buffer_size;
+
+  if(0 > eocdh_offset) {
+    eocdh_offset = 0;
+    eocdh_buffer_size = archive_size;
+  }
+
+  if(EOCDH_STATIC_LENGTH > eocdh_buffer_size) {
+    THROW(MalformatedEndOfCentralDirectoryHeader, "Archive too small");
+  }
+
+  char magic[] = EOCDH_SIGNATURE_CHAR;
+
+  std::vector<unsigned char> buffer(eocdh_buffer_size);
+  is.seekg(eocdh_offset);
+  is.read(reinterpret_cast<char*>(&buffer[0]), eocdh_buffer_size);
+  is.clear();
+  is.seekg(0);
+
+  std::vector<unsigned char>::iterator pos = std::find_end(buffer.begin(), buffer.end(), magic, magic+4);
+  if (buffer.end() == pos || std::distance(pos, buffer.end()) < EOCDH_STATIC_LENGTH) {
+    THROW(MalformatedEndOfCentralDirectoryHeader, "End of central directory record was not found");
+  }
+  long available = std::distance(pos, buffer.end());
+  memcpy(&eocdh.static_part, &(*pos), EOCDH_STATIC_LENGTH);
+
+  if(eocdh.static_part.comment_length != available - EOCDH_STATIC_LENGTH) {
+    THROW(MalformatedEndOfCentralDirectoryHeader, "Wrong comment length");
+  }
+
+  if(eocdh.static_part.comment_length > 0) {
+    eocdh.comment.assign(reinterpret_cast<char*>(&(*pos)) + EOCDH_STATIC_LENGTH, eocdh.static_part.comment_length);
+  }
+}
+
+void read_central_directory(std::istream & is, long archive_size, const end_of_central_directory_header & eocdh, std::vector<unsigned char> & cd, std::vector<central_directory_record> & records) {
+  unsigned int cd_size = eocdh.static_part.central_directory_size;
+  int nb_cdh = eocdh.static_part.total_entries;
+
+  if(archive_size < 0 || (unsigned long)eocdh.static_part.central_directory_offset + cd_size > (unsigned long)archive_size) {
+    THROW(MalformatedCentralDirectoryHeader, "Central directory out of archive bounds");
+  }
+
+  // The whole central directory is read with a single call, then parsed in place.
+  cd.resize(cd_size);
+  if(0 < cd_size) {
+    is.seekg(eocdh.static_part.central_directory_offset);
+    is.read(reinterpret_cast<char*>(&cd[0]), cd_size);
+    if(cd_size != is.gcount()) {
+      THROW(MalformatedCentralDirectoryHeader, "Truncated central directory");
+    }
+  }
+
+  records.clear();
+  records.reserve(nb_cdh);
+
+  unsigned long offset = 0;
+  while(0 < nb_cdh--) {
+    central_directory_record cdr;
+    if(offset + CDH_STATIC_LENGTH > cd_size) {
+      THROW(MalformatedCentralDirectoryHeader, "Truncated central directory header");
+    }
+    memcpy(&cdr.static_part, &cd[offset], CDH_STATIC_LENGTH);
+    if(CDH_SIGNATURE != cdr.static_part.signature) {
+      THROW(MalformatedCentralDirectoryHeader, "Wrong signature");
+    }
+
+    if(0 >= cdr.static_part.file_name_length) {
+      THROW(MalformatedCentralDirectoryHeader, "Wrong file name length");
+    }
+
+    cdr.data_offset = offset + CDH_STATIC_LENGTH;
+    offset = cdr.data_offset
+      + cdr.static_part.file_name_length
+      + cdr.static_part.extra_field_length
+      + cdr.static_part.file_comment_length;
+    if(offset > cd_size) {
+      THROW(MalformatedCentralDirectoryHeader, "Truncated central directory header");
+    }
+
+    records.push_back(cdr);
+  }
+
+  is.clear();
+  is.seekg(0);
+}
@@ -1,23 +1,35 @@
+#include "config.h"
 #include "compress/archive/unzip.h"
+#include "compress/archive/internal/common.h"
 // FIXME : #include "util/log.h"
-#include "compress/compressor/raw.h"
+#include "compress/z.h"
+#include "io/stream.h"
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <algorithm>
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
 namespace mgz {
   namespace compress {
     namespace archive {
-      unzip::unzip(mgz::io::file & archive) : archive_(archive) {
-        archive_size_ = archive_.size();
+      unzip::unzip(mgz::io::file & archive) : archive_(archive), fd_(-1) {
+        directory_ = central_directory_cache::instance().acquire(archive_);
+        archive_size_ = directory_->size;
         is_.exceptions ( std::ifstream::badbit ); // dont set "failbit", as it may reflect normal conditions, when attempting to read more bytes than actually available in the file.
         is_.open(archive_.get_path().c_str(), std::ios::binary | std::ios::in);
-
-        read_eocdh();
-        read_cdh();
+        fd_ = ::open(archive_.get_path().c_str(), O_RDONLY | O_BINARY);
       }
 
       unzip::~unzip() {
         is_.close();
+        if(-1 != fd_) {
+          ::close(fd_);
+        }
+        central_directory_cache::instance().release(directory_);
       }
 
       void unzip::inflate() {
@@ -32,77 +44,16 @@ namespace mgz {
       }
 
       int unzip::number_of_entries() {
-        return cdh_.size();
+        return directory_->records.size();
       }
 
-      void unzip::read_eocdh() {
-        long eocdh_buffer_size = EOCDH_STATIC_LENGTH + EOCDH_COMMENT_MAX_LENGTH;
-        long eocdh_offset = archive_size_ - eocdh_buffer_size;
-
-        if(0 > eocdh_offset) {
-          eocdh_offset = 0;
-          eocdh_buffer_size = archive_size_;
-        }
-
-        char magic[] = EOCDH_SIGNATURE_CHAR;
-
-        std::vector<unsigned char> buffer(eocdh_buffer_size);
-        is_.seekg(eocdh_offset);
-        is_.read(reinterpret_cast<char*>(&buffer[0]), eocdh_buffer_size);
-        is_.seekg(0);
-
-        std::vector<unsigned char>::iterator pos = std::find_end(buffer.begin(), buffer.end(), magic, magic+4);
-        if (buffer.end() == pos) {
-          THROW(MalformatedEndOfCentralDirectoryHeader, "End of central directory record was not found");
-        }
-        int distance = std::distance(buffer.begin(), pos);
-        std::vector<char> eocdh(buffer.begin() + distance, buffer.end());
-        end_of_central_directory_header_static eocdh_static;
-        memcpy(&eocdh_static, std::string(eocdh.begin(), eocdh.begin()+EOCDH_STATIC_LENGTH).c_str(), EOCDH_STATIC_LENGTH);
-
-        eocdh_.static_part = eocdh_static;
-
-        if(eocdh_static.comment_length != eocdh.size() - EOCDH_STATIC_LENGTH) {
-          THROW(MalformatedEndOfCentralDirectoryHeader, "Wrong comment length");
-        }
-
-        if(eocdh_static.comment_length > 0) {
-          eocdh_.comment = std::string(eocdh.begin()+EOCDH_STATIC_LENGTH, eocdh.end());
-        }
+      int unzip::index_of(const std::string & file_name) {
+        std::map<std::string, int>::const_iterator it = directory_->index.find(file_name);
+        return it == directory_->index.end() ? -1 : it->second;
       }
 
-      void unzip::read_cdh() {
-        is_.seekg(eocdh_.static_part.central_directory_offset);
-
-        int nb_cdh = eocdh_.static_part.total_entries;
-
-        while(0 < nb_cdh--) {
-          central_directory_header cdh;
-          is_.read(reinterpret_cast<char*>(&cdh.static_part), CDH_STATIC_LENGTH);
-          if(CDH_SIGNATURE != cdh.static_part.signature) {
-            THROW(MalformatedCentralDirectoryHeader, "Wrong signature");
-          }
-
-          if(0 >= cdh.static_part.file_name_length) {
-            THROW(MalformatedCentralDirectoryHeader, "Wrong file name length");
-          }
-          cdh.data_part.file_name = std::string(cdh.static_part.file_name_length, 0);
-          is_.read(&cdh.data_part.file_name[0], cdh.static_part.file_name_length);
-
-          if(0 < cdh.static_part.extra_field_length) {
-            cdh.data_part.extra_field.resize(cdh.static_part.extra_field_length);
-            is_.read(reinterpret_cast<char *>(&cdh.data_part.extra_field[0]), cdh.static_part.extra_field_length);
-          }
-
-          if(0 < cdh.static_part.file_comment_length) {
-            cdh.data_part.file_comment = std::string(cdh.static_part.file_comment_length, 0);
-            is_.read(&cdh.data_part.file_comment[0], cdh.static_part.file_comment_length);
-          }
-
-          cdh_.push_back(cdh);
-        }
-
-        is_.seekg(0);
+      const char * unzip::cd_data(const central_directory_record & cdr) {
+        return reinterpret_cast<const char*>(&directory_->cd[0]) + cdr.data_offset;
       }
 
       void unzip::inflate_file_at_index(int i) {
@@ -125,19 +76,24 @@ namespace mgz {
                 }
                 // FIXME : Logger::info("Uncompress file %s", outfile.get_path().c_str());
 
-                std::vector<unsigned char> buffer(e.compressed_size);
-
-                is_.seekg(e.file_offset);
-                is_.read(reinterpret_cast<char*>(&buffer[0]), e.uncompressed_size);
-                is_.seekg(0);
-
-                std::ofstream os(outfile.get_path().c_str(), std::ios::binary);
-                os.write(reinterpret_cast<char*>(&buffer[0]), e.uncompressed_size);
-                os.close();
+                if(-1 == fd_) {
+                  THROW(UncompressError, "Can't read archive %s", archive_.get_path().c_str());
+                }
+                int os = ::open(outfile.get_path().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+                if(-1 == os) {
+                  THROW(UncompressError, "Can't create file %s", outfile.get_path().c_str());
+                }
+                // Stored data is copied from the archive by the kernel when possible
+                long copied = mgz::io::copy_fd(fd_, e.file_offset, os, e.compressed_size);
+                ::close(os);
+                if(copied != (long)e.compressed_size) {
+                  THROW(UncompressError, "Can't extract file %s", e.file_name.c_str());
+                }
               }
             }
             break;
           case CM_DEFLAT:
+          case CM_DEFLAT64:
             {
               mgz::io::file outfile = to.join(e.file_name);
               if(!outfile.get_parent_file().exist()) {
@@ -146,12 +102,11 @@ namespace mgz {
               // FIXME : Logger::info("Uncompress file %s", outfile.get_path().c_str());
               is_.seekg(e.file_offset);
               std::fstream os(outfile.get_path().c_str(), std::ios::binary | std::ios::out);
-              mgz::compress::compressor * cmp = new mgz::compress::raw(os, is_);
-              cmp->decompress();
-              if(e.crc32 != cmp->get_crc32()) {
-                THROW(UncompressError, "Wrong CRC32 %ld, expected %ld for file %s", cmp->get_crc32(), e.crc32, e.file_name.c_str());
+              mgz::compress::Z zipper(CM_DEFLAT64 == e.compression_method ? mgz::compress::RAW64 : mgz::compress::RAW);
+              zipper.inflate(is_, os);
+              if(e.crc32 != zipper.get_crc32()) {
+                THROW(UncompressError, "Wrong CRC32 %ld, expected %ld for file %s", (unsigned long)zipper.get_crc32(), e.crc32, e.file_name.c_str());
               }
-              delete cmp;
               os.close();
               is_.clear();
               is_.seekg(0);
@@ -165,12 +120,11 @@ namespace mgz {
       local_file_header unzip::read_lfh_at_index(int i) {
         local_file_header lfh;
 
-        if(cdh_.size() < i + 1) {
+        if(0 > i || directory_->records.size() < (unsigned int)i + 1) {
           THROW(UncompressError, "Entry %i does not exist", i);
         }
 
-        central_directory_header cdh = cdh_[i];
-        is_.seekg(cdh.static_part.offset_of_local_header);
+        is_.seekg(directory_->records[i].static_part.offset_of_local_header);
         is_.read(reinterpret_cast<char*>(&lfh.static_part), LFH_STATIC_LENGTH);
         if(LFH_SIGNATURE != lfh.static_part.signature) {
           THROW(MalformatedLocalFileHeader, "Wrong signature");
@@ -192,34 +146,55 @@ namespace mgz {
         return lfh;
       }
 
+      entry_view unzip::stored_view_at_index(int i) {
+        entry e = file_stat_at_index(i);
+        if(CM_STORE != e.compression_method) {
+          THROW(UnsupportedCompressionMethod, "Entry %s is not stored (compressor #%d)", e.file_name.c_str(), e.compression_method);
+        }
+        if((unsigned long)e.file_offset + e.compressed_size > (unsigned long)archive_size_) {
+          THROW(MalformatedLocalFileHeader, "Entry %s out of archive bounds", e.file_name.c_str());
+        }
+
+        const void * mapping = central_directory_cache::instance().mapping(directory_);
+
+        entry_view view;
+        view.data = reinterpret_cast<const unsigned char*>(mapping) + e.file_offset;
+        view.size = e.compressed_size;
+        return view;
+      }
+
       entry unzip::file_stat_at_index(int i) {
         entry e;
 
         local_file_header lfh = read_lfh_at_index(i);
-        central_directory_header cdh = cdh_[i];
+        const central_directory_record & cdr = directory_->records[i];
+        const char * data = cd_data(cdr);
 
         // TODO check lfh <-> cdh (raise if not)
 
-        e.crc32 = cdh.static_part.descriptor.crc32;
-        e.compressed_size = cdh.static_part.descriptor.compressed_size;
-        e.uncompressed_size = cdh.static_part.descriptor.uncompressed_size;
-        e.time = cdh.static_part.time;
-        e.date = cdh.static_part.date;
-        e.file_name = cdh.data_part.file_name;
-        e.file_comment = cdh.data_part.file_comment;
-        e.compression_method = cdh.static_part.compression_method;
-        e.file_offset = cdh.static_part.offset_of_local_header + LFH_STATIC_LENGTH + lfh.static_part.file_name_length + lfh.static_part.extra_field_length;
-
-        std::vector<unsigned char>::iterator pos = cdh.data_part.extra_field.begin();
-
-        while(pos < cdh.data_part.extra_field.end()) {
+        e.crc32 = cdr.static_part.descriptor.crc32;
+        e.compressed_size = cdr.static_part.descriptor.compressed_size;
+        e.uncompressed_size = cdr.static_part.descriptor.uncompressed_size;
+        e.time = cdr.static_part.time;
+        e.date = cdr.static_part.date;
+        e.file_name.assign(data, cdr.static_part.file_name_length);
+        data += cdr.static_part.file_name_length;
+        e.compression_method = cdr.static_part.compression_method;
+        e.file_offset = cdr.static_part.offset_of_local_header + LFH_STATIC_LENGTH + lfh.static_part.file_name_length + lfh.static_part.extra_field_length;
+
+        const char * pos = data;
+        const char * end = data + cdr.static_part.extra_field_length;
+        data = end;
+        e.file_comment.assign(data, cdr.static_part.file_comment_length);
+
+        while(pos + sizeof(short) * 2 <= end) {
           short header_id;
-          short data_size;
+          unsigned short data_size;
 
-          memcpy(&header_id, std::string(pos, pos + sizeof(header_id)).c_str(), sizeof(header_id));
+          memcpy(&header_id, pos, sizeof(header_id));
           pos += sizeof(header_id);
 
-          memcpy(&data_size, std::string(pos, pos + sizeof(data_size)).c_str(), sizeof(data_size));
+          memcpy(&data_size, pos, sizeof(data_size));
           pos += sizeof(data_size);
 
           switch(header_id) {
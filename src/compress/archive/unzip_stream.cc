@@ -0,0 +1,302 @@
+#include "compress/archive/unzip_stream.h"
+#include "compress/internal/flate.h"
+#include "compress/z.h"
+#include "security/crc32.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+
+namespace mgz {
+  namespace compress {
+    namespace archive {
+      unzip_stream::unzip_stream(std::istream & in) : in_(in), buffer_(BUFFER_SIZE), pos_(0), end_(0), offset_(0),
+        out_buffer_(BUFFER_SIZE), pending_(false), finished_(false) {
+        memset(&stream_, 0, sizeof(stream_));
+        memset(&lfh_, 0, sizeof(lfh_));
+      }
+
+      unzip_stream::~unzip_stream() {
+        free_inflate_state();
+      }
+
+      void unzip_stream::free_inflate_state() {
+        if(NULL != stream_.state) {
+          free(stream_.state);
+          stream_.state = NULL;
+        }
+      }
+
+      bool unzip_stream::fill(unsigned long needed) {
+        if(end_ - pos_ >= needed) {
+          return true;
+        }
+        if(0 < pos_) {
+          memmove(&buffer_[0], &buffer_[pos_], end_ - pos_);
+          end_ -= pos_;
+          pos_ = 0;
+        }
+        if(buffer_.size() < needed) {
+          buffer_.resize(needed);
+        }
+        while(end_ < needed && in_.good()) {
+          in_.read(reinterpret_cast<char*>(&buffer_[end_]), buffer_.size() - end_);
+          end_ += in_.gcount();
+        }
+        return end_ - pos_ >= needed;
+      }
+
+      void unzip_stream::read_bytes(void * data, unsigned long size) {
+        if(!fill(size)) {
+          THROW(MalformatedLocalFileHeader, "Unexpected end of archive");
+        }
+        memcpy(data, &buffer_[pos_], size);
+        pos_ += size;
+        offset_ += size;
+      }
+
+      bool unzip_stream::next_entry(entry & e) {
+        if(finished_) {
+          return false;
+        }
+        if(pending_) {
+          skip_entry();
+        }
+
+        unsigned int signature;
+        if(!fill(sizeof(signature))) {
+          finished_ = true;
+          return false;
+        }
+        memcpy(&signature, &buffer_[pos_], sizeof(signature));
+        if(LFH_SIGNATURE != signature) {
+          finished_ = true;
+          if(CDH_SIGNATURE == signature || EOCDH_SIGNATURE == signature) {
+            return false;
+          }
+          THROW(MalformatedLocalFileHeader, "Wrong signature at offset %lu", offset_);
+        }
+
+        read_bytes(&lfh_, LFH_STATIC_LENGTH);
+        current_ = entry();
+        current_.file_name = std::string(lfh_.file_name_length, 0);
+        if(0 < lfh_.file_name_length) {
+          read_bytes(&current_.file_name[0], lfh_.file_name_length);
+        }
+        if(0 < lfh_.extra_field_length) {
+          std::vector<unsigned char> extra_field(lfh_.extra_field_length);
+          read_bytes(&extra_field[0], lfh_.extra_field_length);
+        }
+        current_.crc32 = lfh_.descriptor.crc32;
+        current_.compressed_size = lfh_.descriptor.compressed_size;
+        current_.uncompressed_size = lfh_.descriptor.uncompressed_size;
+        current_.time = lfh_.time;
+        current_.date = lfh_.date;
+        current_.compression_method = lfh_.compression_method;
+        current_.file_offset = offset_;
+
+        pending_ = true;
+        e = current_;
+        return true;
+      }
+
+      void unzip_stream::copy_stored(std::ostream * out) {
+        if(lfh_.flags & DESCRIPTORS_AFTER_DATA) {
+          THROW(UnsupportedCompressionMethod, "Stored entry %s has no size in its local header", current_.file_name.c_str());
+        }
+        mgz::security::crc32sum crc;
+        unsigned long remaining = current_.compressed_size;
+        while(0 < remaining) {
+          if(!fill(1)) {
+            THROW(UncompressError, "Unexpected end of archive in %s", current_.file_name.c_str());
+          }
+          unsigned long count = end_ - pos_ < remaining ? end_ - pos_ : remaining;
+          if(NULL != out) {
+            out->write(reinterpret_cast<const char*>(&buffer_[pos_]), count);
+          }
+          crc.update(&buffer_[pos_], count);
+          pos_ += count;
+          offset_ += count;
+          remaining -= count;
+        }
+        crc.finalize();
+        if(current_.crc32 != crc.crc) {
+          THROW(UncompressError, "Wrong CRC32 %ld, expected %ld for file %s", crc.crc, current_.crc32, current_.file_name.c_str());
+        }
+        current_.uncompressed_size = current_.compressed_size;
+      }
+
+      void unzip_stream::inflate_deflated(std::ostream * out) {
+        mgz::security::crc32sum crc;
+        unsigned long produced = 0;
+
+        if(!fill(1)) {
+          THROW(UncompressError, "Unexpected end of archive in %s", current_.file_name.c_str());
+        }
+        stream_.err = 0;
+        stream_.state = 0;
+        stream_.next_in = &buffer_[pos_];
+        stream_.avail_in = end_ - pos_;
+        stream_.next_out = &out_buffer_[0];
+        stream_.avail_out = out_buffer_.size();
+
+        // The inflater keeps pointers in buffer_ until it asks for more input
+        bool done = false;
+        while(!done) {
+          switch(CM_DEFLAT64 == current_.compression_method ? ::mgz_inflate64(&stream_) : ::mgz_inflate(&stream_)) {
+            case FLATE_OUT:
+              if(NULL != out) {
+                out->write(reinterpret_cast<const char*>(stream_.next_out), stream_.avail_out);
+              }
+              crc.update(stream_.next_out, stream_.avail_out);
+              produced += stream_.avail_out;
+              stream_.avail_out = out_buffer_.size();
+              break;
+            case FLATE_IN:
+              offset_ += end_ - pos_;
+              pos_ = end_;
+              if(!fill(1)) {
+                free_inflate_state();
+                THROW(UncompressError, "Unexpected end of archive in %s", current_.file_name.c_str());
+              }
+              stream_.next_in = &buffer_[pos_];
+              stream_.avail_in = end_ - pos_;
+              break;
+            case FLATE_OK:
+              // Bytes following the end of the deflate stream are left unread
+              offset_ += (end_ - pos_) - stream_.avail_in;
+              pos_ = end_ - stream_.avail_in;
+              stream_.avail_in = 0;
+              done = true;
+              break;
+            default:
+              free_inflate_state();
+              THROW(UncompressError, "Can't inflate %s", current_.file_name.c_str());
+          }
+        }
+        crc.finalize();
+
+        if(lfh_.flags & DESCRIPTORS_AFTER_DATA) {
+          read_data_descriptor();
+        } else if(current_.compressed_size != offset_ - current_.file_offset) {
+          THROW(UncompressError, "Wrong compressed size for file %s", current_.file_name.c_str());
+        }
+        if(current_.crc32 != crc.crc) {
+          THROW(UncompressError, "Wrong CRC32 %ld, expected %ld for file %s", crc.crc, current_.crc32, current_.file_name.c_str());
+        }
+        current_.uncompressed_size = produced;
+      }
+
+      void unzip_stream::read_data_descriptor() {
+        unsigned long data_end = offset_;
+        unsigned int signature;
+        if(!fill(sizeof(signature))) {
+          THROW(MalformatedLocalFileHeader, "Missing data descriptor for %s", current_.file_name.c_str());
+        }
+        memcpy(&signature, &buffer_[pos_], sizeof(signature));
+        if(DDS_SIGNATURE == signature) {
+          read_bytes(&signature, sizeof(signature));
+        }
+        data_descriptor descriptor;
+        read_bytes(&descriptor, sizeof(descriptor));
+        if(descriptor.compressed_size != data_end - current_.file_offset) {
+          THROW(MalformatedLocalFileHeader, "Wrong data descriptor for %s", current_.file_name.c_str());
+        }
+        current_.crc32 = descriptor.crc32;
+        current_.compressed_size = descriptor.compressed_size;
+        current_.uncompressed_size = descriptor.uncompressed_size;
+      }
+
+      void unzip_stream::skip_entry() {
+        switch(current_.compression_method) {
+          case CM_STORE:
+            copy_stored(NULL);
+            break;
+          case CM_DEFLAT:
+          case CM_DEFLAT64:
+            inflate_deflated(NULL);
+            break;
+          default:
+            if(lfh_.flags & DESCRIPTORS_AFTER_DATA) {
+              THROW(UnsupportedCompressionMethod, "Can't skip entry %s (compressor #%d)", current_.file_name.c_str(), current_.compression_method);
+            }
+            for(unsigned long remaining = current_.compressed_size; 0 < remaining;) {
+              if(!fill(1)) {
+                THROW(UncompressError, "Unexpected end of archive in %s", current_.file_name.c_str());
+              }
+              unsigned long count = end_ - pos_ < remaining ? end_ - pos_ : remaining;
+              pos_ += count;
+              offset_ += count;
+              remaining -= count;
+            }
+        }
+        pending_ = false;
+      }
+
+      entry unzip_stream::inflate_entry(std::ostream & out) {
+        if(!pending_) {
+          THROW(UncompressError, "No entry to inflate");
+        }
+        switch(current_.compression_method) {
+          case CM_STORE:
+            copy_stored(&out);
+            break;
+          case CM_DEFLAT:
+          case CM_DEFLAT64:
+            inflate_deflated(&out);
+            break;
+          default:
+            THROW(UnsupportedCompressionMethod, "Compressor (#%d) not supported", current_.compression_method);
+        }
+        pending_ = false;
+        return current_;
+      }
+
+      void unzip_stream::inflate() {
+        mgz::io::file to(".");
+        inflate(to);
+      }
+
+      // True if the entry would be extracted outside of the target directory : absolute names
+      // (including drive letters) and names with a ".." component
+      static bool escapes_target(const std::string & name) {
+        if((0 < name.size() && ('/' == name[0] || '\\' == name[0])) || (1 < name.size() && ':' == name[1])) {
+          return true;
+        }
+        std::string::size_type start = 0;
+        while(start <= name.size()) {
+          std::string::size_type end = name.find_first_of("/\\", start);
+          if(std::string::npos == end) {
+            end = name.size();
+          }
+          if(0 == name.compare(start, end - start, "..")) {
+            return true;
+          }
+          start = end + 1;
+        }
+        return false;
+      }
+
+      void unzip_stream::inflate(mgz::io::file & to) {
+        entry e;
+        while(next_entry(e)) {
+          if(escapes_target(e.file_name)) {
+            THROW(UnsafeEntryName, "Entry %s would be extracted outside of %s", e.file_name.c_str(), to.get_path().c_str());
+          }
+          mgz::io::file outfile = to.join(e.file_name);
+          if(outfile.represents_directory()) {
+            outfile.mkdirs();
+            continue;
+          }
+          if(!outfile.get_parent_file().exist()) {
+            outfile.get_parent_file().mkdirs();
+          }
+          std::ofstream os(outfile.get_path().c_str(), std::ios::binary | std::ios::out);
+          if(!os.is_open()) {
+            THROW(UncompressError, "Can't create file %s", outfile.get_path().c_str());
+          }
+          inflate_entry(os);
+        }
+      }
+    }
+  }
+}
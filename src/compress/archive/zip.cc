@@ -1,26 +1,61 @@
+#include "config.h"
 #include "io/filesystem.h"
+#include "io/stream.h"
 #include "compress/archive/zip.h"
+#include "compress/archive/unzip.h"
+#include "compress/archive/cd_cache.h"
 #include "compress/archive/internal/common.h"
 #include "compress/compressor.h"
-#include "compress/compressor/raw.h"
+#include "compress/z.h"
+#include "net/mime.h"
+#include "security/crc32.h"
 #include "util/exception.h"
+#include "util/string.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#if defined(HAVE_FSTATAT) && defined(HAVE_FDOPENDIR)
+#include <dirent.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 namespace mgz {
   namespace compress {
     namespace archive {
       zip::zip(const mgz::io::file &archive, unsigned short compression_method, int level)
-        : archive_(archive),compression_method_(compression_method), level_(level) {
+        : archive_(archive),sink_(&archive_stream_),streaming_(false),written_(0),compression_method_(compression_method), level_(level),
+          existing_cd_offset_(0), auto_store_(false), min_saving_(AUTO_STORE_MIN_SAVING), deduplicate_(false) {
+          if (level < mgz::compress::COMPRESSION_LEVEL_0 || level > mgz::compress::COMPRESSION_LEVEL_9) {
+            THROW(mgz::compress::UnsupportedCompressionLevelException,"Compression level %u not supported",level);
+          }
+        }
+
+      zip::zip(std::ostream &sink, unsigned short compression_method, int level)
+        : sink_(&sink),streaming_(true),written_(0),compression_method_(compression_method), level_(level),
+          existing_cd_offset_(0), auto_store_(false), min_saving_(AUTO_STORE_MIN_SAVING), deduplicate_(false) {
           if (level < mgz::compress::COMPRESSION_LEVEL_0 || level > mgz::compress::COMPRESSION_LEVEL_9) {
             THROW(mgz::compress::UnsupportedCompressionLevelException,"Compression level %u not supported",level);
           }
         }
 
       unsigned long zip::writing_position() {
-        long curpos=archive_stream_.tellp();
-        if (-1==curpos) {
-          THROW(CantGetStreamPositionException,"Cannot read the current position in %s archive",archive_.get_path().c_str());
+        return written_;
+      }
+
+      void zip::write_bytes(const void *data, unsigned long size) {
+        sink_->write(reinterpret_cast<const char *>(data),size);
+        if (!sink_->good()) {
+          THROW(CantWriteStreamException,"Cannot write %lu bytes to the archive",size);
         }
-        return curpos;
+        written_+=size;
       }
 
       unsigned short zip::LevelToZipFlag() {
@@ -29,31 +64,34 @@ namespace mgz {
       }
 
       central_directory_header zip::header_from_file(mgz::io::file &fileToAdd, const mgz::io::file &base_dir) {
+        std::string relative_path=fileToAdd.relative_path_from(base_dir);
+        bool is_dir=fileToAdd.is_directory();
+        if (is_dir && !fileToAdd.represents_directory()) { // Sets folder "marker" (terminating '/') if needed
+          relative_path+=FILE_SEPARATOR;
+        }
+        std::string a_la_zip_path=mgz::io::file(relative_path).get_unix_path();
+        return make_header(fileToAdd.get_path(),a_la_zip_path,is_dir,fileToAdd.size(),fileToAdd.get_modification_datetime());
+      }
+
+      central_directory_header zip::make_header(const std::string &path, const std::string &zip_name, bool is_dir, unsigned long size, const struct tm &date_time) {
         central_directory_header cdh;
         central_directory_header_static &hdr=cdh.static_part;
         hdr.signature=CDH_SIGNATURE;
         hdr.version=VERSION_MADE_BY;
         hdr.needed_version=PKZIP_VERSION;
-        struct tm date_time=fileToAdd.get_modification_datetime();
         hdr.time=dos_time_to_zip_time(date_time.tm_hour,date_time.tm_min,date_time.tm_sec);
         hdr.date=dos_date_to_zip_date(date_time.tm_year+1900,date_time.tm_mon+1,date_time.tm_mday);
-        std::string relative_path=fileToAdd.relative_path_from(base_dir);
-        unsigned int external_attribute_value=0;
-        if (fileToAdd.is_directory() && !fileToAdd.represents_directory()) { // Sets folder "marker" (terminating '/') if needed
-          relative_path+=FILE_SEPARATOR;
-          external_attribute_value=DOS_DIR_EXTERNAL_VALUE;
-        }
-        std::string a_la_zip_path=mgz::io::file(relative_path).get_unix_path();
-        hdr.file_name_length=a_la_zip_path.size();
-        cdh.data_part.file_name=a_la_zip_path;
+        hdr.file_name_length=zip_name.size();
+        cdh.data_part.file_name=zip_name;
         hdr.extra_field_length=0;
         hdr.file_comment_length=0;
         hdr.disk_start=0;
         hdr.internal_file_attributs=0;
-        hdr.external_file_attributs=external_attribute_value;
-        hdr.descriptor.uncompressed_size=fileToAdd.size();
-        hdr.flags = ( 0==hdr.descriptor.uncompressed_size ? NO_FLAGS : (DESCRIPTORS_AFTER_DATA | LevelToZipFlag()) );
-        hdr.compression_method=( 0==hdr.descriptor.uncompressed_size ? CM_STORE : compression_method_ );
+        hdr.external_file_attributs=( is_dir ? DOS_DIR_EXTERNAL_VALUE : 0 );
+        hdr.descriptor.uncompressed_size=size;
+        bool store_it=( 0==size || (auto_store_ && !is_dir && should_store(path,size)) );
+        hdr.flags = ( store_it ? NO_FLAGS : (DESCRIPTORS_AFTER_DATA | LevelToZipFlag()) );
+        hdr.compression_method=( store_it ? CM_STORE : compression_method_ );
         hdr.offset_of_local_header=NOT_INITIALIZED_L;
         // Following fields are set lately, as soon as file is compressed
         hdr.descriptor.crc32=0;
@@ -61,6 +99,77 @@ namespace mgz {
         return cdh;
       }
 
+      void zip::set_auto_store(bool enabled, unsigned int min_saving) {
+        auto_store_=enabled;
+        min_saving_=min_saving;
+      }
+
+      bool zip::should_store(const std::string &path, unsigned long size) {
+        if (CM_STORE==compression_method_) {
+          return false;
+        }
+
+        // Already compressed formats ; others (uncompressed audio like wav or aiff, midi...) go through the trial
+        std::vector< std::pair<std::string, mgz::net::mime_type_value> > types=(*mgz::net::mime::getInstance())[mgz::util::to_lower(mgz::io::file(path).get_extension())];
+        std::vector< std::pair<std::string, mgz::net::mime_type_value> >::iterator it;
+        for (it=types.begin(); it!=types.end(); it++) {
+          switch ((*it).second) {
+            case mgz::net::IMAGE_JPEG:
+            case mgz::net::IMAGE_PNG:
+            case mgz::net::IMAGE_GIF:
+            case mgz::net::APPLICATION_ZIP:
+            case mgz::net::APPLICATION_X_GZIP:
+            case mgz::net::APPLICATION_X_BZIP2:
+            case mgz::net::APPLICATION_X_COMPRESS:
+            case mgz::net::APPLICATION_X_COMPRESSED:
+            case mgz::net::APPLICATION_X_RAR_COMPRESSED:
+            case mgz::net::APPLICATION_X_JAVA_ARCHIVE:
+            case mgz::net::APPLICATION_VND_MS_CAB_COMPRESSED:
+            case mgz::net::APPLICATION_OGG:
+            case mgz::net::APPLICATION_MP4:
+            case mgz::net::AUDIO_AMR:
+            case mgz::net::AUDIO_AMR_WB:
+            case mgz::net::AUDIO_MP4:
+            case mgz::net::AUDIO_MPEG:
+            case mgz::net::AUDIO_X_AAC:
+            case mgz::net::AUDIO_X_MS_WMA:
+            case mgz::net::AUDIO_X_PN_REALAUDIO:
+            case mgz::net::AUDIO_X_REALAUDIO:
+            case mgz::net::VIDEO_3GPP:
+            case mgz::net::VIDEO_MJ2:
+            case mgz::net::VIDEO_MP4:
+            case mgz::net::VIDEO_MPEG:
+            case mgz::net::VIDEO_OGG:
+            case mgz::net::VIDEO_QUICKTIME:
+            case mgz::net::VIDEO_X_FLV:
+            case mgz::net::VIDEO_X_MS_ASF:
+            case mgz::net::VIDEO_X_MS_WMV:
+              return true;
+            default:
+              break;
+          }
+        }
+
+        if (size < AUTO_STORE_MIN_SIZE) {
+          return false;
+        }
+
+        // Trial compression of the first block
+        std::ifstream sample_stream(path.c_str(), std::ios::in | std::ios::binary);
+        std::vector<unsigned char> sample(AUTO_STORE_SAMPLE_SIZE);
+        sample_stream.read(reinterpret_cast<char *>(&sample[0]), sample.size());
+        sample.resize(sample_stream.gcount());
+        if (sample.empty()) {
+          return false;
+        }
+        std::vector<unsigned char> compressed;
+        std::vector<unsigned char> end_of_data;
+        mgz::compress::Z trial(mgz::compress::RAW);
+        trial.deflate(sample, compressed);
+        trial.deflate(end_of_data, compressed);
+        return compressed.size()*100 > sample.size()*(100-min_saving_);
+      }
+
       local_file_header zip::central_to_local(const central_directory_header& cdh) {
         local_file_header lfh;
         local_file_header_static &lhdr=lfh.static_part;
@@ -71,9 +180,13 @@ namespace mgz {
         lhdr.flags=cdhs.flags;
         lhdr.time=cdhs.time;
         lhdr.date=cdhs.date;
-        lhdr.descriptor.crc32=0; // Bit 3 of flags set (see DESCRIPTORS_AFTER_DATA flag usage) => desc. in local headers are not significant
-        lhdr.descriptor.uncompressed_size=0; // Idem
-        lhdr.descriptor.compressed_size=0; // Idem
+        if (cdhs.flags & DESCRIPTORS_AFTER_DATA) {
+          lhdr.descriptor.crc32=0; // Bit 3 of flags set (see DESCRIPTORS_AFTER_DATA flag usage) => desc. in local headers are not significant
+          lhdr.descriptor.uncompressed_size=0; // Idem
+          lhdr.descriptor.compressed_size=0; // Idem
+        } else {
+          lhdr.descriptor=cdhs.descriptor; // Either known in advance, or patched once data are written
+        }
         lhdr.file_name_length=cdhs.file_name_length;
         lhdr.extra_field_length=cdhs.extra_field_length;
         lfh.data_part.file_name=cdh.data_part.file_name;
@@ -83,46 +196,129 @@ namespace mgz {
 
       unsigned long zip::write_local_file_header(const local_file_header& lfh) {
         unsigned long pos =  writing_position();
-        archive_stream_.write(reinterpret_cast<const char *>(&lfh.static_part),LFH_STATIC_LENGTH);
-        archive_stream_.write(lfh.data_part.file_name.c_str(),lfh.data_part.file_name.size());
-        archive_stream_.write(reinterpret_cast<const char *>(&lfh.data_part.extra_field),lfh.data_part.extra_field.size());
+        write_bytes(&lfh.static_part,LFH_STATIC_LENGTH);
+        write_bytes(lfh.data_part.file_name.c_str(),lfh.data_part.file_name.size());
+        if (!lfh.data_part.extra_field.empty()) {
+          write_bytes(&lfh.data_part.extra_field[0],lfh.data_part.extra_field.size());
+        }
         return pos;
       }
 
-      central_directory_header zip::compress_and_write_data (mgz::compress::compressor &comp, const central_directory_header& cdh) {
+      central_directory_header zip::compress_and_write_data(const std::string &path, const central_directory_header& cdh) {
         central_directory_header result=cdh;
         central_directory_header_static &hdr=result.static_part;
-        long positionflux=archive_stream_.tellp();
-        comp.compress();
-        positionflux=archive_stream_.tellp();
+        std::ifstream to_zip_stream(path.c_str(), std::ios::in | std::ios::binary);
+        if (!to_zip_stream.is_open()) {
+          THROW(NonExistingFileToCompressException, "The file %s cannot be zipped as it can't be read",path.c_str());
+        }
+        mgz::compress::Z zipper(mgz::compress::RAW);
+        zipper.deflate(to_zip_stream, *sink_);
+        if (!sink_->good()) {
+          THROW(CantWriteStreamException,"Cannot write %s to the archive",path.c_str());
+        }
+        written_+=zipper.get_compressed_size();
         signed_data_descriptor desc;
         desc.signature=DDS_SIGNATURE;
-        desc.descriptor.crc32=comp.get_crc32();
-        desc.descriptor.compressed_size=comp.get_compressed_size();
-        desc.descriptor.uncompressed_size=comp.get_uncompressed_size();
-        archive_stream_.write(reinterpret_cast<char *>(&desc),sizeof(signed_data_descriptor));
+        desc.descriptor.crc32=zipper.get_crc32();
+        desc.descriptor.compressed_size=zipper.get_compressed_size();
+        desc.descriptor.uncompressed_size=zipper.get_uncompressed_size();
+        write_bytes(&desc,sizeof(signed_data_descriptor));
         hdr.descriptor=desc.descriptor;
         return result;
       }
 
-      void zip::write_central_directory() {
-        std::map<std::string,central_directory_header>::iterator it;
+      void zip::crc_of_file(const std::string &path, central_directory_header &cdh) {
+        std::ifstream to_store_stream(path.c_str(), std::ios::in | std::ios::binary);
+        if (!to_store_stream.is_open()) {
+          THROW(NonExistingFileToCompressException, "The file %s cannot be zipped as it can't be read",path.c_str());
+        }
+        std::vector<char> buffer(BUFFER_SIZE);
+        mgz::security::crc32sum crc;
+        unsigned int size=0;
+        while (to_store_stream.read(&buffer[0], buffer.size()) || to_store_stream.gcount() > 0) {
+          crc.update(&buffer[0], to_store_stream.gcount());
+          size+=to_store_stream.gcount();
+        }
+        crc.finalize();
+        cdh.static_part.descriptor.crc32=crc.crc;
+        cdh.static_part.descriptor.compressed_size=size;
+        cdh.static_part.descriptor.uncompressed_size=size;
+      }
+
+      central_directory_header zip::store_and_write_data(const std::string &path, const central_directory_header& cdh) {
+        central_directory_header result=cdh;
+        central_directory_header_static &hdr=result.static_part;
+        std::ifstream to_store_stream(path.c_str(), std::ios::in | std::ios::binary);
+        if (!to_store_stream.is_open()) {
+          THROW(NonExistingFileToCompressException, "The file %s cannot be zipped as it can't be read",path.c_str());
+        }
+        std::vector<char> buffer(BUFFER_SIZE);
+        mgz::security::crc32sum crc;
+        unsigned int size=0;
+        while (to_store_stream.read(&buffer[0], buffer.size()) || to_store_stream.gcount() > 0) {
+          std::streamsize count=to_store_stream.gcount();
+          crc.update(&buffer[0], count);
+          write_bytes(&buffer[0], count);
+          size+=count;
+        }
+        crc.finalize();
+        if (streaming_) {
+          // The local header was written with the crc and size computed beforehand
+          if (crc.crc!=hdr.descriptor.crc32 || size!=hdr.descriptor.compressed_size) {
+            THROW(CantWriteStreamException,"The file %s changed while being archived",path.c_str());
+          }
+          return result;
+        }
+        hdr.descriptor.crc32=crc.crc;
+        hdr.descriptor.compressed_size=size;
+        hdr.descriptor.uncompressed_size=size;
+
+        // Local header descriptor is 14 bytes after its signature
+        archive_stream_.seekp(hdr.offset_of_local_header+14);
+        archive_stream_.write(reinterpret_cast<char *>(&hdr.descriptor),sizeof(data_descriptor));
+        archive_stream_.seekp(written_);
+        return result;
+      }
+
+      void zip::write_central_directory(bool with_catalog) {
         unsigned long cd_offset = writing_position();
-        for (it=catalog.begin(); it!=catalog.end(); it++) {
-          archive_stream_.write(reinterpret_cast<char *>(&((*it).second.static_part)),CDH_STATIC_LENGTH);
-          archive_stream_.write((*it).second.data_part.file_name.c_str(),(*it).second.data_part.file_name.size());
+        std::vector<central_directory_header>::iterator ex;
+        for (ex=existing_.begin(); ex!=existing_.end(); ex++) {
+          write_central_directory_header(*ex);
+        }
+        unsigned long total_entries=existing_.size();
+        if (with_catalog) {
+          std::map<std::string,central_directory_header>::iterator it;
+          for (it=catalog.begin(); it!=catalog.end(); it++) {
+            write_central_directory_header((*it).second);
+          }
+          std::vector<std::pair<std::string,central_directory_header> >::iterator te;
+          for (te=tree_catalog.begin(); te!=tree_catalog.end(); te++) {
+            write_central_directory_header((*te).second);
+          }
+          total_entries+=catalog.size()+tree_catalog.size();
         }
         unsigned long cd_size=writing_position()-cd_offset;
         end_of_central_directory_header_static epilogue;
         epilogue.signature=EOCDH_SIGNATURE;
         epilogue.disk_number=0;
         epilogue.start_disk=0;
-        epilogue.total_entries=catalog.size();
+        epilogue.total_entries=total_entries;
         epilogue.number_of_entries=epilogue.total_entries;
         epilogue.central_directory_size=cd_size;
         epilogue.central_directory_offset=cd_offset;
-        epilogue.comment_length=0;
-        archive_stream_.write(reinterpret_cast<char *>(&epilogue),EOCDH_STATIC_LENGTH);
+        epilogue.comment_length=comment_.size();
+        write_bytes(&epilogue,EOCDH_STATIC_LENGTH);
+        write_bytes(comment_.c_str(),comment_.size());
+      }
+
+      void zip::write_central_directory_header(const central_directory_header& cdh) {
+        write_bytes(&(cdh.static_part),CDH_STATIC_LENGTH);
+        write_bytes(cdh.data_part.file_name.c_str(),cdh.data_part.file_name.size());
+        if (!cdh.data_part.extra_field.empty()) {
+          write_bytes(&cdh.data_part.extra_field[0],cdh.data_part.extra_field.size());
+        }
+        write_bytes(cdh.data_part.file_comment.c_str(),cdh.data_part.file_comment.size());
       }
 
       void zip::add_file(mgz::io::file &fileToAdd, const mgz::io::file &base_dir) {
@@ -141,32 +337,498 @@ namespace mgz {
         }
       }
 
+      void zip::add_tree(const mgz::io::file &root, const mgz::io::file &base_dir, mgz::io::fsfilter *filter) {
+        mgz::io::file root_dir(root);
+        if (!root_dir.exist() || !root_dir.is_defined()) {
+          THROW(NonExistingFileToCompressException, "The file %s cannot be zipped as it does not exist",root_dir.get_path().c_str());
+        }
+        if (!root_dir.is_directory()) {
+          add_file(root_dir,base_dir);
+          return;
+        }
+        std::string zip_dir=mgz::io::file(root_dir.relative_path_from(base_dir)).get_unix_path();
+        if (!zip_dir.empty() && '/'!=zip_dir[zip_dir.size()-1]) {
+          zip_dir+='/';
+        }
+        if (!zip_dir.empty()) {
+          tree_catalog.push_back(std::make_pair(root_dir.get_path(),
+                make_header(root_dir.get_path(),zip_dir,true,0,root_dir.get_modification_datetime())));
+        }
+#if defined(HAVE_FSTATAT) && defined(HAVE_FDOPENDIR)
+        int root_fd=::open(root_dir.get_path().c_str(), O_RDONLY | O_DIRECTORY);
+        if (-1==root_fd) {
+          THROW(CantOpenStreamException, "Cannot open the %s directory", root_dir.get_path().c_str());
+        }
+        walk_tree(root_fd, root_dir.get_path(), zip_dir, root_dir, filter);
+#else
+        walk_tree(-1, root_dir.get_path(), zip_dir, root_dir, filter);
+#endif
+      }
+
+      bool zip::tree_filter(mgz::io::fsfilter *filter, const std::string &path, const mgz::io::file &root) {
+        if (NULL==filter) {
+          return true;
+        }
+        mgz::io::fs_diff d;
+        d.status=mgz::io::RIGHT_ONLY;
+        d.right=mgz::io::file(path);
+        d.right_root=root;
+        return filter->filter(d);
+      }
+
+#if defined(HAVE_FSTATAT) && defined(HAVE_FDOPENDIR)
+      // Closes a directory when leaving walk_tree, even when a filter or a nested walk throws
+      struct dir_guard {
+        dir_guard(DIR *d) : dir(d) {}
+        ~dir_guard() { ::closedir(dir); }
+        DIR *dir;
+      };
+
+      void zip::walk_tree(int dir_fd, const std::string &path, const std::string &zip_dir, const mgz::io::file &root, mgz::io::fsfilter *filter) {
+        DIR *dir=::fdopendir(dir_fd);
+        if (NULL==dir) {
+          ::close(dir_fd);
+          THROW(CantOpenStreamException, "Cannot read the %s directory", path.c_str());
+        }
+        dir_guard guard(dir);
+        // Entries are sorted so that archives do not depend on the order of the directory
+        std::vector<std::string> names;
+        struct dirent *ent;
+        while (NULL!=(ent=::readdir(dir))) {
+          if (0==strcmp(ent->d_name,".") || 0==strcmp(ent->d_name,"..")) {
+            continue;
+          }
+#ifdef _DIRENT_HAVE_D_TYPE
+          if (DT_FIFO==ent->d_type || DT_SOCK==ent->d_type || DT_CHR==ent->d_type || DT_BLK==ent->d_type) {
+            continue;
+          }
+#endif
+          names.push_back(ent->d_name);
+        }
+        std::sort(names.begin(), names.end());
+
+        std::vector<std::string>::iterator it;
+        for (it=names.begin(); it!=names.end(); it++) {
+          // Links to files are archived as the files they point to ; links to directories are skipped,
+          // so that a link to a parent directory can't make the walk loop
+          struct stat st;
+          if (0!=::fstatat(dir_fd, (*it).c_str(), &st, AT_SYMLINK_NOFOLLOW)) {
+            continue;
+          }
+          if (S_ISLNK(st.st_mode) && (0!=::fstatat(dir_fd, (*it).c_str(), &st, 0) || S_ISDIR(st.st_mode))) {
+            continue;
+          }
+          bool is_dir=S_ISDIR(st.st_mode);
+          if (!is_dir && !S_ISREG(st.st_mode)) {
+            continue;
+          }
+          std::string entry_path=path+FILE_SEPARATOR+(*it);
+          if (!tree_filter(filter, entry_path, root)) {
+            continue; // A rejected directory is pruned with all its content
+          }
+          struct tm date_time;
+          ::localtime_r(&st.st_mtime, &date_time);
+          std::string zip_name=zip_dir+(*it)+(is_dir ? "/" : "");
+          tree_catalog.push_back(std::make_pair(entry_path,
+                make_header(entry_path,zip_name,is_dir,(is_dir ? 0 : st.st_size),date_time)));
+          if (is_dir) {
+            int sub_fd=::openat(dir_fd, (*it).c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if (-1!=sub_fd) {
+              walk_tree(sub_fd, entry_path, zip_name, root, filter);
+            }
+          }
+        }
+      }
+#else
+      void zip::walk_tree(int /* unused */, const std::string &path, const std::string &zip_dir, const mgz::io::file &root, mgz::io::fsfilter *filter) {
+        mgz::io::file dir(path);
+        mgz::io::fs f(dir);
+        std::vector<mgz::io::file> files = f.content();
+        std::vector<mgz::io::file>::iterator it;
+        for (it=files.begin(); it<files.end(); it++) {
+          if ((*it).is_symlink() && (*it).is_directory()) {
+            continue; // Links to directories are not followed, as above
+          }
+          if (!tree_filter(filter, (*it).get_path(), root)) {
+            continue;
+          }
+          bool is_dir=(*it).is_directory();
+          std::string zip_name=zip_dir+(*it).get_name()+(is_dir ? "/" : "");
+          tree_catalog.push_back(std::make_pair((*it).get_path(),
+                make_header((*it).get_path(),zip_name,is_dir,(is_dir ? 0 : (*it).size()),(*it).get_modification_datetime())));
+          if (is_dir) {
+            walk_tree(-1, (*it).get_path(), zip_name, root, filter);
+          }
+        }
+      }
+#endif
+
+      void zip::write_entry(const std::string &path, central_directory_header &cdh) {
+        central_directory_header_static& cdhs=cdh.static_part;
+        bool empty_it=cdhs.descriptor.uncompressed_size==0;
+        if (!empty_it && deduplicate_ && !streaming_ && 1<dedup_sizes_[cdhs.descriptor.uncompressed_size]) {
+          write_deduplicated_entry(path,cdh);
+          return;
+        }
+        if (!empty_it && CM_STORE==cdhs.compression_method && streaming_) {
+          crc_of_file(path,cdh); // No way back to the local header : crc is needed before writing it
+        }
+        local_file_header lfh=central_to_local(cdh);
+        unsigned long offset_lfh=write_local_file_header(lfh);
+        cdhs.offset_of_local_header=offset_lfh;
+        if (!empty_it && CM_STORE==cdhs.compression_method) {
+          cdh=store_and_write_data(path,cdh);
+        } else if (!empty_it) {
+          cdh=compress_and_write_data(path,cdh);
+        }
+      }
+
+      void zip::write_catalog_entries() {
+        std::map<std::string,central_directory_header>::iterator it;
+        std::vector<std::pair<std::string,central_directory_header> >::iterator te;
+        dedup_sizes_.clear();
+        dedup_contents_.clear();
+        if (deduplicate_) {
+          // Only files sharing their size with another one may be duplicates
+          for (it=catalog.begin();it != catalog.end();it++) {
+            dedup_sizes_[(*it).second.static_part.descriptor.uncompressed_size]++;
+          }
+          for (te=tree_catalog.begin(); te!=tree_catalog.end(); te++) {
+            dedup_sizes_[(*te).second.static_part.descriptor.uncompressed_size]++;
+          }
+        }
+        for (it=catalog.begin();it != catalog.end();it++) {
+          write_entry((*it).first,(*it).second);
+        }
+        for (te=tree_catalog.begin(); te!=tree_catalog.end(); te++) {
+          write_entry((*te).first,(*te).second);
+        }
+      }
+
+      void zip::set_deduplicate(bool enabled) {
+        deduplicate_=enabled;
+      }
+
+      unsigned long zip::head_hash(const std::string &path) {
+        std::ifstream is(path.c_str(), std::ios::in | std::ios::binary);
+        std::vector<char> head(DEDUP_HEAD_SIZE);
+        is.read(&head[0], head.size());
+        mgz::security::crc32sum crc;
+        crc.update(&head[0], is.gcount());
+        crc.finalize();
+        return crc.crc;
+      }
+
+      bool zip::same_content(const std::string &path1, const std::string &path2) {
+        std::ifstream is1(path1.c_str(), std::ios::in | std::ios::binary);
+        std::ifstream is2(path2.c_str(), std::ios::in | std::ios::binary);
+        std::vector<char> buffer1(BUFFER_SIZE);
+        std::vector<char> buffer2(BUFFER_SIZE);
+        for (;;) {
+          is1.read(&buffer1[0], buffer1.size());
+          is2.read(&buffer2[0], buffer2.size());
+          if (is1.gcount()!=is2.gcount() || 0!=memcmp(&buffer1[0], &buffer2[0], is1.gcount())) {
+            return false;
+          }
+          if (0==is1.gcount()) {
+            return true;
+          }
+        }
+      }
+
+      void zip::write_deduplicated_entry(const std::string &path, central_directory_header &cdh) {
+        central_directory_header_static& cdhs=cdh.static_part;
+        std::vector<written_content> &candidates=dedup_contents_[std::make_pair((unsigned long)cdhs.descriptor.uncompressed_size, head_hash(path))];
+        std::vector<written_content>::iterator it;
+        for (it=candidates.begin(); it!=candidates.end(); it++) {
+          if (!same_content((*it).path, path)) {
+            continue;
+          }
+          // Same content : only headers are written, compressed data is copied from the archive
+          cdhs.compression_method=(*it).header.compression_method;
+          cdhs.flags=(*it).header.flags;
+          cdhs.descriptor=(*it).header.descriptor;
+          local_file_header lfh=central_to_local(cdh);
+          cdhs.offset_of_local_header=write_local_file_header(lfh);
+          copy_archive_data((*it).data_offset, cdhs.descriptor.compressed_size);
+          if (cdhs.flags & DESCRIPTORS_AFTER_DATA) {
+            signed_data_descriptor desc;
+            desc.signature=DDS_SIGNATURE;
+            desc.descriptor=cdhs.descriptor;
+            write_bytes(&desc,sizeof(signed_data_descriptor));
+          }
+          return;
+        }
+
+        // First time this content is seen
+        bool saved_deduplicate=deduplicate_;
+        deduplicate_=false;
+        write_entry(path,cdh);
+        deduplicate_=saved_deduplicate;
+        written_content content;
+        content.path=path;
+        content.header=cdhs;
+        content.data_offset=cdhs.offset_of_local_header+LFH_STATIC_LENGTH+cdhs.file_name_length+cdhs.extra_field_length;
+        candidates.push_back(content);
+      }
+
+      void zip::copy_archive_data(unsigned long offset, unsigned long size) {
+        archive_stream_.flush();
+        std::ifstream is(archive_.get_path().c_str(), std::ios::in | std::ios::binary);
+        is.seekg(offset);
+        std::vector<char> buffer(BUFFER_SIZE);
+        while (0<size) {
+          is.read(&buffer[0], (size<buffer.size() ? size : buffer.size()));
+          if (0>=is.gcount()) {
+            THROW(CantWriteStreamException,"Cannot read back %lu bytes from the archive",size);
+          }
+          write_bytes(&buffer[0], is.gcount());
+          size-=is.gcount();
+        }
+      }
+
       void zip::deflate() {
-        if (catalog.size()==0) {
+        if (catalog.size()==0 && tree_catalog.empty()) {
           THROW(NothingToCompressException, "Compress has nothing to do...exiting.");
         }
+        existing_.clear();
+        comment_.clear();
+        written_=0;
+        if (streaming_) {
+          write_catalog_entries();
+          write_central_directory();
+          sink_->flush();
+          return;
+        }
         char * out_buffer=new char[OUT_BUFFER_SIZE];
         archive_stream_.exceptions ( std::fstream::failbit | std::fstream::badbit );
         archive_stream_.rdbuf()->pubsetbuf(out_buffer,OUT_BUFFER_SIZE);
         archive_stream_.open(archive_.get_path().c_str(), std::ios::out | std::ios::binary);
-        std::map<std::string,central_directory_header>::iterator it;
-        for (it=catalog.begin();it != catalog.end();it++) {
-          local_file_header lfh;
-          central_directory_header& cdh=(*it).second;
-          central_directory_header_static& cdhs=cdh.static_part;
-          lfh=central_to_local(cdh);
-          unsigned long offset_lfh=write_local_file_header(lfh);
-          cdh.static_part.offset_of_local_header=offset_lfh;
-          bool empty_it=cdhs.descriptor.uncompressed_size==0;
-          if (!empty_it) {
-            std::fstream to_zip_stream((*it).first.c_str(),std::ios::in | std::ios::binary);
-            mgz::compress::raw zipator(to_zip_stream,archive_stream_,level_);
-            cdh=compress_and_write_data(zipator,cdh);
-          }
-        }
+        write_catalog_entries();
         write_central_directory();
         archive_stream_.flush();
-        delete out_buffer;
+        archive_stream_.close();
+        delete[] out_buffer;
+        central_directory_cache::instance().invalidate(archive_.get_path());
+        archive_.refresh();
+      }
+
+      void zip::read_existing_entries(bool with_catalog) {
+        existing_.clear();
+        archive_.refresh(); // The archive may have been rewritten since this zip was built
+        std::ifstream is(archive_.get_path().c_str(), std::ios::in | std::ios::binary);
+        if (!is.is_open()) {
+          THROW(CantOpenStreamException, "Cannot open the %s archive", archive_.get_path().c_str());
+        }
+        long archive_size=archive_.size();
+        end_of_central_directory_header eocdh;
+        std::vector<unsigned char> cd;
+        std::vector<central_directory_record> records;
+        read_end_of_central_directory(is, archive_size, eocdh);
+        read_central_directory(is, archive_size, eocdh, cd, records);
+        existing_cd_offset_=eocdh.static_part.central_directory_offset;
+        comment_=eocdh.comment;
+
+        // Entries of the catalog replace existing ones with the same name
+        std::set<std::string> replaced;
+        if (with_catalog) {
+          std::map<std::string,central_directory_header>::iterator it;
+          for (it=catalog.begin(); it!=catalog.end(); it++) {
+            replaced.insert((*it).second.data_part.file_name);
+          }
+          std::vector<std::pair<std::string,central_directory_header> >::iterator te;
+          for (te=tree_catalog.begin(); te!=tree_catalog.end(); te++) {
+            replaced.insert((*te).second.data_part.file_name);
+          }
+        }
+
+        existing_.reserve(records.size());
+        std::vector<central_directory_record>::iterator rec;
+        for (rec=records.begin(); rec!=records.end(); rec++) {
+          const central_directory_header_static &hdr=(*rec).static_part;
+          const char *data=reinterpret_cast<const char *>(&cd[0])+(*rec).data_offset;
+          std::string file_name(data, hdr.file_name_length);
+          if (removed_.count(file_name)!=0 || replaced.count(file_name)!=0) {
+            continue;
+          }
+          central_directory_header cdh;
+          cdh.static_part=hdr;
+          cdh.data_part.file_name=file_name;
+          data+=hdr.file_name_length;
+          cdh.data_part.extra_field.assign(data, data+hdr.extra_field_length);
+          data+=hdr.extra_field_length;
+          cdh.data_part.file_comment.assign(data, hdr.file_comment_length);
+          existing_.push_back(cdh);
+        }
+      }
+
+      // Closes the archive stream after a failure, without throwing, and frees its buffer
+      static void abort_archive_stream(std::fstream &stream, char *buffer) {
+        stream.exceptions(std::fstream::goodbit);
+        if (stream.is_open()) {
+          stream.close();
+        }
+        stream.clear();
+        delete[] buffer;
+      }
+
+      void zip::append() {
+        if (streaming_) {
+          THROW(CantUpdateArchiveException, "Cannot append to a streamed archive");
+        }
+        archive_.refresh();
+        if (!archive_.exist()) {
+          deflate();
+          return;
+        }
+        long old_size=archive_.size();
+        read_existing_entries();
+
+        // The old central directory and end of central directory record, put back if appending fails
+        std::string old_tail(old_size-existing_cd_offset_,'\0');
+        {
+          std::ifstream is(archive_.get_path().c_str(), std::ios::in | std::ios::binary);
+          is.seekg(existing_cd_offset_);
+          is.read(&old_tail[0],old_tail.size());
+          if ((long)old_tail.size()!=is.gcount()) {
+            THROW(CantUpdateArchiveException, "Cannot read the %s archive", archive_.get_path().c_str());
+          }
+        }
+
+        char * out_buffer=new char[OUT_BUFFER_SIZE];
+        unsigned long new_size;
+        try {
+          archive_stream_.exceptions ( std::fstream::failbit | std::fstream::badbit );
+          archive_stream_.rdbuf()->pubsetbuf(out_buffer,OUT_BUFFER_SIZE);
+          archive_stream_.open(archive_.get_path().c_str(), std::ios::in | std::ios::out | std::ios::binary);
+          // New local files overwrite the old central directory
+          archive_stream_.seekp(existing_cd_offset_);
+          written_=existing_cd_offset_;
+          write_catalog_entries();
+          write_central_directory();
+          new_size=writing_position();
+          archive_stream_.flush();
+          archive_stream_.close();
+        } catch(...) {
+          abort_archive_stream(archive_stream_,out_buffer);
+          central_directory_cache::instance().invalidate(archive_.get_path());
+          {
+            std::fstream os(archive_.get_path().c_str(), std::ios::in | std::ios::out | std::ios::binary);
+            os.seekp(existing_cd_offset_);
+            os.write(old_tail.data(),old_tail.size());
+          }
+          ::truncate(archive_.get_path().c_str(), old_size);
+          archive_.refresh();
+          throw;
+        }
+        delete[] out_buffer;
+        removed_.clear();
+
+        central_directory_cache::instance().invalidate(archive_.get_path());
+        if (new_size<(unsigned long)old_size && 0!=::truncate(archive_.get_path().c_str(), new_size)) {
+          THROW(CantUpdateArchiveException, "Cannot truncate the %s archive", archive_.get_path().c_str());
+        }
+        archive_.refresh();
+      }
+
+      void zip::remove_file(const std::string &file_name) {
+        removed_.insert(file_name);
+      }
+
+      // Closes the descriptors of zip::compact, and removes the compacted archive unless it replaced the original
+      struct compact_guard {
+        compact_guard(const std::string &p) : path(p), in(-1), out(-1), keep(false) {}
+        ~compact_guard() {
+          close_all();
+          if (!keep) {
+            ::unlink(path.c_str());
+          }
+        }
+        void close_all() {
+          if (-1!=in) ::close(in);
+          if (-1!=out) ::close(out);
+          in=out=-1;
+        }
+        std::string path;
+        int in;
+        int out;
+        bool keep;
+      };
+
+      void zip::compact() {
+        if (streaming_) {
+          THROW(CantUpdateArchiveException, "Cannot compact a streamed archive");
+        }
+        archive_.refresh();
+        if (!archive_.exist()) {
+          THROW(NonExistingFileToCompressException, "The archive %s does not exist", archive_.get_path().c_str());
+        }
+        read_existing_entries(false); // Catalog entries are not in the archive yet
+
+        std::string compact_path=archive_.get_path()+".compact";
+        compact_guard guard(compact_path);
+        std::ifstream is(archive_.get_path().c_str(), std::ios::in | std::ios::binary);
+        guard.in=::open(archive_.get_path().c_str(), O_RDONLY | O_BINARY);
+        guard.out=::open(compact_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+        if (!is.is_open() || -1==guard.in || -1==guard.out) {
+          THROW(CantOpenStreamException, "Cannot compact the %s archive", archive_.get_path().c_str());
+        }
+
+        // Live entries are copied as is (local header, data and descriptor), one after the other
+        unsigned long position=0;
+        std::vector<central_directory_header>::iterator it;
+        for (it=existing_.begin(); it!=existing_.end(); it++) {
+          central_directory_header_static &hdr=(*it).static_part;
+          local_file_header_static lfh;
+          is.seekg(hdr.offset_of_local_header);
+          is.read(reinterpret_cast<char *>(&lfh),LFH_STATIC_LENGTH);
+          if (LFH_STATIC_LENGTH!=is.gcount() || LFH_SIGNATURE!=lfh.signature) {
+            THROW(CantUpdateArchiveException, "Wrong local header for %s", (*it).data_part.file_name.c_str());
+          }
+          unsigned long length=LFH_STATIC_LENGTH+lfh.file_name_length+lfh.extra_field_length+hdr.descriptor.compressed_size;
+          if (lfh.flags & DESCRIPTORS_AFTER_DATA) {
+            unsigned int signature=0;
+            is.seekg(hdr.offset_of_local_header+length);
+            is.read(reinterpret_cast<char *>(&signature),sizeof(signature));
+            length+=(DDS_SIGNATURE==signature ? sizeof(signed_data_descriptor) : sizeof(data_descriptor));
+          }
+          is.clear();
+          if ((long)length!=mgz::io::copy_fd(guard.in, hdr.offset_of_local_header, guard.out, length)) {
+            THROW(CantUpdateArchiveException, "Cannot copy %s", (*it).data_part.file_name.c_str());
+          }
+          hdr.offset_of_local_header=position;
+          position+=length;
+        }
+        guard.close_all();
+        is.close();
+
+        char * out_buffer=new char[OUT_BUFFER_SIZE];
+        try {
+          archive_stream_.exceptions ( std::fstream::failbit | std::fstream::badbit );
+          archive_stream_.rdbuf()->pubsetbuf(out_buffer,OUT_BUFFER_SIZE);
+          archive_stream_.open(compact_path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+          archive_stream_.seekp(position);
+          written_=position;
+          write_central_directory(false);
+          archive_stream_.flush();
+          archive_stream_.close();
+        } catch(...) {
+          abort_archive_stream(archive_stream_,out_buffer);
+          throw;
+        }
+        delete[] out_buffer;
+        removed_.clear();
+
+        central_directory_cache::instance().invalidate(archive_.get_path());
+#ifdef __WIN32__
+        archive_.remove();
+        guard.keep=true; // Now the only copy of the archive
+#endif
+        if (0!=::rename(compact_path.c_str(), archive_.get_path().c_str())) {
+          THROW(CantUpdateArchiveException, "Cannot replace the %s archive", archive_.get_path().c_str());
+        }
+        guard.keep=true;
+        archive_.refresh();
       }
     }
   }
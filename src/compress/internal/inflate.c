@@ -16,8 +16,10 @@ enum {
 	Nlen            = 29,  /* number of len codes */
 	Nlitlen         = Nlit+Nlen+3, /* litlen codes + block end + 2 unused */
 	Ndist           = 30,  /* number of distance codes */
+	Ndist64         = 32,  /* number of distance codes (deflate64) */
 	Nclen           = 19,  /* number of code length codes */
-	WinSize         = 1 << 15 /* output window size */
+	WinSize         = 1 << 15, /* output window size */
+	WinSize64       = 1 << 16  /* output window size (deflate64) */
 };
 
 /* states */
@@ -58,7 +60,8 @@ typedef struct {
 	unsigned int bits;
 	unsigned int nbits;
 
-	unsigned char win[WinSize]; /* output window */
+	unsigned char *win;  /* output window, allocated with the state */
+	unsigned int winsize;
 	unsigned int pos;    /* window pos */
 	unsigned int posout; /* used for flushing win */
 
@@ -71,7 +74,12 @@ typedef struct {
 	int ndist;
 	int nclen;   /* also used in decode_block() */
 	int lenpos;  /* also used in decode_block() */
-	unsigned char lens[Nlitlen + Ndist];
+	unsigned char lens[Nlitlen + Ndist64];
+
+	/* deflate64 only differs by its window, len code 285 and dist codes 30, 31 */
+	int ndistmax;
+	const unsigned char *lenbits;
+	const unsigned short *lenbase;
 
 	int fixed;   /* fixed code tree flag */
 	Huff lhuff;  /* dynamic lit/len huffman code tree */
@@ -89,11 +97,17 @@ static unsigned char lenbits[Nlen] = {
 static unsigned short lenbase[Nlen] = {
 	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
 };
-static unsigned char distbits[Ndist] = {
-	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+static unsigned char lenbits64[Nlen] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 16
+};
+static unsigned short lenbase64[Nlen] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 3
+};
+static unsigned char distbits[Ndist64] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14
 };
-static unsigned short distbase[Ndist] = {
-	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+static unsigned short distbase[Ndist64] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577, 32769, 49153
 };
 
 /* ordering of code lengths */
@@ -213,9 +227,9 @@ static void init_fixed_huffs(void) {
 		lens[i] = 8;
 	build_huff(&lhuff, lens, Nlitlen, 8);
 
-	for (i = 0; i < Ndist; i++)
+	for (i = 0; i < Ndist64; i++)
 		lens[i] = 5;
-	build_huff(&dhuff, lens, Ndist, 5);
+	build_huff(&dhuff, lens, Ndist64, 5);
 }
 
 /* fill *bits with n bits from *src */
@@ -339,6 +353,10 @@ static unsigned int decode_symbol(State *s, Huff *huff) {
 /* decode a block of data from stream with trees */
 static int decode_block(State *s, Huff *lhuff, Huff *dhuff) {
 	unsigned char *win = s->win;
+	unsigned int winsize = s->winsize;
+	unsigned int mask = winsize - 1;
+	const unsigned char *lenbits = s->lenbits;
+	const unsigned short *lenbase = s->lenbase;
 	unsigned int pos = s->pos;
 	unsigned int sym = s->nclen;
 	unsigned int len = s->lenpos;
@@ -350,8 +368,8 @@ static int decode_block(State *s, Huff *lhuff, Huff *dhuff) {
 		sym = decode_symbol(s, lhuff);
 		if (sym < 256) {
 			win[pos++] = sym;
-			if (pos == WinSize) {
-				s->pos = WinSize;
+			if (pos == winsize) {
+				s->pos = winsize;
 				s->state = DecodeBlock;
 				return FLATE_OUT;
 			}
@@ -380,7 +398,7 @@ static int decode_block(State *s, Huff *lhuff, Huff *dhuff) {
 				s->state = DecodeBlockDist;
 				return FLATE_IN;
 			}
-			if (sym >= Ndist)
+			if (sym >= (unsigned int)s->ndistmax)
 				return FLATE_ERR;
 	case DecodeBlockDistBits:
 			if (!fillbits_fast(&s->src, s->srcend, &s->bits, &s->nbits, distbits[sym])) {
@@ -392,32 +410,32 @@ static int decode_block(State *s, Huff *lhuff, Huff *dhuff) {
 			}
 			dist = distbase[sym] + getbits_fast(&s->bits, &s->nbits, distbits[sym]);
 			/* copy match, loop unroll in common case */
-			if (pos + len < WinSize) {
+			if (pos + len < winsize) {
 				/* lenbase[sym] >= 3 */
 				do {
-					win[pos] = win[(pos - dist) % WinSize];
+					win[pos] = win[(pos - dist) & mask];
 					pos++;
-					win[pos] = win[(pos - dist) % WinSize];
+					win[pos] = win[(pos - dist) & mask];
 					pos++;
-					win[pos] = win[(pos - dist) % WinSize];
+					win[pos] = win[(pos - dist) & mask];
 					pos++;
 					len -= 3;
 				} while (len >= 3);
 				if (len--) {
-					win[pos] = win[(pos - dist) % WinSize];
+					win[pos] = win[(pos - dist) & mask];
 					pos++;
 					if (len) {
-						win[pos] = win[(pos - dist) % WinSize];
+						win[pos] = win[(pos - dist) & mask];
 						pos++;
 					}
 				}
 			} else { /* rare */
 	case DecodeBlockCopy:
 				while (len--) {
-					win[pos] = win[(pos - dist) % WinSize];
+					win[pos] = win[(pos - dist) & mask];
 					pos++;
-					if (pos == WinSize) {
-						s->pos = WinSize;
+					if (pos == winsize) {
+						s->pos = winsize;
 						s->lenpos = len;
 						s->nclen = dist; /* using nclen to store dist */
 						s->state = DecodeBlockCopy;
@@ -482,7 +500,7 @@ static int inflate_state(State *s) {
 					return FLATE_IN;
 				s->lenpos--;
 				s->win[s->pos++] = *s->src++;
-				if (s->pos == WinSize)
+				if (s->pos == s->winsize)
 					return FLATE_OUT;
 			}
 			s->state = BlockHead;
@@ -498,7 +516,7 @@ static int inflate_state(State *s) {
 			s->nlit = 257 + getbits(s, 5);
 			s->ndist = 1 + getbits(s, 5);
 			s->nclen = 4 + getbits(s, 4);
-			if (s->nlit > Nlitlen || s->ndist > Ndist)
+			if (s->nlit > Nlitlen || s->ndist > s->ndistmax)
 				return s->err = "corrupt code tree.", FLATE_ERR;
 			/* build code length tree */
 			for (n = 0; n < Nclen; n++)
@@ -585,10 +603,16 @@ static int inflate_state(State *s) {
 	}
 }
 
-static State *alloc_state(void) {
-	State *s = (State*)malloc(sizeof(State));
+static State *alloc_state(int deflate64) {
+	unsigned int winsize = deflate64 ? WinSize64 : WinSize;
+	State *s = (State*)malloc(sizeof(State) + winsize);
 
 	if (s) {
+		s->win = (unsigned char*)(s + 1);
+		s->winsize = winsize;
+		s->ndistmax = deflate64 ? Ndist64 : Ndist;
+		s->lenbits = deflate64 ? lenbits64 : lenbits;
+		s->lenbase = deflate64 ? lenbase64 : lenbase;
 		s->final = s->pos = s->posout = s->bits = s->nbits = 0;
 		s->state = BlockHead;
 		s->src = s->srcend = 0;
@@ -603,7 +627,7 @@ static State *alloc_state(void) {
 
 /* extern */
 
-int mgz_inflate(mgz_stream *stream) {
+static int inflate_stream(mgz_stream *stream, int deflate64) {
 	State *s = (State*)(stream->state);
 	int n;
 
@@ -615,7 +639,7 @@ int mgz_inflate(mgz_stream *stream) {
 		return FLATE_ERR;
 	}
 	if (!s) {
-		stream->state = alloc_state();
+		stream->state = alloc_state(deflate64);
 		s = (State*)(stream->state);
 		if (!s)
 			return stream->err = "no mem.", FLATE_ERR;
@@ -649,6 +673,14 @@ int mgz_inflate(mgz_stream *stream) {
 	return n;
 }
 
+int mgz_inflate(mgz_stream *stream) {
+	return inflate_stream(stream, 0);
+}
+
+int mgz_inflate64(mgz_stream *stream) {
+	return inflate_stream(stream, 1);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -386,6 +386,12 @@ namespace mgz {
     int Z::deflate_init(int /* FIXME : unused */ level) {
       int rcod;
 
+      if(RAW64 == type_) {
+        stream.err = strdup("deflate64 compression not supported.");
+        last_flat_rcod_ = FLATE_ERR;
+        return last_flat_rcod_;
+      }
+
       checksum_ = 0;
       crc32_ = 0;
       nin_ = 0;
@@ -602,7 +608,7 @@ namespace mgz {
       free(buffer);
     }
     
-    void Z::deflate(std::fstream & in, std::fstream & out) {
+    void Z::deflate(std::istream & in, std::ostream & out) {
       unsigned char* buffer = (unsigned char*)malloc(BUFFER_SIZE);
 
       std::vector<unsigned char> vec_in;
@@ -711,7 +717,7 @@ namespace mgz {
           break;
       }
 
-      last_flat_rcod_ = ::mgz_inflate(&stream);
+      last_flat_rcod_ = RAW64 == type_ ? ::mgz_inflate64(&stream) : ::mgz_inflate(&stream);
 
       switch(last_flat_rcod_) {
         case FLATE_IN:
@@ -854,7 +860,7 @@ namespace mgz {
       free(buffer);
     }
 
-    void Z::inflate(std::fstream & in, std::fstream & out) {
+    void Z::inflate(std::istream & in, std::ostream & out) {
       unsigned char* buffer = (unsigned char*)malloc(BUFFER_SIZE);
 
       std::vector<unsigned char> vec_in;
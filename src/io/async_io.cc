@@ -0,0 +1,494 @@
+#include "config.h"
+#include "io/async_io.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __WIN32__
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_MMAN_H) && defined(STATX_BASIC_STATS)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define ASYNC_IO_URING 1
+#endif
+#endif
+
+#define ASYNC_IO_MAX_THREADS 16
+
+namespace mgz {
+  namespace io {
+    enum operation_type {
+      OPERATION_READ,
+      OPERATION_WRITE,
+      OPERATION_OPEN,
+      OPERATION_STAT
+    };
+
+    struct async_io::operation {
+      operation(async_io * io) : task(io, this) {}
+
+      operation_task task;
+      operation_type type;
+      int fd;
+      void * buffer;
+      unsigned long length;
+      long long offset;
+      std::string path;
+      int flags;
+      int mode;
+      file_status * status;
+#ifdef ASYNC_IO_URING
+      struct statx extended_status;
+#endif
+      async_callback * callback;
+      long result;
+    };
+
+#ifdef ASYNC_IO_URING
+    // The rings are shared with the kernel : indexes written by one side are read by the other
+    static inline unsigned load_acquire(const unsigned * p) {
+      unsigned v = *(const volatile unsigned *)p;
+      __sync_synchronize();
+      return v;
+    }
+
+    static inline void store_release(unsigned * p, unsigned v) {
+      __sync_synchronize();
+      *(volatile unsigned *)p = v;
+    }
+
+    // No system library is required : the three io_uring system calls are called directly
+    struct async_io::ring {
+      int fd;
+      void * sq_ptr;
+      size_t sq_size;
+      void * cq_ptr;
+      size_t cq_size;
+      struct io_uring_sqe * sqes;
+      size_t sqes_size;
+      unsigned * sq_head;
+      unsigned * sq_tail;
+      unsigned * sq_mask;
+      unsigned * sq_array;
+      unsigned * cq_head;
+      unsigned * cq_tail;
+      unsigned * cq_mask;
+      struct io_uring_cqe * cqes;
+      unsigned queued; // Tail of the written entries
+      unsigned submitted; // Tail of the entries handed to the kernel
+
+      static int enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+      }
+
+      // Checks that the kernel knows all the operations used here (read and write need Linux 5.6)
+      static bool supported(int fd) {
+        std::vector<unsigned char> buffer(sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op), 0);
+        struct io_uring_probe * probe = reinterpret_cast<struct io_uring_probe *>(&buffer[0]);
+        if(0 > syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256)) {
+          return false;
+        }
+        const int ops[] = {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_OPENAT, IORING_OP_STATX};
+        for(unsigned int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+          if(ops[i] > probe->last_op || 0 == (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      bool open(unsigned int depth) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+        if(0 > fd) {
+          return false;
+        }
+        sq_ptr = NULL;
+        cq_ptr = NULL;
+        sqes = NULL;
+        if(!supported(fd)) {
+          ::close(fd);
+          return false;
+        }
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = (0 != (params.features & IORING_FEAT_SINGLE_MMAP));
+        if(single) {
+          sq_size = cq_size = (sq_size > cq_size) ? sq_size : cq_size;
+        }
+        sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if(MAP_FAILED == sq_ptr) {
+          sq_ptr = NULL;
+          close();
+          return false;
+        }
+        cq_ptr = single ? sq_ptr : mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        void * entries = (MAP_FAILED == cq_ptr) ? MAP_FAILED :
+          mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if(MAP_FAILED == cq_ptr) {
+          cq_ptr = NULL;
+        }
+        if(MAP_FAILED == entries) {
+          close();
+          return false;
+        }
+        sqes = static_cast<struct io_uring_sqe *>(entries);
+
+        unsigned char * sq = static_cast<unsigned char *>(sq_ptr);
+        unsigned char * cq = static_cast<unsigned char *>(cq_ptr);
+        sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+        queued = submitted = *sq_tail;
+        return true;
+      }
+
+      void close() {
+        if(NULL != sqes) {
+          munmap(sqes, sqes_size);
+        }
+        if(NULL != cq_ptr && cq_ptr != sq_ptr) {
+          munmap(cq_ptr, cq_size);
+        }
+        if(NULL != sq_ptr) {
+          munmap(sq_ptr, sq_size);
+        }
+        ::close(fd);
+      }
+
+      // The submission ring is never full : it has at least depth entries, and the
+      // kernel consumes them when they are submitted
+      struct io_uring_sqe * next() {
+        unsigned index = queued & *sq_mask;
+        struct io_uring_sqe * sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array[index] = index;
+        queued++;
+        return sqe;
+      }
+
+      void submit(unsigned min_complete) {
+        if(queued != submitted) {
+          store_release(sq_tail, queued);
+        }
+        unsigned flags = (0 < min_complete) ? IORING_ENTER_GETEVENTS : 0;
+        while(queued != submitted || 0 < min_complete) {
+          int n = enter(fd, queued - submitted, min_complete, flags);
+          if(0 > n) {
+            if(EINTR == errno) {
+              continue;
+            }
+            return; // Retried on next submission
+          }
+          submitted += n;
+          if(0 == n && 0 == min_complete) {
+            return;
+          }
+          min_complete = 0;
+        }
+      }
+    };
+
+    static void status_from_statx(const struct statx & x, file_status & st) {
+      memset(&st, 0, sizeof(st));
+      st.st_dev = makedev(x.stx_dev_major, x.stx_dev_minor);
+      st.st_ino = x.stx_ino;
+      st.st_mode = x.stx_mode;
+      st.st_nlink = x.stx_nlink;
+      st.st_uid = x.stx_uid;
+      st.st_gid = x.stx_gid;
+      st.st_rdev = makedev(x.stx_rdev_major, x.stx_rdev_minor);
+      st.st_size = x.stx_size;
+      st.st_blksize = x.stx_blksize;
+      st.st_blocks = x.stx_blocks;
+      st.st_atim.tv_sec = x.stx_atime.tv_sec;
+      st.st_atim.tv_nsec = x.stx_atime.tv_nsec;
+      st.st_mtim.tv_sec = x.stx_mtime.tv_sec;
+      st.st_mtim.tv_nsec = x.stx_mtime.tv_nsec;
+      st.st_ctim.tv_sec = x.stx_ctime.tv_sec;
+      st.st_ctim.tv_nsec = x.stx_ctime.tv_nsec;
+    }
+#else
+    struct async_io::ring {};
+#endif
+
+    async_io::async_io(unsigned int depth, async_backend backend) : depth_(0 == depth ? 1 : depth), ring_(NULL), pool_(NULL), in_flight_(0) {
+#ifdef ASYNC_IO_URING
+      if(ASYNC_AUTO == backend) {
+        ring_ = new ring();
+        if(!ring_->open(depth_)) {
+          delete ring_;
+          ring_ = NULL;
+        }
+      }
+#endif
+      if(NULL == ring_) {
+        unsigned int threads = mgz::util::thread_pool::cpu_count() * 2; // Threads mostly wait for the device
+        if(threads > ASYNC_IO_MAX_THREADS) {
+          threads = ASYNC_IO_MAX_THREADS;
+        }
+        pool_ = new mgz::util::thread_pool(threads < depth_ ? threads : depth_);
+      }
+      for(unsigned int i = 0; i < depth_; i++) {
+        operations_.push_back(new operation(this));
+        free_.push_back(operations_.back());
+      }
+    }
+
+    async_io::~async_io() {
+      while(0 < in_flight_) {
+        submit();
+        reap(true);
+      }
+      completed_.clear();
+      delete pool_;
+#ifdef ASYNC_IO_URING
+      if(NULL != ring_) {
+        ring_->close();
+        delete ring_;
+      }
+#endif
+      for(unsigned int i = 0; i < operations_.size(); i++) {
+        delete operations_[i];
+      }
+    }
+
+    bool async_io::uses_io_uring() const {
+      return NULL != ring_;
+    }
+
+    unsigned int async_io::depth() const {
+      return depth_;
+    }
+
+    unsigned long async_io::pending() const {
+      return in_flight_ + completed_.size();
+    }
+
+    async_io::operation * async_io::acquire() {
+      while(free_.empty()) {
+        submit();
+        reap(true);
+      }
+      operation * op = free_.back();
+      free_.pop_back();
+      return op;
+    }
+
+    void async_io::read(int fd, void * buffer, unsigned long length, long long offset, async_callback * callback) {
+      operation * op = acquire();
+      op->type = OPERATION_READ;
+      op->fd = fd;
+      op->buffer = buffer;
+      op->length = length;
+      op->offset = offset;
+      op->callback = callback;
+      queue(op);
+    }
+
+    void async_io::write(int fd, const void * buffer, unsigned long length, long long offset, async_callback * callback) {
+      operation * op = acquire();
+      op->type = OPERATION_WRITE;
+      op->fd = fd;
+      op->buffer = const_cast<void *>(buffer);
+      op->length = length;
+      op->offset = offset;
+      op->callback = callback;
+      queue(op);
+    }
+
+    void async_io::open(const std::string & path, int flags, int mode, async_callback * callback) {
+      operation * op = acquire();
+      op->type = OPERATION_OPEN;
+      op->path = path;
+      op->flags = flags;
+      op->mode = mode;
+      op->callback = callback;
+      queue(op);
+    }
+
+    void async_io::stat(const std::string & path, file_status * status, async_callback * callback) {
+      operation * op = acquire();
+      op->type = OPERATION_STAT;
+      op->path = path;
+      op->status = status;
+      op->callback = callback;
+      queue(op);
+    }
+
+    void async_io::queue(operation * op) {
+      in_flight_++;
+#ifdef ASYNC_IO_URING
+      if(NULL != ring_) {
+        struct io_uring_sqe * sqe = ring_->next();
+        sqe->user_data = (unsigned long long)(unsigned long)op;
+        switch(op->type) {
+          case OPERATION_READ:
+          case OPERATION_WRITE:
+            sqe->opcode = (OPERATION_READ == op->type) ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->fd = op->fd;
+            sqe->addr = (unsigned long long)(unsigned long)op->buffer;
+            sqe->len = op->length;
+            sqe->off = op->offset;
+            break;
+          case OPERATION_OPEN:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (unsigned long long)(unsigned long)op->path.c_str();
+            sqe->len = op->mode;
+            sqe->open_flags = op->flags;
+            break;
+          case OPERATION_STAT:
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (unsigned long long)(unsigned long)op->path.c_str();
+            sqe->len = STATX_BASIC_STATS;
+            sqe->off = (unsigned long long)(unsigned long)&op->extended_status;
+            break;
+        }
+        return;
+      }
+#endif
+      pool_->submit(&op->task);
+    }
+
+    void async_io::submit() {
+#ifdef ASYNC_IO_URING
+      if(NULL != ring_) {
+        ring_->submit(0);
+      }
+#endif
+    }
+
+    // Blocking implementation, run by the thread pool
+    void async_io::run(operation * op) {
+      long result = 0;
+      switch(op->type) {
+        case OPERATION_READ:
+#ifdef __WIN32__
+          {
+            static mgz::util::mutex seek_lock; // No positional read : seek and read atomically
+            mgz::util::scoped_lock lock(seek_lock);
+            result = (-1 == _lseeki64(op->fd, op->offset, SEEK_SET)) ? -1 : ::read(op->fd, op->buffer, op->length);
+          }
+#else
+          do {
+            result = ::pread(op->fd, op->buffer, op->length, op->offset);
+          } while(0 > result && EINTR == errno);
+#endif
+          break;
+        case OPERATION_WRITE:
+#ifdef __WIN32__
+          {
+            static mgz::util::mutex seek_lock;
+            mgz::util::scoped_lock lock(seek_lock);
+            result = (-1 == _lseeki64(op->fd, op->offset, SEEK_SET)) ? -1 : ::write(op->fd, op->buffer, op->length);
+          }
+#else
+          do {
+            result = ::pwrite(op->fd, op->buffer, op->length, op->offset);
+          } while(0 > result && EINTR == errno);
+#endif
+          break;
+        case OPERATION_OPEN:
+          result = ::open(op->path.c_str(), op->flags, op->mode);
+          break;
+        case OPERATION_STAT:
+#ifdef __WIN32__
+          result = ::_stat(op->path.c_str(), op->status);
+#else
+          result = ::stat(op->path.c_str(), op->status);
+#endif
+          break;
+      }
+      op->result = (0 > result) ? -errno : result;
+
+      mgz::util::scoped_lock lock(done_lock_);
+      done_list_.push_back(op);
+      done_.signal();
+    }
+
+    // Moves the finished operations to the completed list ; callbacks are not called here, so
+    // that a callback queueing operations never reenters another one
+    void async_io::reap(bool block) {
+#ifdef ASYNC_IO_URING
+      if(NULL != ring_) {
+        for(;;) {
+          unsigned head = *ring_->cq_head;
+          unsigned tail = load_acquire(ring_->cq_tail);
+          bool found = (head != tail);
+          for(; head != tail; head++) {
+            struct io_uring_cqe * cqe = &ring_->cqes[head & *ring_->cq_mask];
+            operation * op = reinterpret_cast<operation *>((unsigned long)cqe->user_data);
+            op->result = cqe->res;
+            finish(op);
+          }
+          store_release(ring_->cq_head, head);
+          if(found || !block) {
+            return;
+          }
+          ring_->submit(1);
+        }
+      }
+#endif
+      std::vector<operation *> done;
+      {
+        mgz::util::scoped_lock lock(done_lock_);
+        while(block && done_list_.empty()) {
+          done_.wait(done_lock_);
+        }
+        done.swap(done_list_);
+      }
+      for(unsigned int i = 0; i < done.size(); i++) {
+        finish(done[i]);
+      }
+    }
+
+    void async_io::finish(operation * op) {
+#ifdef ASYNC_IO_URING
+      if(NULL != ring_ && OPERATION_STAT == op->type && 0 == op->result) {
+        status_from_statx(op->extended_status, *op->status);
+      }
+#endif
+      completion c;
+      c.callback = op->callback;
+      c.result = op->result;
+      completed_.push_back(c);
+      op->path.clear();
+      free_.push_back(op);
+      in_flight_--;
+    }
+
+    void async_io::wait() {
+      for(;;) {
+        while(!completed_.empty()) {
+          completion c = completed_.front();
+          completed_.pop_front();
+          if(NULL != c.callback) {
+            c.callback->completed(c.result);
+          }
+        }
+        if(0 == in_flight_) {
+          return;
+        }
+        submit();
+        reap(true);
+      }
+    }
+  }
+}
@@ -0,0 +1,225 @@
+#include "config.h"
+#include "io/checksum_cache.h"
+#include "io/file.h"
+#include "security/crc32.h"
+#include "security/sha1.h"
+#include "security/sha2.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#define CHECKSUM_BUFFER_SIZE (64 * 1024)
+#define CHECKSUM_RACY_DELAY 2 // seconds
+#define CHECKSUM_CACHE_VERSION "mgz-checksum-cache 1"
+
+namespace mgz {
+  namespace io {
+    bool file_identity::operator<(const file_identity & other) const {
+      if(device != other.device) return device < other.device;
+      if(inode != other.inode) return inode < other.inode;
+      if(size != other.size) return size < other.size;
+      if(mtime != other.mtime) return mtime < other.mtime;
+      return mtime_nsec < other.mtime_nsec;
+    }
+
+    bool file_identity::operator==(const file_identity & other) const {
+      return device == other.device && inode == other.inode && size == other.size &&
+        mtime == other.mtime && mtime_nsec == other.mtime_nsec;
+    }
+
+    checksum_cache::checksum_cache() {}
+
+    checksum_cache::checksum_cache(const std::string & path) : path_(path) {
+      load();
+    }
+
+    bool checksum_cache::identify(const std::string & path, file_identity & id) {
+#ifdef __WIN32__
+      struct _stat st;
+      if(0 != _stat(path.c_str(), &st)) {
+        return false;
+      }
+#else
+      struct stat st;
+      if(0 != stat(path.c_str(), &st)) {
+        return false;
+      }
+#endif
+      id.device = st.st_dev;
+      id.inode = st.st_ino;
+      id.size = st.st_size;
+      id.mtime = st.st_mtime;
+#if defined(__APPLE__)
+      id.mtime_nsec = st.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+      id.mtime_nsec = st.st_mtim.tv_nsec;
+#else
+      id.mtime_nsec = 0;
+#endif
+      return true;
+    }
+
+    std::string checksum_cache::compute(const std::string & path, fs_checksum algorithm) {
+      std::ifstream is(path.c_str(), std::ios::in | std::ios::binary);
+      if(!is.is_open()) {
+        return std::string();
+      }
+      std::vector<char> buffer(CHECKSUM_BUFFER_SIZE);
+      mgz::security::crc32sum crc;
+      mgz::security::sha1sum sha;
+      mgz::security::sha256sum sha256;
+      while(is.good()) {
+        is.read(&buffer[0], buffer.size());
+        size_t count = is.gcount();
+        if(CHECKSUM_CRC32 == algorithm) {
+          crc.update(&buffer[0], count);
+        } else if(CHECKSUM_SHA256 == algorithm) {
+          sha256.update(&buffer[0], count);
+        } else {
+          sha.update(&buffer[0], count);
+        }
+      }
+      if(CHECKSUM_CRC32 == algorithm) {
+        return crc.finalize().hexdigest();
+      }
+      if(CHECKSUM_SHA256 == algorithm) {
+        sha256.finalize();
+        return sha256.hexdigest();
+      }
+      return sha.finalize().hexdigest();
+    }
+
+    static file_digest digest_of(fs_checksum algorithm) {
+      switch(algorithm) {
+        case CHECKSUM_CRC32:
+          return DIGEST_CRC32;
+        case CHECKSUM_SHA256:
+          return DIGEST_SHA256;
+        default:
+          return DIGEST_SHA1;
+      }
+    }
+
+    std::string checksum_cache::checksum(const std::string & path, fs_checksum algorithm) {
+      return checksums(path, std::vector<fs_checksum>(1, algorithm))[0];
+    }
+
+    std::vector<std::string> checksum_cache::checksums(const std::string & path, const std::vector<fs_checksum> & algorithms, bool * hashed) {
+      std::vector<std::string> digests(algorithms.size());
+      if(NULL != hashed) {
+        *hashed = false;
+      }
+      file_identity before;
+      if(!identify(path, before)) {
+        return digests;
+      }
+      int missing = 0;
+      for(unsigned int i = 0; i < algorithms.size(); i++) {
+        if(!lookup(before, algorithms[i], digests[i])) {
+          missing |= digest_of(algorithms[i]);
+        }
+      }
+      if(0 == missing) {
+        return digests;
+      }
+
+      // Hashing is done without holding the lock, by the calling thread : callers hash several
+      // files at once. The result is only cached if the file did not change while it was read,
+      // and if it was not modified in the last seconds : a file rewritten within the timestamp
+      // granularity would keep the same identity.
+      if(NULL != hashed) {
+        *hashed = true;
+      }
+      std::map<file_digest, std::string> computed;
+      try {
+        computed = file(path).digest(missing, false);
+      } catch(...) {
+        return std::vector<std::string>(algorithms.size());
+      }
+      file_identity after;
+      bool cacheable = identify(path, after) && before == after && after.mtime + CHECKSUM_RACY_DELAY < time(NULL);
+      for(unsigned int i = 0; i < algorithms.size(); i++) {
+        if(digests[i].empty()) {
+          digests[i] = computed[digest_of(algorithms[i])];
+          if(cacheable) {
+            store(after, algorithms[i], digests[i]);
+          }
+        }
+      }
+      return digests;
+    }
+
+    bool checksum_cache::lookup(const file_identity & id, fs_checksum algorithm, std::string & digest) {
+      mgz::util::scoped_lock lock(lock_);
+      std::map<std::pair<file_identity, int>, std::string>::iterator it = digests_.find(std::make_pair(id, (int)algorithm));
+      if(it == digests_.end()) {
+        return false;
+      }
+      digest = it->second;
+      return true;
+    }
+
+    void checksum_cache::store(const file_identity & id, fs_checksum algorithm, const std::string & digest) {
+      mgz::util::scoped_lock lock(lock_);
+      digests_[std::make_pair(id, (int)algorithm)] = digest;
+    }
+
+    unsigned long checksum_cache::size() {
+      mgz::util::scoped_lock lock(lock_);
+      return digests_.size();
+    }
+
+    // One entry per line : device inode size mtime mtime_nsec algorithm digest
+    void checksum_cache::load() {
+      std::ifstream is(path_.c_str());
+      std::string line;
+      if(!std::getline(is, line) || CHECKSUM_CACHE_VERSION != line) {
+        return;
+      }
+      mgz::util::scoped_lock lock(lock_);
+      while(std::getline(is, line)) {
+        std::istringstream fields(line);
+        file_identity id;
+        int algorithm;
+        std::string digest;
+        if(fields >> id.device >> id.inode >> id.size >> id.mtime >> id.mtime_nsec >> algorithm >> digest) {
+          digests_[std::make_pair(id, algorithm)] = digest;
+        }
+      }
+    }
+
+    bool checksum_cache::save() {
+      if(path_.empty()) {
+        return false;
+      }
+      std::string temp = path_ + ".tmp";
+      {
+        std::ofstream os(temp.c_str(), std::ios::out | std::ios::trunc);
+        if(!os.is_open()) {
+          return false;
+        }
+        os << CHECKSUM_CACHE_VERSION << std::endl;
+        mgz::util::scoped_lock lock(lock_);
+        std::map<std::pair<file_identity, int>, std::string>::iterator it;
+        for(it = digests_.begin(); it != digests_.end(); it++) {
+          const file_identity & id = it->first.first;
+          os << id.device << " " << id.inode << " " << id.size << " " << id.mtime << " " << id.mtime_nsec << " "
+            << it->first.second << " " << it->second << "\n";
+        }
+        os.flush();
+        if(!os.good()) {
+          return false;
+        }
+      }
+#ifdef __WIN32__
+      ::remove(path_.c_str());
+#endif
+      return 0 == ::rename(temp.c_str(), path_.c_str());
+    }
+  }
+}
@@ -0,0 +1,319 @@
+#include "config.h"
+#include "io/compiled_properties.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fstream>
+#include <sstream>
+#ifdef __WIN32__
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define COMPILED_PROPERTIES_MAGIC "mgzprop1"
+#define COMPILED_PROPERTIES_BYTE_ORDER 0x01020304
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+namespace mgz {
+  namespace io {
+    static int temp_counter = 0;
+
+    // Creates an empty file with a unique name next to path, so that concurrent compilations of
+    // the same target never share their temporary file. Returns false if no name could be reserved.
+    static bool create_temp_file(const std::string & path, std::string & temp) {
+      for(int attempt = 0; attempt < 100; attempt++) {
+        std::ostringstream name;
+        name << path << "." << getpid() << "." << __sync_fetch_and_add(&temp_counter, 1) << ".tmp";
+        temp = name.str();
+        int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0666);
+        if(-1 != fd) {
+          ::close(fd);
+          return true;
+        }
+        if(EEXIST != errno) {
+          return false;
+        }
+      }
+      return false;
+    }
+
+    // Offsets are relative to the heap ; all the entries are 32 bits aligned
+    struct compiled_properties::header {
+      char magic[8];
+      uint32_t byte_order;
+      uint32_t has_source;
+      int64_t source_device;
+      int64_t source_inode;
+      int64_t source_size;
+      int64_t source_mtime;
+      int64_t source_mtime_nsec;
+      uint32_t key_count;
+      uint32_t value_count;
+      uint32_t heap_size;
+      uint32_t reserved;
+    };
+
+    struct compiled_properties::key_entry {
+      uint32_t offset;
+      uint32_t size;
+      uint32_t first_value;
+      uint32_t value_count;
+    };
+
+    struct compiled_properties::value_entry {
+      uint32_t offset;
+      uint32_t size;
+    };
+
+    compiled_properties::compiled_properties() : data_(NULL), size_(0), mapped_(false), header_(NULL), keys_(NULL), values_(NULL), heap_(NULL) {}
+
+    compiled_properties::~compiled_properties() {
+      close();
+    }
+
+    bool compiled_properties::compile(const properties & p, const std::string & path, const file_identity * source) {
+      std::vector<property_view> keys = p.keys();
+      std::vector<key_entry> key_table(keys.size());
+      std::vector<value_entry> value_table;
+      std::string heap;
+      for(unsigned long i = 0; i < keys.size(); i++) {
+        const std::vector<property_view> * values = p.find(keys[i].str());
+        key_table[i].offset = heap.size();
+        key_table[i].size = keys[i].size;
+        key_table[i].first_value = value_table.size();
+        key_table[i].value_count = values->size();
+        heap.append(keys[i].data, keys[i].size);
+        for(unsigned long j = 0; j < values->size(); j++) {
+          value_entry v;
+          v.offset = heap.size();
+          v.size = (*values)[j].size;
+          value_table.push_back(v);
+          heap.append((*values)[j].data, (*values)[j].size);
+        }
+      }
+      if(heap.size() > 0xffffffffUL || value_table.size() > 0xffffffffUL) {
+        return false;
+      }
+
+      header h;
+      memset(&h, 0, sizeof(h));
+      memcpy(h.magic, COMPILED_PROPERTIES_MAGIC, sizeof(h.magic));
+      h.byte_order = COMPILED_PROPERTIES_BYTE_ORDER;
+      if(NULL != source) {
+        h.has_source = 1;
+        h.source_device = source->device;
+        h.source_inode = source->inode;
+        h.source_size = source->size;
+        h.source_mtime = source->mtime;
+        h.source_mtime_nsec = source->mtime_nsec;
+      }
+      h.key_count = key_table.size();
+      h.value_count = value_table.size();
+      h.heap_size = heap.size();
+
+      std::string temp;
+      if(!create_temp_file(path, temp)) {
+        return false;
+      }
+      {
+        std::ofstream os(temp.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+        if(!os.is_open()) {
+          ::unlink(temp.c_str());
+          return false;
+        }
+        os.write((const char *)&h, sizeof(h));
+        if(!key_table.empty()) {
+          os.write((const char *)&key_table[0], key_table.size() * sizeof(key_entry));
+        }
+        if(!value_table.empty()) {
+          os.write((const char *)&value_table[0], value_table.size() * sizeof(value_entry));
+        }
+        os.write(heap.data(), heap.size());
+        os.flush();
+        if(!os.good()) {
+          os.close();
+          ::unlink(temp.c_str());
+          return false;
+        }
+      }
+#ifdef __WIN32__
+      ::remove(path.c_str());
+#endif
+      if(0 != ::rename(temp.c_str(), path.c_str())) {
+        ::unlink(temp.c_str());
+        return false;
+      }
+      return true;
+    }
+
+    bool compiled_properties::open(const std::string & path, const std::string & source) {
+      close();
+      int fd = ::open(path.c_str(), O_RDONLY | O_BINARY);
+      if(-1 == fd) {
+        return false;
+      }
+      struct stat st;
+      if(0 != ::fstat(fd, &st) || (unsigned long)st.st_size < sizeof(header)) {
+        ::close(fd);
+        return false;
+      }
+      size_ = st.st_size;
+#ifdef HAVE_SYS_MMAN_H
+      void * mapping = ::mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(MAP_FAILED != mapping) {
+        data_ = (const char *)mapping;
+        mapped_ = true;
+      }
+#endif
+      if(NULL == data_) {
+        // No mapping : the file is read in memory instead
+        char * buffer = new char[size_];
+        unsigned long total = 0;
+        long n = 0;
+        while(total < size_ && 0 < (n = ::read(fd, buffer + total, size_ - total))) {
+          total += n;
+        }
+        data_ = buffer;
+        if(total < size_) {
+          ::close(fd);
+          close();
+          return false;
+        }
+      }
+      ::close(fd);
+
+      header_ = (const header *)data_;
+      unsigned long tables = sizeof(header) + (unsigned long)header_->key_count * sizeof(key_entry) +
+        (unsigned long)header_->value_count * sizeof(value_entry);
+      bool valid = 0 == memcmp(header_->magic, COMPILED_PROPERTIES_MAGIC, sizeof(header_->magic)) &&
+        COMPILED_PROPERTIES_BYTE_ORDER == header_->byte_order && tables + header_->heap_size == size_;
+      if(valid && !source.empty()) {
+        file_identity id;
+        valid = 1 == header_->has_source && checksum_cache::identify(source, id) &&
+          header_->source_device == (int64_t)id.device && header_->source_inode == (int64_t)id.inode &&
+          header_->source_size == id.size && header_->source_mtime == id.mtime && header_->source_mtime_nsec == id.mtime_nsec;
+      }
+      if(!valid) {
+        close();
+        return false;
+      }
+      keys_ = (const key_entry *)(data_ + sizeof(header));
+      values_ = (const value_entry *)(keys_ + header_->key_count);
+      heap_ = (const char *)(values_ + header_->value_count);
+      return true;
+    }
+
+    void compiled_properties::close() {
+      if(NULL != data_) {
+#ifdef HAVE_SYS_MMAN_H
+        if(mapped_) {
+          ::munmap((void *)data_, size_);
+        }
+#endif
+        if(!mapped_) {
+          delete[] data_;
+        }
+      }
+      data_ = NULL;
+      size_ = 0;
+      mapped_ = false;
+      header_ = NULL;
+      keys_ = NULL;
+      values_ = NULL;
+      heap_ = NULL;
+    }
+
+    bool compiled_properties::is_open() const {
+      return NULL != keys_;
+    }
+
+    unsigned long compiled_properties::size() const {
+      return is_open() ? header_->key_count : 0;
+    }
+
+    // Entries written by another version of the library, or damaged, are cut to the heap
+    property_view compiled_properties::string_at(uint32_t offset, uint32_t size) const {
+      property_view view;
+      if(offset > header_->heap_size || size > header_->heap_size - offset) {
+        offset = 0;
+        size = 0;
+      }
+      view.data = heap_ + offset;
+      view.size = size;
+      return view;
+    }
+
+    void compiled_properties::values_of(const key_entry & key, std::vector<property_view> & values) const {
+      values.clear();
+      if(key.first_value > header_->value_count || key.value_count > header_->value_count - key.first_value) {
+        return;
+      }
+      values.reserve(key.value_count);
+      for(uint32_t i = 0; i < key.value_count; i++) {
+        const value_entry & v = values_[key.first_value + i];
+        values.push_back(string_at(v.offset, v.size));
+      }
+    }
+
+    bool compiled_properties::find(const std::string & key, std::vector<property_view> & values) const {
+      if(!is_open()) {
+        return false;
+      }
+      std::string::size_type first = key.find_first_not_of(' ');
+      std::string::size_type last = key.find_last_not_of(' ');
+      const char * k = key.data() + (std::string::npos == first ? key.size() : first);
+      unsigned long size = (std::string::npos == first) ? 0 : last - first + 1;
+
+      unsigned long low = 0;
+      unsigned long high = header_->key_count;
+      while(low < high) {
+        unsigned long middle = low + (high - low) / 2;
+        property_view candidate = string_at(keys_[middle].offset, keys_[middle].size);
+        int c = memcmp(candidate.data, k, candidate.size < size ? candidate.size : size);
+        if(0 == c) {
+          c = (candidate.size < size) ? -1 : (candidate.size > size ? 1 : 0);
+        }
+        if(0 == c) {
+          values_of(keys_[middle], values);
+          return true;
+        }
+        if(c < 0) {
+          low = middle + 1;
+        } else {
+          high = middle;
+        }
+      }
+      return false;
+    }
+
+    std::string compiled_properties::get_property(const std::string & key) const {
+      std::vector<property_view> values;
+      if(!find(key, values) || 1 != values.size()) {
+        return "";
+      }
+      return values[0].str();
+    }
+
+    void compiled_properties::load(properties & p) const {
+      if(!is_open()) {
+        return;
+      }
+      p.reserve(p.count_all_props() + header_->key_count);
+      std::vector<property_view> values;
+      for(uint32_t i = 0; i < header_->key_count; i++) {
+        values_of(keys_[i], values);
+        p.add_values(string_at(keys_[i].offset, keys_[i].size), values.empty() ? NULL : &values[0], values.size());
+      }
+    }
+  }
+}
@@ -9,6 +9,7 @@
 #endif
 
 #define HAVE_FASTSTREAM 1
+#define FASTSTREAM_WRITE_EXTENT (8 * 1024 * 1024)
 
 #if defined(HAVE_SYS_MMAN_H) && defined(HAVE__SC_PAGESIZE)
 #include <unistd.h>
@@ -58,7 +59,11 @@ mgz::io::faststream::faststream(const std::string & path, mgz::io::mode m) :
   file_descriptor_(-1), 
   offset_(0),
   file_size_(0),
-  read_size_(0) {
+  read_size_(0),
+  capacity_(0),
+  mapping_(NULL),
+  mapping_offset_(0),
+  mapping_size_(0) {
 #ifdef HAVE__SC_PAGESIZE
   pagesize_ = sysconf(_SC_PAGESIZE);
   if(0 > pagesize_) {
@@ -87,7 +92,11 @@ mgz::io::faststream::faststream(mgz::io::file f, mode m) :
   file_descriptor_(-1), 
   offset_(0),
   file_size_(0),
-  read_size_(0) {
+  read_size_(0),
+  capacity_(0),
+  mapping_(NULL),
+  mapping_offset_(0),
+  mapping_size_(0) {
 #ifdef HAVE__SC_PAGESIZE
   pagesize_ = sysconf(_SC_PAGESIZE);
   if(0 > pagesize_) {
@@ -110,7 +119,11 @@ mgz::io::faststream::faststream(mgz::io::file f, mode m) :
 }
 
 mgz::io::faststream::~faststream() {
-  close();
+  // May run while unwinding from another faststream exception : errors are dropped here
+  try {
+    close();
+  } catch(...) {
+  }
 }
 
 bool mgz::io::faststream::open(long i) {
@@ -120,9 +133,19 @@ bool mgz::io::faststream::open(long i) {
     pages(i);
   }
 
+  offset_ = 0;
+  capacity_ = 0;
   if(mgz::io::out == mode_) {
     file_descriptor_ = ::open(path_.c_str(), O_RDONLY);
     get_file_size();
+    map(0, file_size_, false);
+#if defined(HAVE_SYS_MMAN_H) && defined(MADV_SEQUENTIAL) && defined(MADV_WILLNEED)
+    if(NULL != mapping_) {
+      // Read ahead aggressively, and drop pages behind the reader
+      madvise(mapping_, mapping_size_, MADV_SEQUENTIAL);
+      madvise(mapping_, mapping_size_, MADV_WILLNEED);
+    }
+#endif
   } else {
     file_descriptor_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, (mode_t)0644);
   }
@@ -132,10 +155,49 @@ bool mgz::io::faststream::open(long i) {
   return open_;
 }
 
+// Maps size bytes of the file, from offset (a multiple of the page size)
+void mgz::io::faststream::map(long offset, long size, bool writable) {
+  unmap();
+  if(0 >= size) {
+    return;
+  }
+#if defined(HAVE_CREATEFILEMAPPING) && defined(HAVE_MAPVIEWOFFILE)
+  void *data = win_mmap(NULL, size, writable ? PAGE_READWRITE : PAGE_WRITECOPY, writable ? FILE_MAP_WRITE : FILE_MAP_COPY, file_descriptor_, offset);
+  if(NULL == data) {
+#else
+  void *data = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file_descriptor_, offset);
+  if(MAP_FAILED == data) {
+#endif
+    THROW(ErrorWhileReadingFile, "Error mapping file %s (offset: %ld)", path_.c_str(), offset);
+  }
+  mapping_ = static_cast<unsigned char *>(data);
+  mapping_offset_ = offset;
+  mapping_size_ = size;
+}
+
+void mgz::io::faststream::unmap() {
+  if(NULL == mapping_) {
+    return;
+  }
+#ifdef HAVE_UNMAPVIEWOFFILE
+  UnmapViewOfFile(mapping_);
+#else
+  munmap(mapping_, mapping_size_);
+#endif
+  mapping_ = NULL;
+  mapping_offset_ = 0;
+  mapping_size_ = 0;
+}
+
 bool mgz::io::faststream::close() {
   if(open_) {
-    if(mgz::io::in == mode_) {
-      flush(true);
+    unmap();
+    // The file is allocated by extents : cut the unused end
+    if(mgz::io::in == mode_ && capacity_ > offset_ && 0 != ::ftruncate(file_descriptor_, offset_)) {
+      ::close(file_descriptor_);
+      open_ = false;
+      file_descriptor_ = -1;
+      THROW(CantWriteFile, "Can't truncate file %s", path_.c_str());
     }
     if(-1 != ::close(file_descriptor_)) {
       open_ = false;
@@ -150,91 +212,68 @@ bool mgz::io::faststream::close() {
 }
 
 std::vector<unsigned char> mgz::io::faststream::read() {
+  faststream_view window = view();
+  return std::vector<unsigned char>(window.data, window.data + window.size);
+}
+
+mgz::io::faststream_view mgz::io::faststream::view() {
   if(mgz::io::out != mode_) {
     THROW(CantReadFile, "Can't read file open with mgz::io::in mode");
   }
-  std::vector<unsigned char> result;
+  faststream_view window;
+  window.data = NULL;
+  window.size = 0;
 
-  if(offset_ < file_size_) {
+  if(NULL != mapping_ && offset_ < file_size_) {
     long rest = (file_size_ - offset_);
-    read_size_ = (rest >= pages_)?pages_:rest;
-    result.resize(read_size_);
-
-#if defined(HAVE_CREATEFILEMAPPING) && defined(HAVE_MAPVIEWOFFILE)
-    void *data = win_mmap(NULL, pages_, PAGE_WRITECOPY, FILE_MAP_COPY, file_descriptor_, offset_);
-    if(NULL == data) {
-#else
-    void *data = mmap(NULL, pages_, PROT_READ, MAP_SHARED, file_descriptor_, offset_);
-    if((int*)data == (int*)-1) {
-#endif
-      THROW(ErrorWhileReadingFile, "Error reading file %s (offset: %ld)", path_.c_str(), offset_);
-    }
-
-    memcpy(&result[0], data, read_size_);
-#ifdef HAVE_UNMAPVIEWOFFILE
-    UnmapViewOfFile(data);
-#else
-    munmap(data, pages_);
-#endif
-
-    offset_ += pages_;
-  } else {
-    read_size_ = 0;
+    window.data = mapping_ + offset_;
+    window.size = (rest >= pages_)?pages_:rest;
+    offset_ += window.size;
   }
+  read_size_ = window.size;
 
-  return result;
+  return window;
 }
 
 long mgz::io::faststream::write(const std::vector<unsigned char> & buffer) {
-  if(mgz::io::in != mode_) {
-    THROW(CantWriteFile, "Can't write file open with mgz::io::out mode");
-  }
-
-  buffer_.insert(buffer_.end(), buffer.begin(), buffer.end());
-  if(buffer_.size() >= pages_) {
-    flush();
+  if(!buffer.empty()) {
+    memcpy(reserve(buffer.size()), &buffer[0], buffer.size());
+    commit(buffer.size());
   }
-
-  return offset_ + buffer_.size();
+  return offset_;
 }
 
-void mgz::io::faststream::flush(bool force) {
-  long size = buffer_.size();
-  long length = size;
-
-  if(!force) {
-    long keep = size % pages_;
-    length = size - keep;
-  }
-
-  if(-1 == lseek(file_descriptor_, offset_ + length, SEEK_SET)) {
-    THROW(CantWriteFile, "Can't seek");
-  }
-  if(1 != ::write(file_descriptor_, "", 1)) {
-    THROW(CantWriteFile, "Can't write");
+unsigned char * mgz::io::faststream::reserve(long size) {
+  if(mgz::io::in != mode_) {
+    THROW(CantWriteFile, "Can't write file open with mgz::io::out mode");
   }
 
-#if defined(HAVE_CREATEFILEMAPPING) && defined(HAVE_MAPVIEWOFFILE)
-  void *data = win_mmap(NULL, length, PAGE_WRITECOPY, FILE_MAP_COPY, file_descriptor_, offset_);
-  if(NULL == data) {
-#else
-  void *data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor_, offset_);
-  if((int*)data == MAP_FAILED) {
+  if(offset_ + size > capacity_) {
+    // Grow the file by whole extents, so that most reservations neither allocate nor remap
+    long extent = (pages_ > FASTSTREAM_WRITE_EXTENT) ? pages_ : FASTSTREAM_WRITE_EXTENT;
+    long capacity = ((offset_ + size + extent - 1) / extent) * extent;
+    bool allocated = false;
+#ifdef HAVE_FALLOCATE
+    allocated = (0 == ::fallocate(file_descriptor_, 0, capacity_, capacity - capacity_));
 #endif
-    THROW(ErrorWhileWrittingingFile, "Error writing file %s (offset: %ld)", path_.c_str(), offset_);
+    if(!allocated && 0 != ::ftruncate(file_descriptor_, capacity)) {
+      THROW(CantWriteFile, "Can't extend file %s", path_.c_str());
+    }
+    capacity_ = capacity;
   }
-  memcpy(data, &buffer_[0], length);
 
-#ifdef HAVE_UNMAPVIEWOFFILE
-  UnmapViewOfFile(data);
-#else
-  munmap(data, length);
-#endif
-  offset_ += length;
+  if(NULL == mapping_ || offset_ + size > mapping_offset_ + mapping_size_) {
+    // The window starts at the page holding the current offset, and runs to the end of the allocation
+    long start = (offset_ / pagesize_) * pagesize_;
+    map(start, capacity_ - start, true);
+  }
 
-  buffer_.erase(buffer_.begin(), buffer_.begin() + length);
+  return mapping_ + (offset_ - mapping_offset_);
 }
 
+void mgz::io::faststream::commit(long size) {
+  offset_ += size;
+}
 
 long mgz::io::faststream::gcount() const {
   return read_size_;
@@ -8,14 +8,30 @@
 
 #include "regex/re.h"
 #include "io/file.h"
+#include "io/async_io.h"
+#include "io/stream.h"
 #include "util/string.h"
 #include "util/exception.h"
+#include "util/thread.h"
+#include "security/adler32.h"
+#include "security/md5.h"
+#include "security/sha1.h"
+#include "security/sha2.h"
+#include "security/ripem.h"
 
 #include <sys/param.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#ifndef __WIN32__
+#include <sys/ioctl.h>
+#endif
+#ifdef HAVE_FICLONE
+#include <linux/fs.h>
+#endif
 #include <unistd.h>
 #include <algorithm>
 #include <fstream>
@@ -25,80 +41,132 @@ namespace mgz {
   namespace io {
     file::file(std::string path) : status_set_(false) {
       filepath_ = tilde_to_home(mgz::util::replace_all(path, ALTERNATE_FILE_SEPARATOR_CHAR, FILE_SEPARATOR_CHAR));
+      memset(&status_, 0, sizeof(status_));
+      memset(&lstatus_, 0, sizeof(lstatus_));
     }
+    file::file(const std::string & path, const file_status & status, const file_status & lstatus) :
+      filepath_(path), status_set_(true), status_(status), lstatus_(lstatus) {}
     file::file() : status_set_(false) {
       filepath_ = "";
+      memset(&status_, 0, sizeof(status_));
+      memset(&lstatus_, 0, sizeof(lstatus_));
     }
 
     bool file::operator==(file f) {
       return get_path().compare(f.get_path()) == 0;
     }
 
-    void file::initialize_status() {
-      if(exist() && false == status_set_) {
-        int stat_result;
-        int lstat_result;
+    /*
+     * Read the metadata snapshot : one lstat, plus a stat for symbolic links. A missing file
+     * is not cached, so that a file created after the check is seen by the next one.
+     */
+    bool file::load_status() {
+      if(status_set_) {
+        return true;
+      }
+      if(filepath_.empty()) {
+        return false;
+      }
 #ifdef __WIN32__
-        // On F***ing Win$, stat does not support FILE_SEPARATOR at end of path for a directory
-        std::string path_ = filepath_;
-        if (path_.find_last_of(FILE_SEPARATOR) == (path_.size() - 1)) {
-          path_ = path_.substr(0, path_.size() - 1);
-          //TODO: Attention, pansement ci-dessous - Investiguer pourquoi on reçoit parfois \ dans filepath_ sur PC.
-          if (path_.empty()) {
-            return;
-          }
+      // On F***ing Win$, stat does not support FILE_SEPARATOR at end of path for a directory
+      std::string path_ = filepath_;
+      if (path_.find_last_of(FILE_SEPARATOR) == (path_.size() - 1)) {
+        path_ = path_.substr(0, path_.size() - 1);
+        //TODO: Attention, pansement ci-dessous - Investiguer pourquoi on reçoit parfois \ dans filepath_ sur PC.
+        if (path_.empty()) {
+          return false;
         }
-        stat_result = _stat(path_.c_str(), &status_);
-        lstat_result = _stat(path_.c_str(), &lstatus_);
+      }
+      if(0 != _stat(path_.c_str(), &status_)) {
+        return false;
+      }
+      lstatus_ = status_;
 #else
-        stat_result = stat(filepath_.c_str(), &status_);
-        lstat_result = lstat(filepath_.c_str(), &lstatus_);
+      if(0 != lstat(filepath_.c_str(), &lstatus_)) {
+        return false;
+      }
+      if(S_ISLNK(lstatus_.st_mode)) {
+        if(0 != stat(filepath_.c_str(), &status_)) {
+          return false; // Broken link
+        }
+      } else {
+        status_ = lstatus_;
+      }
 #endif
-        if (0 != stat_result || 0 != lstat_result) {
-          THROW(CantReadFileStatusException,"Cannot read the attributes of the file %s (err = %d)",filepath_.c_str(),stat_result);
+      status_set_ = true;
+      return true;
+    }
+
+    void file::refresh() {
+      status_set_ = false;
+    }
+
+    std::vector<file> file::list(const std::string & directory) {
+      std::vector<file> entries;
+      std::vector<std::string> names;
+      DIR * dp = opendir(directory.c_str());
+      if(NULL == dp) {
+        return entries;
+      }
+      struct dirent * ent;
+      while(NULL != (ent = readdir(dp))) {
+        if(0 != strcmp(ent->d_name, ".") && 0 != strcmp(ent->d_name, "..")) {
+          names.push_back(ent->d_name);
         }
+      }
+      std::sort(names.begin(), names.end());
 
-        status_set_ = true;
+      entries.reserve(names.size());
+      for(std::vector<std::string>::iterator it = names.begin(); it != names.end(); it++) {
+        std::string path = directory;
+        if(!path.empty() && FILE_SEPARATOR_CHAR != path[path.size() - 1]) {
+          path.append(FILE_SEPARATOR);
+        }
+        path.append(*it);
+#if defined(HAVE_FSTATAT) && !defined(__WIN32__)
+        // Entries are stat'ed relative to the open directory : no path lookup for each of them
+        file_status lstatus;
+        file_status status;
+        if(0 == ::fstatat(dirfd(dp), it->c_str(), &lstatus, AT_SYMLINK_NOFOLLOW)) {
+          if(!S_ISLNK(lstatus.st_mode)) {
+            entries.push_back(file(path, lstatus, lstatus));
+            continue;
+          }
+          if(0 == ::fstatat(dirfd(dp), it->c_str(), &status, 0)) {
+            entries.push_back(file(path, status, lstatus));
+            continue;
+          }
+        }
+#endif
+        entries.push_back(file(path));
       }
+      closedir(dp);
+      return entries;
     }
 
     mode_t file::get_mode() {
-      initialize_status();
+      load_status();
       return status_.st_mode;
     }
 
     mode_t file::get_lmode() {
-      initialize_status();
+      load_status();
       return lstatus_.st_mode;
     }
 
     bool file::is_type(mode_t m) {
-      if (exist()) {
-        return (((get_mode()) & S_IFMT) == m);
-      } else {
-        return false;
-      }
+      return load_status() && ((status_.st_mode & S_IFMT) == m);
     }
 
     bool file::is_ltype(mode_t m) {
-      if (exist()) {
-        return (((get_lmode()) & S_IFMT) == m);
-      } else {
-        return false;
-      }
+      return load_status() && ((lstatus_.st_mode & S_IFMT) == m);
     }
 
     long file::size() {
-      struct stat status;
-      if (exist() && !is_directory()) {
-        if(0 != stat(filepath_.c_str(), &status)) {
-          return -1;
-        }
-
-        return (long)status.st_size;
-      } else {
+      if (is_type(S_IFDIR) || !load_status()) {
         return 0L;
       }
+      return (long)status_.st_size;
     }
 
     bool file::is_file() {
@@ -405,19 +473,12 @@ namespace mgz {
     }
 
     bool file::exist() {
-      bool result = !filepath_.empty();
-      if(result) {
-#ifdef HAVE_GETFILEATTRIBUTES
-        result = result && (::GetFileAttributes(filepath_.c_str()) != 0xFFFFFFFF);
-#else
-        result = result && (-1 != access(filepath_.c_str(), 0));
-#endif
-      }
-      return result;
+      return load_status();
     }
 
     bool file::mkdir() {
       if(!exist()) {
+        refresh();
         return make_directory(filepath_.c_str()) == 0;
       }
       return true;
@@ -455,6 +516,7 @@ namespace mgz {
           }
         }
 
+        refresh();
         return true;
       } else {
         return true;
@@ -468,9 +530,11 @@ namespace mgz {
       if(exist() || is_broken_symlink()) {
 #ifdef HAVE_REMOVEDIRECTORY
         if(is_directory()) {
+          refresh();
           return ::RemoveDirectory(filepath_.c_str());
         }
 #endif
+        refresh();
         return ::remove(filepath_.c_str()) == 0;
       }
       return true;
@@ -507,6 +571,41 @@ namespace mgz {
       }
     }
 
+#ifndef __WIN32__
+    /*
+     * Copy a regular file : a copy-on-write clone when the file system supports it, otherwise
+     * an in-kernel copy (see copy_fd) into a preallocated destination.
+     */
+    static bool copy_regular_file(const std::string & from, const std::string & to) {
+      int in = ::open(from.c_str(), O_RDONLY);
+      if(-1 == in) {
+        return false;
+      }
+      struct stat st;
+      int out = -1;
+      if(0 != fstat(in, &st) || -1 == (out = ::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR))) {
+        ::close(in);
+        return false;
+      }
+
+      bool copied = false;
+#ifdef HAVE_FICLONE
+      copied = (0 == ::ioctl(out, FICLONE, in));
+#endif
+      if(!copied) {
+#ifdef HAVE_FALLOCATE
+        if(0 < st.st_size) {
+          ::fallocate(out, 0, 0, st.st_size); // Only a hint : not all file systems support it
+        }
+#endif
+        copied = (st.st_size == copy_fd(in, 0, out, st.st_size));
+      }
+      copied = (0 == ::close(out)) && copied;
+      ::close(in);
+      return copied;
+    }
+#endif
+
     bool file::copy(file destination) {
       if(is_directory()) {
         if(exist() && destination.mkdirs()) {
@@ -549,15 +648,9 @@ namespace mgz {
             return (0 != ::CopyFile(filepath_.c_str(), destination.get_path().c_str(), FALSE));
 #else
             mode_t origin_mode=get_mode();
-            std::ifstream src(filepath_.c_str(), std::ios::in | std::ios::binary);
-            std::ofstream dst(destination.get_path().c_str(), std::ios::out | std::ios::binary);
-            if(src.is_open() && dst.is_open()) {
-              dst << src.rdbuf();
-            } else {
+            if(!copy_regular_file(filepath_, destination.get_path())) {
               return false;
             }
-            src.close();
-            dst.close();
             destination.set_permissions(origin_mode);
             return true;
 #endif
@@ -620,6 +713,7 @@ namespace mgz {
           } //else, it is a "rename" of the dir (+ optionnally a "move")
         }
         int result = rename( filepath_.c_str() , destination.filepath_.c_str());
+        refresh();
         if (0 ==result) {
           return true;
         }
@@ -661,6 +755,7 @@ namespace mgz {
 #ifndef __WIN32__
       mode_t save_mode=get_mode();
       int chmod_result=chmod( filepath_.c_str(), save_mode | S_IEXEC | S_IXGRP | S_IXOTH  );
+      refresh();
       if (0 != chmod_result) {
         THROW(CantSetPermissionsException,"Cannot set the executable attributes of the file %s (err = %d)",filepath_.c_str(),chmod_result);
       }
@@ -670,6 +765,7 @@ namespace mgz {
     void file::set_permissions(mode_t perms) {
 #ifndef __WIN32__
       int chmod_result=chmod( filepath_.c_str(), perms  );
+      refresh();
       if (0 != chmod_result) {
         THROW(CantSetPermissionsException,"Cannot set the permissions for element %s (err = %d)",filepath_.c_str(),chmod_result);
       }
@@ -681,7 +777,7 @@ namespace mgz {
      */
     struct tm file::get_modification_datetime() {
       time_t time_sec;
-      initialize_status();
+      load_status();
 #ifdef __APPLE__
       time_sec=status_.st_mtimespec.tv_sec;
 #else
@@ -695,7 +791,7 @@ namespace mgz {
      */
     struct tm file::get_creation_datetime() {
       time_t time_sec;
-      initialize_status();
+      load_status();
 #ifdef __APPLE__
       time_sec=status_.st_birthtimespec.tv_sec;
 #else
@@ -704,7 +800,215 @@ namespace mgz {
       return (*localtime(&time_sec));
     }
 
-#define HASH_BUFFER_SIZE ( 1024 * 2048 ) //2MB buffer
+#define DIGEST_BLOCK_SIZE ( 1024 * 1024 )
+#define DIGEST_RING_SIZE 4
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+    // One running digest of file::digest
+    class digest_state {
+      public:
+        virtual ~digest_state() {}
+        virtual void update(const unsigned char * data, size_t size) = 0;
+        virtual std::string hexdigest() = 0;
+    };
+
+    template <typename T> class digest_state_of : public digest_state {
+      public:
+        void update(const unsigned char * data, size_t size) {
+          sum.update(data, size);
+        }
+        std::string hexdigest() {
+          sum.finalize();
+          return sum.hexdigest();
+        }
+        T sum;
+    };
+
+    // Blocks read once and shared by the digest threads : a block is only
+    // overwritten when every digest is done with it
+    class digest_ring {
+      public:
+        digest_ring(unsigned int digests) : blocks_(DIGEST_RING_SIZE, std::vector<unsigned char>(DIGEST_BLOCK_SIZE)),
+          sizes_(DIGEST_RING_SIZE, 0), consumed_(digests, 0), produced_(0), finished_(false) {}
+
+        // Reader side : the block to fill next
+        unsigned char * free_block() {
+          mgz::util::scoped_lock lock(lock_);
+          while(produced_ - *std::min_element(consumed_.begin(), consumed_.end()) >= DIGEST_RING_SIZE) {
+            changed_.wait(lock_);
+          }
+          return &blocks_[produced_ % DIGEST_RING_SIZE][0];
+        }
+
+        void publish(size_t size) {
+          mgz::util::scoped_lock lock(lock_);
+          sizes_[produced_ % DIGEST_RING_SIZE] = size;
+          produced_++;
+          changed_.broadcast();
+        }
+
+        void finish() {
+          mgz::util::scoped_lock lock(lock_);
+          finished_ = true;
+          changed_.broadcast();
+        }
+
+        // Digest side : false at the end of the file
+        bool next(unsigned int digest, const unsigned char *& data, size_t & size) {
+          mgz::util::scoped_lock lock(lock_);
+          while(consumed_[digest] == produced_ && !finished_) {
+            changed_.wait(lock_);
+          }
+          if(consumed_[digest] == produced_) {
+            return false;
+          }
+          data = &blocks_[consumed_[digest] % DIGEST_RING_SIZE][0];
+          size = sizes_[consumed_[digest] % DIGEST_RING_SIZE];
+          return true;
+        }
+
+        void release(unsigned int digest) {
+          mgz::util::scoped_lock lock(lock_);
+          consumed_[digest]++;
+          changed_.broadcast();
+        }
+
+      private:
+        std::vector<std::vector<unsigned char> > blocks_;
+        std::vector<size_t> sizes_;
+        std::vector<unsigned long> consumed_;
+        unsigned long produced_;
+        bool finished_;
+        mgz::util::mutex lock_;
+        mgz::util::condition changed_;
+    };
+
+    class digest_task : public mgz::util::task {
+      public:
+        digest_task(digest_ring * ring, unsigned int index, digest_state * state) : ring_(ring), index_(index), state_(state) {}
+
+        void run() {
+          const unsigned char * data;
+          size_t size;
+          while(ring_->next(index_, data, size)) {
+            state_->update(data, size);
+            ring_->release(index_);
+          }
+        }
+
+      private:
+        digest_ring * ring_;
+        unsigned int index_;
+        digest_state * state_;
+    };
+
+    // Fills buffer, unless the end of the file is reached ; -1 on error
+    static long read_block(int fd, unsigned char * buffer, long size) {
+      long total = 0;
+      while(total < size) {
+        long n = ::read(fd, buffer + total, size - total);
+        if(0 > n && EINTR == errno) {
+          continue;
+        }
+        if(0 > n) {
+          return -1;
+        }
+        if(0 == n) {
+          break;
+        }
+        total += n;
+      }
+      return total;
+    }
+
+    // Reads the file once, feeding every digest ; each digest has its own thread when there are several, if parallel
+    static bool digest_file(const std::string & path, std::vector<digest_state *> & states, bool parallel) {
+      int fd = ::open(path.c_str(), O_RDONLY | O_BINARY);
+      if(-1 == fd) {
+        return false;
+      }
+      long n;
+      if(1 == states.size() || !parallel) {
+        std::vector<unsigned char> buffer(DIGEST_BLOCK_SIZE);
+        while(0 < (n = read_block(fd, &buffer[0], buffer.size()))) {
+          for(unsigned int i = 0; i < states.size(); i++) {
+            states[i]->update(&buffer[0], n);
+          }
+        }
+      } else {
+        digest_ring ring(states.size());
+        std::vector<digest_task> tasks;
+        for(unsigned int i = 0; i < states.size(); i++) {
+          tasks.push_back(digest_task(&ring, i, states[i]));
+        }
+        mgz::util::thread_pool pool(states.size());
+        for(unsigned int i = 0; i < tasks.size(); i++) {
+          pool.submit(&tasks[i]);
+        }
+        do {
+          unsigned char * block = ring.free_block();
+          n = read_block(fd, block, DIGEST_BLOCK_SIZE);
+          if(0 < n) {
+            ring.publish(n);
+          }
+        } while(DIGEST_BLOCK_SIZE == n);
+        ring.finish();
+        pool.wait();
+      }
+      ::close(fd);
+      return 0 <= n;
+    }
+
+    std::map<file_digest, std::string> file::digest(int algorithms, bool parallel) {
+      if (!exist()) {
+        THROW(FileShouldExistException,"Cannot open the file %s as it does not exist",filepath_.c_str())
+      }
+      if (is_directory()) {
+        THROW(FileShouldNotBeFolderException, "Cannot compute the digest of %s as it is a folder",filepath_.c_str() );
+      }
+
+      std::vector<file_digest> names;
+      std::vector<digest_state *> states;
+      if(algorithms & DIGEST_CRC32) {
+        names.push_back(DIGEST_CRC32);
+        states.push_back(new digest_state_of<security::crc32sum>());
+      }
+      if(algorithms & DIGEST_ADLER32) {
+        names.push_back(DIGEST_ADLER32);
+        states.push_back(new digest_state_of<security::adler32sum>());
+      }
+      if(algorithms & DIGEST_MD5) {
+        names.push_back(DIGEST_MD5);
+        states.push_back(new digest_state_of<security::md5sum>());
+      }
+      if(algorithms & DIGEST_SHA1) {
+        names.push_back(DIGEST_SHA1);
+        states.push_back(new digest_state_of<security::sha1sum>());
+      }
+      if(algorithms & DIGEST_SHA256) {
+        names.push_back(DIGEST_SHA256);
+        states.push_back(new digest_state_of<security::sha256sum>());
+      }
+      if(algorithms & DIGEST_RIPEMD160) {
+        names.push_back(DIGEST_RIPEMD160);
+        states.push_back(new digest_state_of<security::ripem160sum>());
+      }
+
+      std::map<file_digest, std::string> result;
+      bool read = states.empty() || digest_file(filepath_, states, parallel);
+      for(unsigned int i = 0; i < states.size(); i++) {
+        if(read) {
+          result[names[i]] = states[i]->hexdigest();
+        }
+        delete states[i];
+      }
+      if(!read) {
+        THROW(FileShouldExistException, "Cannot read the file %s", filepath_.c_str());
+      }
+      return result;
+    }
 
     uint32_t file::crc32() {
       if (!exist()) {
@@ -713,21 +1017,107 @@ namespace mgz {
       if (is_directory()) {
         THROW(FileShouldNotBeFolderException, "Cannot compute the crc32 of %s as it is a folder",filepath_.c_str() );
       }
-      char * buffer = new char[HASH_BUFFER_SIZE];
-      security::crc32sum crc32;
+      digest_state_of<security::crc32sum> crc32;
+      std::vector<digest_state *> states(1, &crc32);
+      if(!digest_file(filepath_, states, false)) {
+        THROW(FileShouldExistException, "Cannot read the file %s", filepath_.c_str());
+      }
+      crc32.sum.finalize();
 
-      std::ifstream file(get_path().c_str(), std::ios::in | std::ios::binary);
-      while(file.good()) {
-        memset(buffer, 0, HASH_BUFFER_SIZE);
-        file.read(buffer, HASH_BUFFER_SIZE);
-        int read_size = file.gcount();
-        crc32.update(buffer, read_size);
+      return crc32.sum.crc;
+    }
+
+#define ASYNC_HASH_BUFFER_SIZE ( 256 * 1024 )
+
+    class crc32_batch;
+
+    // Checksum of one file of file::crc32(files, io) : the file is opened, then read one block at a time
+    class crc32_job : public async_callback {
+      public:
+        crc32_job() : batch(NULL), opened(false), fd(-1), offset(0), error(0), crc(0) {}
+
+        void completed(long result);
+
+        crc32_batch * batch;
+        std::string path;
+        bool opened;
+        int fd;
+        long long offset;
+        int error;
+        std::vector<char> buffer;
+        security::crc32sum sum;
+        uint32_t crc;
+    };
+
+    // Keeps as many files open as the queue has room for operations
+    class crc32_batch {
+      public:
+        crc32_batch(std::vector<file> & files, async_io & io) : jobs(files.size()), next(0), io(io) {
+          for(unsigned long i = 0; i < files.size(); i++) {
+            jobs[i].batch = this;
+            jobs[i].path = files[i].get_path();
+          }
+        }
+
+        void start_next() {
+          if(next < jobs.size()) {
+            crc32_job & job = jobs[next++];
+            io.open(job.path, O_RDONLY | O_BINARY, 0, &job);
+          }
+        }
+
+        std::vector<crc32_job> jobs;
+        unsigned long next;
+        async_io & io;
+    };
+
+    void crc32_job::completed(long result) {
+      if(!opened) {
+        opened = true;
+        if(0 > result) {
+          error = -result;
+          batch->start_next();
+          return;
+        }
+        fd = result;
+        buffer.resize(ASYNC_HASH_BUFFER_SIZE);
+        batch->io.read(fd, &buffer[0], buffer.size(), offset, this);
+        return;
       }
-      crc32.finalize();
+      if(0 < result) {
+        sum.update(&buffer[0], result);
+        offset += result;
+        batch->io.read(fd, &buffer[0], buffer.size(), offset, this);
+        return;
+      }
+      if(0 > result) {
+        error = -result;
+      }
+      ::close(fd);
+      crc = sum.finalize().crc;
+      std::vector<char>().swap(buffer);
+      batch->start_next();
+    }
 
-      delete buffer;
+    std::vector<uint32_t> file::crc32(std::vector<file> & files, async_io & io) {
+      crc32_batch batch(files, io);
+      for(unsigned int i = 0; i < io.depth(); i++) {
+        batch.start_next();
+      }
+      io.wait();
 
-      return crc32.crc;
+      std::vector<uint32_t> result(files.size());
+      for(unsigned long i = 0; i < batch.jobs.size(); i++) {
+        crc32_job & job = batch.jobs[i];
+        if(EISDIR == job.error) {
+          THROW(FileShouldNotBeFolderException, "Cannot compute the crc32 of %s as it is a folder", job.path.c_str());
+        }
+        if(0 != job.error) {
+          THROW(FileShouldExistException, "Cannot read the file %s (err = %d)", job.path.c_str(), job.error);
+        }
+        result[i] = job.crc;
+      }
+      return result;
     }
   }
 }
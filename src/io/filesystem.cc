@@ -1,16 +1,26 @@
 #include <sys/types.h>
-#include <dirent.h>
 #include <algorithm>
+#include <set>
 
 #include "config.h"
+#if __cplusplus >= 201103L
+#include <unordered_map>
+#define DIFF_HASH_MAP std::unordered_map
+#elif defined(HAVE_TR1_UNORDERED_MAP)
+#include <tr1/unordered_map>
+#define DIFF_HASH_MAP std::tr1::unordered_map
+#else
+#include <map>
+#define DIFF_HASH_MAP std::map
+#endif
 #ifdef __WIN32__
 #include <windows.h>
 #else
 #include <sys/statvfs.h>
 #endif // __WIN32__
 #include "io/filesystem.h"
-#include "regex/re.h"
-#include "util/string.h"
+#include "io/walker.h"
+#include "util/thread.h"
 
 
 //#include "util/log.h"
@@ -112,18 +122,20 @@ namespace mgz {
     }
 
     std::vector<file> fs::all_files(bool recursive, bool relative) {
+      return all_files(recursive, relative, 1);
+    }
+
+    std::vector<file> fs::all_files(bool recursive, bool relative, unsigned int threads) {
       files_.clear();
-      if(0 != getdir_(recursive, relative, false)) {
+      if(0 != getdir_(recursive, relative, false, threads)) {
         files_.clear();
       }
       return files_;
     }
 
     std::vector<file> fs::content() {
-      files_.clear();
-      if(0 != getdir_(false, false, true)) {
-        files_.clear();
-      }
+      // Entries come with their metadata, read while listing
+      files_ = file::list(root_path);
       return files_;
     }
 
@@ -138,65 +150,114 @@ namespace mgz {
       return true;
     }
 
-    bool fs::copy_content(const fs & destination) {
-      
+    // Copies one file of fs::copy_content
+    class copy_task : public mgz::util::task {
+      public:
+        copy_task(const file & src, const file & dst) : src_(src), dst_(dst), copied_(false) {}
+
+        void run() {
+          try {
+            copied_ = src_.copy(dst_);
+          } catch(...) {
+            copied_ = false;
+          }
+        }
+
+        bool copied() const { return copied_; }
+
+      private:
+        file src_;
+        file dst_;
+        bool copied_;
+    };
+
+    bool fs::copy_content(const fs & destination, unsigned int threads) {
       std::vector<file> content_list = all_files(true, true);
-      std::vector<file>::iterator it;
-      for(it = content_list.begin(); it < content_list.end(); it++) {
+      std::vector<copy_task> tasks;
+      tasks.reserve(content_list.size());
+      std::set<std::string> parents;
+      for(std::vector<file>::iterator it = content_list.begin(); it < content_list.end(); it++) {
         mgz::io::file src = mgz::io::file(root_path).join(*it);
         mgz::io::file dst = mgz::io::file(destination.root_path).join(*it);
-        if(!src.copy(dst)) { return false; }
+        // Directories are created here : concurrent mkdirs of the same parents would fail
+        if(parents.insert(dst.get_parent_path()).second && !dst.get_parent_file().mkdirs()) {
+          return false;
+        }
+        tasks.push_back(copy_task(src, dst));
+      }
+
+      if(0 == threads) {
+        threads = mgz::util::thread_pool::cpu_count();
+      }
+      if(1 == threads || 1 >= tasks.size()) {
+        for(std::vector<copy_task>::iterator it = tasks.begin(); it != tasks.end(); it++) {
+          it->run();
+          if(!it->copied()) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      mgz::util::thread_pool pool(tasks.size() < threads ? tasks.size() : threads);
+      for(std::vector<copy_task>::iterator it = tasks.begin(); it != tasks.end(); it++) {
+        pool.submit(&(*it));
+      }
+      pool.wait();
+      for(std::vector<copy_task>::iterator it = tasks.begin(); it != tasks.end(); it++) {
+        if(!it->copied()) {
+          return false;
+        }
       }
       return true;
     }
 
-    int fs::getdir_(bool recursive, bool relative, bool keep_dir) {
-      return getdir_(root_path, recursive, relative, keep_dir);
+    int fs::getdir_(bool recursive, bool relative, bool keep_dir, unsigned int threads) {
+      return getdir_(root_path, recursive, relative, keep_dir, threads);
     }
 
-    int fs::getdir_(std::string root, bool recursive, bool relative, bool keep_dir) {
-      DIR *dp;
-      struct dirent *dirp;
-      if((dp  = opendir(root.c_str())) == NULL) {
-        return -1;
-      }
+    // Collects the entries found by the walker
+    class listing_callback : public walk_callback {
+      public:
+        listing_callback(bool keep_dir) : keep_dir_(keep_dir) {}
 
-      while ((dirp = readdir(dp)) != NULL) {
-        std::string local_path(dirp->d_name);
-        if(0 != local_path.compare(".") && 0 != local_path.compare("..")) {
-          std::string current_path = root;
-          current_path.append(FILE_SEPARATOR).append(local_path);
-
-          mgz::io::file current_file(current_path);
-          if(!current_file.is_directory() || (current_file.is_directory() && keep_dir)) {
-            if(!relative) {
-              files_.push_back(current_file);
-            } else {
-              std::string path(current_path);
-              std::string path_regex("^(");
-              path_regex.append(root_path);
-              if(root_path.find_last_of(FILE_SEPARATOR) != (root_path.size() - 1)) {
-                path_regex.append(FILE_SEPARATOR);
-              }
-              path_regex.append(")(.*)$");
-              mgz::util::replace_all(path_regex, FILE_SEPARATOR, FILE_SEPARATOR_REGEX);
-
-              mgz::regex::RE r(path_regex);
-              if(r.find(path) && 2 == r.captures()) {
-                path = r.match(1);
-              }
-              files_.push_back(mgz::io::file(path));
-            }
-          } 
-
-          if(current_file.is_directory() && recursive && !current_file.is_symlink()) {
-            if(-1 == getdir_(current_path, recursive, relative, keep_dir)) {
-              return -1;
-            }
+        bool entry(const walk_entry & e) {
+          if(!e.is_directory || keep_dir_) {
+            entries.push_back(e);
           }
+          return true;
+        }
+
+        std::vector<walk_entry> entries;
+
+      private:
+        bool keep_dir_;
+    };
+
+    // All the entries share the root : ordering by relative path orders by path too
+    static bool entry_before(const walk_entry & a, const walk_entry & b) {
+      return a.relative < b.relative;
+    }
+
+    int fs::getdir_(std::string root, bool recursive, bool relative, bool keep_dir, unsigned int threads) {
+      listing_callback listing(keep_dir);
+      walker w(root, recursive ? threads : 1);
+      w.set_read_status(true);
+      if(!w.walk(listing, recursive)) {
+        return -1;
+      }
+      // The walker order depends on thread scheduling
+      std::sort(listing.entries.begin(), listing.entries.end(), entry_before);
+      files_.reserve(files_.size() + listing.entries.size());
+      for(std::vector<walk_entry>::iterator it = listing.entries.begin(); it != listing.entries.end(); it++) {
+        const std::string & path = relative ? (*it).relative : (*it).path;
+        if((*it).has_status) {
+          // Metadata read while listing : the files are never stat'ed again
+          files_.push_back(mgz::io::file(path, (*it).status, (*it).lstatus));
+        } else {
+          files_.push_back(mgz::io::file(path));
         }
       }
-      closedir(dp);
       return 0;
     }
 
@@ -206,22 +267,52 @@ namespace mgz {
     }
 
     std::vector<fs_diff> fs::get_diff(fs dest, bool keep_version, fsfilter *filter) {
+      return filter_diff(join(dest, keep_version), filter);
+    }
+
+    std::vector<fs_diff> fs::filter_diff(const std::vector<fs_diff> & diff, fsfilter *filter) {
+      if(NULL == filter) {
+        return diff;
+      }
+      std::vector<fs_diff> filtered;
+      for(std::vector<fs_diff>::const_iterator it = diff.begin(); it != diff.end(); it++) {
+        fs_diff d = *it;
+        if(filter->filter(d)) {
+          filtered.push_back(d);
+        } else {
+          //Logger::info("[FS/Filter] ignore files %s - %s", d.left.get_path().c_str(), d.right.get_path().c_str());
+        }
+      }
+      return filtered;
+    }
+
+    std::vector<fs_diff> fs::join(fs & dest, bool keep_version) {
       std::vector<fs_diff> diff;
 
+      // Hash join on the (version-less) paths : each source file is paired with the first
+      // unmatched destination file having the same key, in destination order.
       std::vector<file> dest_files = dest.all_files(true, true);
-      EACH_RFILES_R(src_file, root_path) {
-        std::vector<file>::iterator it;
-        std::vector<file> current;
-        current.push_back(*src_file);
+      std::vector<bool> matched(dest_files.size(), false);
+      DIFF_HASH_MAP<std::string, std::vector<unsigned long> > dest_index;
+      for(unsigned long i = 0; i < dest_files.size(); i++) {
+        dest_index[diff_key(dest_files[i], keep_version)].push_back(i);
+      }
+      DIFF_HASH_MAP<std::string, unsigned long> next_match;
 
-        if(keep_version) {
-          it = std::search(dest_files.begin(), dest_files.end(), current.begin(), current.end(), search_predicate_with_version);
-        } else {
-          it = std::search(dest_files.begin(), dest_files.end(), current.begin(), current.end(), search_predicate_without_version);
+      EACH_RFILES_R(src_file, root_path) {
+        std::vector<file>::iterator it = dest_files.end();
+        std::string key = diff_key(*src_file, keep_version);
+
+        DIFF_HASH_MAP<std::string, std::vector<unsigned long> >::iterator candidates = dest_index.find(key);
+        if(candidates != dest_index.end()) {
+          unsigned long & next = next_match[key];
+          if(next < candidates->second.size()) {
+            matched[candidates->second[next]] = true;
+            it = dest_files.begin() + candidates->second[next];
+            next++;
+          }
         }
         if(it != dest_files.end()) {
-          int pos = std::find(dest_files.begin(), dest_files.end(), *it) - dest_files.begin();
-
           fs_diff d;
           d.left = mgz::io::file().join(root_path, src_file->get_path());
           d.left_root = mgz::io::file(root_path);
@@ -230,59 +321,105 @@ namespace mgz {
           d.right_root = mgz::io::file(dest.root_path);
 
           d.status = BOTH;
-          
-          if(NULL == filter || filter->filter(d)) {
-            diff.push_back(d);
-          } else {
-            //Logger::info("[FS/Filter] ignore files %s - %s", d.left.get_path().c_str(), d.right.get_path().c_str());
-          }
-
-          dest_files.erase(dest_files.begin()+pos);
+          diff.push_back(d);
         } else {
           fs_diff d;
           d.left = mgz::io::file().join(root_path, src_file->get_path());
           d.left_root = mgz::io::file(root_path);
 
           d.status = LEFT_ONLY;
-          
-          if(NULL == filter || filter->filter(d)) {
-            diff.push_back(d);
-          } else {
-            //Logger::info("[FS/Filter] ignore \"left-only\" file %s", d.left.get_path().c_str());
-          }
+          diff.push_back(d);
         }
       }
 
       std::vector<file>::iterator itr;
       for(itr = dest_files.begin(); itr < dest_files.end(); itr++) {
+        if(matched[itr - dest_files.begin()]) {
+          continue;
+        }
         fs_diff d;
         d.right = mgz::io::file().join(dest.root_path, itr->get_path());
         d.right_root = mgz::io::file(dest.root_path);
 
         d.status = RIGHT_ONLY;
-        
-        if(NULL == filter || filter->filter(d)) {
-          diff.push_back(d);
-        } else {
-          //Logger::info("[FS/Filter] ignore \"right-only\" file %s", d.right.get_path().c_str());
-        }
+        diff.push_back(d);
       }
 
       return diff;
     }
 
-    bool fs::search_predicate_with_version(file v1, file v2) {
-      return (v1.get_path()).compare(v2.get_path()) == 0;
+    // Hashes both sides of a pair whose size and modification time did not decide
+    class content_compare_task : public mgz::util::task {
+      public:
+        content_compare_task(fs_diff * d, fs_checksum algorithm, checksum_cache * cache) :
+          diff_(d), algorithm_(algorithm), cache_(cache) {}
+
+        void run() {
+          std::string left = cache_->checksum(diff_->left.get_path(), algorithm_);
+          std::string right = cache_->checksum(diff_->right.get_path(), algorithm_);
+          diff_->status = (!left.empty() && left == right) ? IDENTICAL : MODIFIED;
+        }
+
+      private:
+        fs_diff * diff_;
+        fs_checksum algorithm_;
+        checksum_cache * cache_;
+    };
+
+    std::vector<fs_diff> fs::get_content_diff(fs dest, bool keep_version, fs_checksum algorithm, checksum_cache *cache, fsfilter *filter) {
+      std::vector<fs_diff> diff = join(dest, keep_version);
+      checksum_cache local_cache;
+      if(NULL == cache) {
+        cache = &local_cache;
+      }
+
+      std::vector<content_compare_task> tasks;
+      tasks.reserve(diff.size());
+      for(std::vector<fs_diff>::iterator it = diff.begin(); it != diff.end(); it++) {
+        if(BOTH != it->status) {
+          continue;
+        }
+        file_identity left, right;
+        if(!checksum_cache::identify(it->left.get_path(), left) || !checksum_cache::identify(it->right.get_path(), right)) {
+          it->status = MODIFIED;
+        } else if(it->left.is_directory() || it->right.is_directory()) {
+          it->status = (it->left.is_directory() && it->right.is_directory()) ? IDENTICAL : MODIFIED;
+        } else if(left.size != right.size) {
+          it->status = MODIFIED;
+        } else if(left == right || (left.mtime == right.mtime && left.mtime_nsec == right.mtime_nsec)) {
+          it->status = IDENTICAL;
+        } else {
+          tasks.push_back(content_compare_task(&(*it), algorithm, cache));
+        }
+      }
+
+      if(!tasks.empty()) {
+        mgz::util::thread_pool pool(tasks.size() < mgz::util::thread_pool::cpu_count() ? tasks.size() : 0);
+        for(std::vector<content_compare_task>::iterator it = tasks.begin(); it != tasks.end(); it++) {
+          pool.submit(&(*it));
+        }
+        pool.wait();
+      }
+
+      return filter_diff(diff, filter);
     }
 
-    bool fs::search_predicate_without_version(file v1, file v2) {
-      return (v1.get_path_without_version()).compare(v2.get_path_without_version()) == 0;
+    std::string fs::diff_key(file f, bool keep_version) {
+      return keep_version ? f.get_path() : f.get_path_without_version();
     }
 	  
     bool fs::exist() {
 		  return mgz::io::file(root_path).exist();
     }
   
+    fs_iterator fs::begin(bool recursive, bool relative, fsfilter *filter) {
+      return fs_iterator(root_path, recursive, relative, false, filter);
+    }
+
+    fs_iterator fs::end() {
+      return fs_iterator();
+    }
+
     std::vector<file> fs::all_files_filtered(/* const */ fsfilter &filter, bool keep_ignored) {
       std::vector<file> content=this->all_files(true,false);
       std::vector<file> filtered_content;
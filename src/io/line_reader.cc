@@ -0,0 +1,98 @@
+#include "config.h"
+#include "io/line_reader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#ifndef __WIN32__
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+#define LINE_READER_BUFFER_SIZE ( 64 * 1024 )
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+namespace mgz {
+  namespace io {
+    line_reader::line_reader(const std::string & path) : fd_(::open(path.c_str(), O_RDONLY | O_BINARY)), owned_(true),
+      failed_(false), eof_(false), buffer_(LINE_READER_BUFFER_SIZE), start_(0), end_(0) {}
+
+    line_reader::line_reader(int fd) : fd_(fd), owned_(false), failed_(false), eof_(false),
+      buffer_(LINE_READER_BUFFER_SIZE), start_(0), end_(0) {}
+
+    line_reader::~line_reader() {
+      if(owned_ && -1 != fd_) {
+        ::close(fd_);
+      }
+    }
+
+    bool line_reader::is_open() const {
+      return -1 != fd_;
+    }
+
+    bool line_reader::failed() const {
+      return -1 == fd_ || failed_;
+    }
+
+    // Moves the pending bytes to the front of the buffer, growing it if a single line fills it,
+    // and reads more ; returns the number of bytes read, 0 at the end of the file, -1 on error
+    long line_reader::fill() {
+      if(0 < start_) {
+        memmove(&buffer_[0], &buffer_[start_], end_ - start_);
+        end_ -= start_;
+        start_ = 0;
+      }
+      if(end_ == buffer_.size()) {
+        buffer_.resize(buffer_.size() * 2);
+      }
+      for(;;) {
+        long n = ::read(fd_, &buffer_[0] + end_, buffer_.size() - end_);
+        if(0 > n && EINTR == errno) {
+          continue;
+        }
+        if(0 < n) {
+          end_ += n;
+        }
+        return n;
+      }
+    }
+
+    bool line_reader::next(line_view & line) {
+      if(-1 == fd_ || failed_) {
+        return false;
+      }
+      unsigned long scanned = start_;
+      for(;;) {
+        const char * nl = (const char *)memchr(&buffer_[0] + scanned, '\n', end_ - scanned);
+        if(NULL != nl) {
+          line.data = &buffer_[start_];
+          line.size = nl - line.data;
+          start_ += line.size + 1;
+          break;
+        }
+        if(eof_) {
+          if(start_ == end_) {
+            return false;
+          }
+          line.data = &buffer_[start_];
+          line.size = end_ - start_;
+          start_ = end_;
+          break;
+        }
+        scanned = end_ - start_; // The pending bytes have no end of line, and are moved to the front
+        long n = fill();
+        if(0 > n) {
+          failed_ = true;
+          return false;
+        }
+        eof_ = (0 == n);
+      }
+      if(0 < line.size && '\r' == line.data[line.size - 1]) {
+        line.size--;
+      }
+      return true;
+    }
+  }
+}
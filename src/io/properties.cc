@@ -2,45 +2,347 @@
 #include "util/exception.h"
 #include "xml/xml.h"
 #include "io/properties.h"
-
-#define CR '\r'
+#include "io/line_reader.h"
+#include "io/compiled_properties.h"
+#include <string.h>
+#include <time.h>
 
 namespace mgz {
    namespace io {
-      properties::properties() {
+#define PROPERTIES_ARENA_BLOCK ( 64 * 1024 )
+#define PROPERTIES_MIN_TABLE 16
+#define PROPERTIES_RACY_DELAY 2 // seconds
+
+      // Removes the spaces around [begin, end)
+      static void trim_range(const char *& begin, const char *& end) {
+        while(begin < end && ' ' == *begin) {
+          begin++;
+        }
+        while(end > begin && ' ' == *(end - 1)) {
+          end--;
+        }
+      }
+
+      // FNV-1a
+      static unsigned long hash_key(const char * data, unsigned long size) {
+        unsigned long hash = 2166136261UL;
+        for(unsigned long i = 0; i < size; i++) {
+          hash ^= (unsigned char)data[i];
+          hash *= 16777619UL;
+        }
+        return hash;
+      }
+
+      static bool key_less(const std::pair<property_view, const void *> & a, const std::pair<property_view, const void *> & b) {
+        int c = memcmp(a.first.data, b.first.data, a.first.size < b.first.size ? a.first.size : b.first.size);
+        return 0 == c ? a.first.size < b.first.size : c < 0;
+      }
+
+      properties::properties() : count_(0), current_(NULL), current_used_(0), arena_bytes_(0), garbage_(0) {
       }
 
-      properties::properties(mgz::io::file file) {
+      properties::properties(mgz::io::file file) : count_(0), current_(NULL), current_used_(0), arena_bytes_(0), garbage_(0) {
          load(file);
       }
 
+      properties::properties(const properties & other) : count_(0), current_(NULL), current_used_(0), arena_bytes_(0), garbage_(0),
+        propertiesFile(other.propertiesFile) {
+        merge(other);
+      }
+
+      void properties::merge(const properties & other) {
+        reserve(count_ + other.count_);
+        for(unsigned long i = 0; i < other.table_.size(); i++) {
+          const entry & e = other.table_[i];
+          if(e.used) {
+            add_values(e.key, e.values.empty() ? NULL : &e.values[0], e.values.size());
+          }
+        }
+      }
+
+      properties & properties::operator=(const properties & other) {
+        if(this != &other) {
+          properties copy(other);
+          swap(copy);
+        }
+        return *this;
+      }
+
+      properties::~properties() {
+        for(unsigned long i = 0; i < blocks_.size(); i++) {
+          delete[] blocks_[i];
+        }
+      }
+
+      void properties::swap(properties & other) {
+        table_.swap(other.table_);
+        blocks_.swap(other.blocks_);
+        std::swap(count_, other.count_);
+        std::swap(current_, other.current_);
+        std::swap(current_used_, other.current_used_);
+        std::swap(arena_bytes_, other.arena_bytes_);
+        std::swap(garbage_, other.garbage_);
+        std::swap(propertiesFile, other.propertiesFile);
+      }
+
+      // Copies a string in the arena. Small strings are packed in shared blocks, big ones get their own.
+      property_view properties::intern(const char * data, unsigned long size) {
+        property_view view;
+        view.size = size;
+        if(0 == size) {
+          view.data = "";
+          return view;
+        }
+        char * dest;
+        if(size > PROPERTIES_ARENA_BLOCK / 4) {
+          dest = new char[size];
+          blocks_.push_back(dest);
+        } else {
+          if(NULL == current_ || current_used_ + size > PROPERTIES_ARENA_BLOCK) {
+            current_ = new char[PROPERTIES_ARENA_BLOCK];
+            current_used_ = 0;
+            blocks_.push_back(current_);
+          }
+          dest = current_ + current_used_;
+          current_used_ += size;
+        }
+        memcpy(dest, data, size);
+        arena_bytes_ += size;
+        view.data = dest;
+        return view;
+      }
+
+      // Copies the keys and values still used in a new arena, once most of the old one is garbage
+      void properties::compact() {
+        if(garbage_ < PROPERTIES_ARENA_BLOCK || 2 * garbage_ < arena_bytes_) {
+          return;
+        }
+        std::vector<char *> old;
+        old.swap(blocks_);
+        current_ = NULL;
+        current_used_ = 0;
+        arena_bytes_ = 0;
+        garbage_ = 0;
+        for(unsigned long i = 0; i < table_.size(); i++) {
+          entry & e = table_[i];
+          if(!e.used) {
+            continue;
+          }
+          e.key = intern(e.key.data, e.key.size);
+          for(unsigned long j = 0; j < e.values.size(); j++) {
+            e.values[j] = intern(e.values[j].data, e.values[j].size);
+          }
+        }
+        for(unsigned long i = 0; i < old.size(); i++) {
+          delete[] old[i];
+        }
+      }
+
+      long properties::index_of(const char * key, unsigned long size) const {
+        if(table_.empty()) {
+          return -1;
+        }
+        const char * end = key + size;
+        trim_range(key, end);
+        size = end - key;
+        unsigned long hash = hash_key(key, size);
+        unsigned long mask = table_.size() - 1;
+        for(unsigned long i = hash & mask; table_[i].used; i = (i + 1) & mask) {
+          const entry & e = table_[i];
+          if(e.hash == hash && e.key.size == size && 0 == memcmp(e.key.data, key, size)) {
+            return i;
+          }
+        }
+        return -1;
+      }
+
+      // Returns the index of the (trimmed) key, adding it without values if needed
+      unsigned long properties::insert(const char * key, unsigned long size) {
+        const char * end = key + size;
+        trim_range(key, end);
+        size = end - key;
+        long found = index_of(key, size);
+        if(-1 != found) {
+          return found;
+        }
+        if((count_ + 1) * 4 > table_.size() * 3) {
+          rehash(table_.empty() ? PROPERTIES_MIN_TABLE : table_.size() * 2);
+        }
+        unsigned long hash = hash_key(key, size);
+        unsigned long mask = table_.size() - 1;
+        unsigned long i = hash & mask;
+        while(table_[i].used) {
+          i = (i + 1) & mask;
+        }
+        table_[i].hash = hash;
+        table_[i].key = intern(key, size);
+        table_[i].used = true;
+        count_++;
+        return i;
+      }
+
+      void properties::append(unsigned long index, const char * value, unsigned long size) {
+        property_view v = intern(value, size);
+        table_[index].values.push_back(v);
+      }
+
+      void properties::release_values(unsigned long index) {
+        std::vector<property_view> & values = table_[index].values;
+        for(unsigned long i = 0; i < values.size(); i++) {
+          garbage_ += values[i].size;
+        }
+        values.clear();
+      }
+
+      void properties::rehash(unsigned long size) {
+        std::vector<entry> old;
+        old.swap(table_);
+        table_.resize(size);
+        unsigned long mask = size - 1;
+        for(unsigned long j = 0; j < old.size(); j++) {
+          if(!old[j].used) {
+            continue;
+          }
+          unsigned long i = old[j].hash & mask;
+          while(table_[i].used) {
+            i = (i + 1) & mask;
+          }
+          table_[i].hash = old[j].hash;
+          table_[i].key = old[j].key;
+          table_[i].used = true;
+          table_[i].values.swap(old[j].values);
+        }
+      }
+
+      void properties::reserve(unsigned long count) {
+        unsigned long size = table_.empty() ? PROPERTIES_MIN_TABLE : table_.size();
+        while(count * 4 > size * 3) {
+          size *= 2;
+        }
+        if(size != table_.size()) {
+          rehash(size);
+        }
+      }
+
+      // Entries ordered by key, so that stored files do not depend on the hash table
+      std::vector<const properties::entry *> properties::sorted() const {
+        std::vector<std::pair<property_view, const entry *> > keys;
+        keys.reserve(count_);
+        for(unsigned long i = 0; i < table_.size(); i++) {
+          if(table_[i].used) {
+            keys.push_back(std::make_pair(table_[i].key, &table_[i]));
+          }
+        }
+        std::sort(keys.begin(), keys.end(), key_less);
+        std::vector<const entry *> result;
+        result.reserve(keys.size());
+        for(unsigned long i = 0; i < keys.size(); i++) {
+          result.push_back(keys[i].second);
+        }
+        return result;
+      }
+
+      std::vector<property_view> properties::keys() const {
+        std::vector<const entry *> entries = sorted();
+        std::vector<property_view> result;
+        result.reserve(entries.size());
+        for(unsigned long i = 0; i < entries.size(); i++) {
+          result.push_back(entries[i]->key);
+        }
+        return result;
+      }
+
+      void properties::add_values(const property_view & key, const property_view * values, unsigned long count) {
+        unsigned long index = insert(key.data, key.size);
+        for(unsigned long i = 0; i < count; i++) {
+          append(index, values[i].data, values[i].size);
+        }
+      }
+
+      bool properties::load_compiled(mgz::io::file & file, mgz::io::file & cache) {
+        compiled_properties compiled;
+        if(!compiled.open(cache.get_path(), file.get_path())) {
+          return false;
+        }
+        compiled.load(*this);
+        return true;
+      }
+
+      // The cache is only written if the file did not change while it was parsed, and if it was not
+      // modified in the last seconds : a file rewritten within the timestamp granularity would keep
+      // the same identity. A cache that can't be written is not an error.
+      void properties::store_compiled(const properties & parsed, mgz::io::file & file, mgz::io::file & cache, const file_identity * before) {
+        file_identity after;
+        if(NULL != before && checksum_cache::identify(file.get_path(), after) && *before == after &&
+            after.mtime + PROPERTIES_RACY_DELAY < time(NULL)) {
+          compiled_properties::compile(parsed, cache.get_path(), &after);
+        }
+      }
+
+      void properties::load(mgz::io::file file, mgz::io::file cache) {
+        propertiesFile = file;
+        if(load_compiled(file, cache)) {
+          return;
+        }
+        file_identity before;
+        bool identified = checksum_cache::identify(file.get_path(), before);
+        properties parsed;
+        parsed.load(file);
+        store_compiled(parsed, file, cache, identified ? &before : NULL);
+        merge(parsed);
+      }
+
+      void properties::load_xml(mgz::io::file file, mgz::io::file cache) {
+        if(load_compiled(file, cache)) {
+          return;
+        }
+        file_identity before;
+        bool identified = checksum_cache::identify(file.get_path(), before);
+        properties parsed;
+        parsed.load_xml(file);
+        store_compiled(parsed, file, cache, identified ? &before : NULL);
+        merge(parsed);
+      }
+
      void properties::load(mgz::io::file file) {
        propertiesFile = file;
-       std::string line;
-       std::string key;
-       std::vector<std::string> values;
-       size_t found;
-       
-       std::ifstream propertyFile (file.get_path().c_str(), std::ios::in);
        if (!file.exist()) {
          THROW(PropertyFileNotFoundException,"Properties file %s does not exist", file.get_path().c_str());
        }
-       if( propertyFile.is_open() ) {
-         while( propertyFile.good() ) {
-           getline( propertyFile, line );
-           if(!line.empty() && *line.rbegin() == CR) {
-             line.erase( line.length()-1, 1);
-           }
-           if(!mgz::util::trim(line).empty() && line.find_first_of("#")!=0) {
-             found = line.find_first_of("=");
-             key = line.substr(0, found);
-             values = mgz::util::split(line.substr(found+1), PROPERTIES_SEPARATOR);
-             add_properties(key, values);
+       mgz::io::line_reader reader(file.get_path());
+       if (!reader.is_open()) {
+         THROW(PropertyFileOpenException,"Properties file %s cannot be opened", file.get_path().c_str());
+       }
+
+       // Lines are parsed in the reader's buffer, and keys and values copied straight in the arena
+       mgz::io::line_view line;
+       while (reader.next(line)) {
+         const char * begin = line.data;
+         const char * end = line.data + line.size;
+         trim_range(begin, end);
+         if (begin == end || '#' == line.data[0]) {
+           continue;
+         }
+         const char * found = (const char *)memchr(line.data, '=', line.size);
+         unsigned long index = insert(line.data, (NULL == found ? line.data + line.size : found) - line.data);
+
+         // Values are split on the separator like mgz::util::split, over the untrimmed remainder of the
+         // line : a trailing separator adds no value, but one followed by blanks adds an empty value
+         const char * value = (NULL == found) ? line.data : found + 1;
+         const char * line_end = line.data + line.size;
+         while (value < line_end) {
+           const char * value_end = (const char *)memchr(value, PROPERTIES_SEPARATOR, line_end - value);
+           if (NULL == value_end) {
+             value_end = line_end;
            }
+           const char * next = value_end + 1;
+           trim_range(value, value_end);
+           append(index, value, value_end - value);
+           value = next;
          }
-         propertyFile.close();
-       } else {
-         THROW(PropertyFileOpenException,"Properties file %s cannot be opened", file.get_path().c_str());
+       }
+       if (reader.failed()) {
+         THROW(PropertyFileOpenException,"Properties file %s cannot be read", file.get_path().c_str());
        }
      }
 
@@ -52,9 +354,17 @@ namespace mgz {
       void properties::store() {
          std::ofstream propertyFile (propertiesFile.get_path().c_str(), std::ios::out);
          if (propertyFile.is_open()) {
-            std::map<std::string, std::vector<std::string> >::const_iterator iter;
-            for (iter = datas.begin(); iter != datas.end(); ++iter) {
-              propertyFile << iter->first << "=" << mgz::util::join(iter->second, PROPERTIES_SEPARATOR) << std::endl;
+            std::vector<const entry *> entries = sorted();
+            for (std::vector<const entry *>::const_iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+              const entry & e = **iter;
+              propertyFile.write(e.key.data, e.key.size) << "=";
+              for (unsigned long i = 0; i < e.values.size(); i++) {
+                if (0 < i) {
+                  propertyFile << PROPERTIES_SEPARATOR;
+                }
+                propertyFile.write(e.values[i].data, e.values[i].size);
+              }
+              propertyFile << std::endl;
               if (0 !=propertyFile.rdstate()) {
                 THROW (CantStorePropertiesException,"Cannot write to property file %s", propertiesFile.get_path().c_str());
               }
@@ -74,54 +384,98 @@ namespace mgz {
       }
 
       std::string properties::get_property(std::string key) {
-         std::vector<std::string> values = get_properties(key);
-         if(1 != values.size()) {
+         const std::vector<property_view> * values = find(key);
+         if(NULL == values || 1 != values->size()) {
             return "";
          }
-         return values.at(0);
+         return (*values)[0].str();
       }
 
       std::vector<std::string> properties::get_properties(std::string key) {
         std::vector<std::string> result;
-         if(datas.count(key)!=0) // Avoids side-effect creation in the map.
-         {
-           result=datas[mgz::util::trim(key)];
-         }
+        const std::vector<property_view> * values = find(key);
+        if(NULL != values) {
+          result.reserve(values->size());
+          for(unsigned long i = 0; i < values->size(); i++) {
+            result.push_back((*values)[i].str());
+          }
+        }
         return result;
       }
 
+      const std::vector<property_view> * properties::find(const std::string & key) const {
+        long index = index_of(key.data(), key.size());
+        return -1 == index ? NULL : &table_[index].values;
+      }
+
       std::string properties::set_property(std::string key, std::string value) {
          std::string oldValue = get_property(key, "");
-         std::vector<std::string> values;
-         values.push_back(mgz::util::trim(value));
-         set_properties(key, values);
+         unsigned long index = insert(key.data(), key.size());
+         release_values(index);
+         const char * begin = value.data();
+         const char * end = begin + value.size();
+         trim_range(begin, end);
+         append(index, begin, end - begin);
+         compact();
          return oldValue;
       }
 
       std::vector<std::string> properties::set_properties(std::string key, std::vector<std::string> values) {
          std::vector<std::string> oldValues = get_properties(key);
-         datas[mgz::util::trim(key)] = values;
+         unsigned long index = insert(key.data(), key.size());
+         release_values(index);
+         for (unsigned long i = 0; i < values.size(); i++) {
+           append(index, values[i].data(), values[i].size());
+         }
+         compact();
          return oldValues;
       }
 
       void properties::add_property(std::string key, std::string value) {
-         std::vector<std::string> values;
-         values.push_back(mgz::util::trim(value));
-         add_properties(key, values);
+         unsigned long index = insert(key.data(), key.size());
+         const char * begin = value.data();
+         const char * end = begin + value.size();
+         trim_range(begin, end);
+         append(index, begin, end - begin);
       }
 
       void properties::add_properties(std::string key, std::vector<std::string> values) {
-         std::vector<std::string> currentValues = get_properties(key);
-         std::vector<std::string>::iterator it;
-         for (it = values.begin() ; it < values.end(); it++) {
-            currentValues.push_back(*it);
+         unsigned long index = insert(key.data(), key.size());
+         for (unsigned long i = 0; i < values.size(); i++) {
+           append(index, values[i].data(), values[i].size());
          }
-         set_properties(key, currentValues);
       }
-	   
 
+      // Backward shift deletion : the following entries of the probe sequence are moved up, so that
+      // lookups never need tombstones
 	   bool properties::remove(std::string key) {
-		   return datas.erase(mgz::util::trim(key))!=0;
+        long found = index_of(key.data(), key.size());
+        if(-1 == found) {
+          return false;
+        }
+        unsigned long hole = found;
+        release_values(hole);
+        garbage_ += table_[hole].key.size;
+        table_[hole].used = false;
+        count_--;
+        unsigned long mask = table_.size() - 1;
+        for(unsigned long i = (hole + 1) & mask; table_[i].used; i = (i + 1) & mask) {
+          unsigned long home = table_[i].hash & mask;
+          // The entry can move to the hole unless its home lies in (hole, i]
+          bool stays = (hole < i) ? (home > hole && home <= i) : (home > hole || home <= i);
+          if(stays) {
+            continue;
+          }
+          table_[hole].hash = table_[i].hash;
+          table_[hole].key = table_[i].key;
+          table_[hole].values.swap(table_[i].values);
+          table_[hole].used = true;
+          table_[i].used = false;
+          table_[i].values.clear();
+          hole = i;
+        }
+        compact();
+        return true;
 	   }
 
       void properties::load_xml(mgz::io::file file) {
@@ -152,16 +506,15 @@ namespace mgz {
          mgz::xml::element * props = new mgz::xml::element("properties");
 
 
-         std::map<std::string, std::vector<std::string> >::const_iterator iter;
-         for (iter = datas.begin(); iter != datas.end(); ++iter) {
-            std::vector<std::string>::iterator it;
-            std::vector<std::string> values = iter->second;
+         std::vector<const properties::entry *> entries = sorted();
+         for (std::vector<const properties::entry *>::const_iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+            std::string key = (*iter)->key.str();
+            const std::vector<property_view> & values = (*iter)->values;
 
-            for(it = values.begin(); it < values.end(); it++) {
-               //iter->first = *it
+            for(std::vector<property_view>::const_iterator it = values.begin(); it < values.end(); it++) {
                mgz::xml::element * entry = new mgz::xml::element("entry");
-               entry->SetAttribute("key", iter->first);
-               mgz::xml::text * value = new mgz::xml::text(*it);
+               entry->SetAttribute("key", key);
+               mgz::xml::text * value = new mgz::xml::text(it->str());
                entry->LinkEndChild(value);
                props->LinkEndChild(entry);
             }
@@ -0,0 +1,254 @@
+#include "config.h"
+#include "io/reloadable_properties.h"
+#include <string.h>
+#ifdef __WIN32__
+#include <windows.h>
+#else
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#define RELOAD_EVENTS_SIZE 4096
+
+namespace mgz {
+  namespace io {
+    // The slot is taken before the version : a reload waits for both slots after its swap, so a
+    // reader that got the replaced version is always waited for, whatever slot it used.
+    reloadable_properties::reader::reader(const reloadable_properties & source) : source_(source) {
+      slot_ = source.epoch_ & 1;
+      __sync_fetch_and_add(&source.readers_[slot_], 1);
+      properties_ = source.current_;
+    }
+
+    reloadable_properties::reader::~reader() {
+      __sync_fetch_and_sub(&source_.readers_[slot_], 1);
+    }
+
+    reloadable_properties::reloadable_properties(const mgz::io::file & file) : file_(file), current_(NULL), epoch_(0), version_(1),
+      identified_(false), interval_(0), stopping_(false), notify_fd_(-1), watcher_(NULL), task_(this) {
+      readers_[0] = 0;
+      readers_[1] = 0;
+      wake_fds_[0] = -1;
+      wake_fds_[1] = -1;
+      identified_ = checksum_cache::identify(file_.get_path(), identity_);
+      properties * first = new properties();
+      try {
+        first->load(file_);
+      } catch(...) {
+        delete first;
+        throw;
+      }
+      current_ = first;
+    }
+
+    reloadable_properties::~reloadable_properties() {
+      stop();
+      delete current_;
+    }
+
+    bool reloadable_properties::reload() {
+      mgz::util::scoped_lock lock(reload_lock_);
+      // The identity is taken first : a change made while parsing is seen by the next check
+      identified_ = checksum_cache::identify(file_.get_path(), identity_);
+      properties * next = new properties();
+      try {
+        next->load(file_);
+      } catch(...) {
+        delete next;
+        return false;
+      }
+      publish(next);
+      return true;
+    }
+
+    void reloadable_properties::publish(properties * next) {
+      properties * previous = current_;
+      current_ = next;
+      __sync_synchronize();
+      for(int i = 0; i < 2; i++) {
+        wait_readers(__sync_fetch_and_add(&epoch_, 1) & 1);
+      }
+      __sync_fetch_and_add(&version_, 1);
+      notify(*previous, *next);
+      delete previous;
+    }
+
+    // New readers use the other slot : this one only drains
+    void reloadable_properties::wait_readers(unsigned long slot) {
+      while(0 != __sync_fetch_and_add(&readers_[slot], 0)) {
+#ifdef __WIN32__
+        Sleep(0);
+#else
+        sched_yield();
+#endif
+      }
+    }
+
+    static bool same_values(const std::vector<property_view> * a, const std::vector<property_view> * b) {
+      if(NULL == a || NULL == b) {
+        return a == b;
+      }
+      if(a->size() != b->size()) {
+        return false;
+      }
+      for(unsigned long i = 0; i < a->size(); i++) {
+        if((*a)[i].size != (*b)[i].size || 0 != memcmp((*a)[i].data, (*b)[i].data, (*a)[i].size)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    void reloadable_properties::notify(const properties & previous, const properties & current) {
+      mgz::util::scoped_lock lock(listeners_lock_);
+      std::multimap<std::string, property_listener *>::iterator it = listeners_.begin();
+      while(it != listeners_.end()) {
+        std::multimap<std::string, property_listener *>::iterator last = listeners_.upper_bound(it->first);
+        const std::vector<property_view> * values = current.find(it->first);
+        if(!same_values(previous.find(it->first), values)) {
+          for(; it != last; it++) {
+            it->second->changed(it->first, values);
+          }
+        }
+        it = last;
+      }
+    }
+
+    std::string reloadable_properties::get_property(const std::string & key) const {
+      reader r(*this);
+      const std::vector<property_view> * values = r->find(key);
+      if(NULL == values || 1 != values->size()) {
+        return "";
+      }
+      return (*values)[0].str();
+    }
+
+    void reloadable_properties::subscribe(const std::string & key, property_listener * listener) {
+      mgz::util::scoped_lock lock(listeners_lock_);
+      listeners_.insert(std::make_pair(key, listener));
+    }
+
+    void reloadable_properties::unsubscribe(property_listener * listener) {
+      mgz::util::scoped_lock lock(listeners_lock_);
+      std::multimap<std::string, property_listener *>::iterator it = listeners_.begin();
+      while(it != listeners_.end()) {
+        if(it->second == listener) {
+          listeners_.erase(it++);
+        } else {
+          it++;
+        }
+      }
+    }
+
+    unsigned long reloadable_properties::version() const {
+      return version_;
+    }
+
+    bool reloadable_properties::uses_inotify() const {
+      return -1 != notify_fd_;
+    }
+
+    void reloadable_properties::start(unsigned int interval) {
+      if(NULL != watcher_) {
+        return;
+      }
+      interval_ = interval;
+      stopping_ = false;
+#ifndef __WIN32__
+      if(0 != ::pipe(wake_fds_)) {
+        wake_fds_[0] = wake_fds_[1] = -1;
+      }
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+      // The directory is watched : editors often replace the file rather than rewriting it
+      std::string dir = file_.get_parent_path();
+      notify_fd_ = ::inotify_init();
+      if(-1 != notify_fd_ && -1 == ::inotify_add_watch(notify_fd_, dir.empty() ? "." : dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        ::close(notify_fd_);
+        notify_fd_ = -1;
+      }
+#endif
+      watcher_ = new mgz::util::thread_pool(1);
+      watcher_->submit(&task_);
+    }
+
+    void reloadable_properties::stop() {
+      if(NULL == watcher_) {
+        return;
+      }
+      stopping_ = true;
+#ifndef __WIN32__
+      if(-1 != wake_fds_[1]) {
+        ssize_t written = ::write(wake_fds_[1], "", 1); // On failure, the watcher stops after its interval
+        (void)written;
+      }
+#endif
+      delete watcher_;
+      watcher_ = NULL;
+#ifndef __WIN32__
+      for(int i = 0; i < 2; i++) {
+        if(-1 != wake_fds_[i]) {
+          ::close(wake_fds_[i]);
+          wake_fds_[i] = -1;
+        }
+      }
+#endif
+      if(-1 != notify_fd_) {
+        ::close(notify_fd_);
+        notify_fd_ = -1;
+      }
+    }
+
+    bool reloadable_properties::changed() {
+      file_identity id;
+      bool identified = checksum_cache::identify(file_.get_path(), id);
+      mgz::util::scoped_lock lock(reload_lock_);
+      return identified != identified_ || (identified && !(id == identity_));
+    }
+
+    void reloadable_properties::watch() {
+      std::string name = file_.get_name();
+      while(!stopping_) {
+        bool event = false;
+#ifdef __WIN32__
+        Sleep(interval_);
+#else
+        struct pollfd fds[2];
+        nfds_t count = 0;
+        if(-1 != wake_fds_[0]) {
+          fds[count].fd = wake_fds_[0];
+          fds[count++].events = POLLIN;
+        }
+        if(-1 != notify_fd_) {
+          fds[count].fd = notify_fd_;
+          fds[count++].events = POLLIN;
+        }
+        int ready = ::poll(fds, count, interval_);
+        if(stopping_) {
+          break;
+        }
+#ifdef HAVE_SYS_INOTIFY_H
+        if(0 < ready && -1 != notify_fd_ && (fds[count - 1].revents & POLLIN)) {
+          char events[RELOAD_EVENTS_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+          long size = ::read(notify_fd_, events, sizeof(events));
+          for(long offset = 0; offset < size; ) {
+            const struct inotify_event * e = (const struct inotify_event *)(events + offset);
+            if((e->mask & IN_Q_OVERFLOW) || (0 < e->len && name == e->name)) {
+              event = true;
+            }
+            offset += sizeof(struct inotify_event) + e->len;
+          }
+        }
+#endif
+#endif
+        if(event || changed()) {
+          reload();
+        }
+      }
+    }
+  }
+}
@@ -1,13 +1,84 @@
+#include "config.h"
 #include "io/stream.h"
 
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+#define COPY_BUFFER_SIZE ( 1024 * 64 )
+
 std::istream& mgz::io::get_line(std::istream& is, std::string& t) {
-  std::string myline;
-  if(std::getline(is, myline)) {
-    if(myline.size() && myline[myline.size()-1] == '\r') {
-      t = myline.substr(0, myline.size() - 1);
-    } else {
-      t = myline;
-    }
+  if(std::getline(is, t) && !t.empty() && '\r' == t[t.size() - 1]) {
+    t.erase(t.size() - 1);
   }
   return is;
 }
+
+long mgz::io::copy_fd(int fd_in, long offset, int fd_out, long length) {
+  long copied = 0;
+
+#ifdef HAVE_COPY_FILE_RANGE
+  loff_t off_in = offset;
+  while(copied < length) {
+    ssize_t n = copy_file_range(fd_in, &off_in, fd_out, NULL, length - copied, 0);
+    if(0 >= n) {
+      if(0 > n && EINTR == errno) {
+        continue;
+      }
+      break; // Not supported for those descriptors (EXDEV, EINVAL, ...) or EOF, try the next method
+    }
+    copied += n;
+  }
+#endif
+
+#ifdef HAVE_SYS_SENDFILE_H
+  off_t off_send = offset + copied;
+  while(copied < length) {
+    ssize_t n = sendfile(fd_out, fd_in, &off_send, length - copied);
+    if(0 >= n) {
+      if(0 > n && EINTR == errno) {
+        continue;
+      }
+      break;
+    }
+    copied += n;
+  }
+#endif
+
+  if(copied < length) {
+    char buffer[COPY_BUFFER_SIZE];
+    if(-1 == lseek(fd_in, offset + copied, SEEK_SET)) {
+      return -1;
+    }
+    while(copied < length) {
+      long chunk = length - copied;
+      if(chunk > COPY_BUFFER_SIZE) {
+        chunk = COPY_BUFFER_SIZE;
+      }
+      ssize_t n = ::read(fd_in, buffer, chunk);
+      if(0 > n && EINTR == errno) {
+        continue;
+      }
+      if(0 >= n) {
+        return -1;
+      }
+      ssize_t written = 0;
+      while(written < n) {
+        ssize_t w = ::write(fd_out, buffer + written, n - written);
+        if(0 > w) {
+          if(EINTR == errno) {
+            continue;
+          }
+          return -1;
+        }
+        written += w;
+      }
+      copied += n;
+    }
+  }
+
+  return copied;
+}
@@ -0,0 +1,64 @@
+#include "config.h"
+#include "io/tree_hasher.h"
+#include <algorithm>
+
+namespace mgz {
+  namespace io {
+    static bool by_path(const tree_checksum & a, const tree_checksum & b) {
+      return a.path < b.path;
+    }
+
+    tree_hasher::tree_hasher(checksum_cache * cache, unsigned int threads) : cache_(cache), threads_(threads), hashed_(0) {
+      if(0 == threads_) {
+        threads_ = mgz::util::thread_pool::cpu_count();
+      }
+    }
+
+    bool tree_hasher::hash(const std::string & root, const std::vector<fs_checksum> & algorithms, std::vector<tree_checksum> & result,
+        fsfilter * filter) {
+      checksum_cache local_cache;
+      checksum_cache * cache = (NULL == cache_) ? &local_cache : cache_;
+      hashed_ = 0;
+
+      // Paths are collected first, so that the result can be sorted and filled in place
+      result.clear();
+      std::vector<std::string> paths;
+      fs_iterator it(root, true, false, false, filter);
+      for(; it != fs_iterator(); ++it) {
+        tree_checksum c;
+        c.path = it.entry().relative;
+        result.push_back(c);
+        paths.push_back(it.entry().path);
+      }
+      bool ok = !it.failed();
+
+      std::vector<hash_task> tasks;
+      tasks.reserve(result.size());
+      for(unsigned long i = 0; i < result.size(); i++) {
+        tasks.push_back(hash_task(cache, paths[i], &algorithms, &result[i]));
+      }
+      if(!tasks.empty()) {
+        mgz::util::thread_pool pool(tasks.size() < threads_ ? tasks.size() : threads_);
+        for(std::vector<hash_task>::iterator t = tasks.begin(); t != tasks.end(); t++) {
+          pool.submit(&(*t));
+        }
+        pool.wait();
+      }
+
+      for(unsigned long i = 0; i < tasks.size(); i++) {
+        if(tasks[i].hashed()) {
+          hashed_++;
+        }
+        if(!algorithms.empty() && result[i].digests[0].empty()) {
+          ok = false;
+        }
+      }
+      std::sort(result.begin(), result.end(), by_path);
+      return ok;
+    }
+
+    unsigned long tree_hasher::hashed() const {
+      return hashed_;
+    }
+  }
+}
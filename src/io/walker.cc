@@ -0,0 +1,417 @@
+#include "config.h"
+#include "io/walker.h"
+#include "io/filesystem.h"
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#ifndef __WIN32__
+#include <unistd.h>
+#endif
+
+// Queued directories above which the calling thread starts the other workers
+#define WALKER_PARALLEL_THRESHOLD 8
+
+namespace mgz {
+  namespace io {
+    // Fills an entry read from the directory at path (opened as dir_fd, if fstatat is available).
+    // Most file systems give the entry type in the dirent : only links and unknown types are stat'ed,
+    // unless the status is asked for.
+    static void make_entry(int dir_fd, const std::string & path, const std::string & relative, struct dirent * ent, bool read_status, walk_entry & e) {
+      e.path = path + FILE_SEPARATOR + ent->d_name;
+      e.relative = relative.empty() ? std::string(ent->d_name) : relative + FILE_SEPARATOR + ent->d_name;
+      e.is_directory = false;
+      e.is_symlink = false;
+      e.has_status = false;
+#if defined(HAVE_FSTATAT) && defined(HAVE_FDOPENDIR)
+      if(read_status && 0 == ::fstatat(dir_fd, ent->d_name, &e.lstatus, AT_SYMLINK_NOFOLLOW)) {
+        e.status = e.lstatus;
+        e.has_status = true;
+        if(S_ISLNK(e.lstatus.st_mode)) {
+          e.is_symlink = true;
+          e.has_status = (0 == ::fstatat(dir_fd, ent->d_name, &e.status, 0));
+          e.is_directory = e.has_status && S_ISDIR(e.status.st_mode);
+        } else {
+          e.is_directory = S_ISDIR(e.lstatus.st_mode);
+        }
+        return;
+      }
+      unsigned char type = DT_UNKNOWN;
+#ifdef _DIRENT_HAVE_D_TYPE
+      type = ent->d_type;
+#endif
+      struct stat st;
+      if(DT_DIR == type) {
+        e.is_directory = true;
+      } else if(DT_LNK == type) {
+        e.is_symlink = true;
+        e.is_directory = (0 == ::fstatat(dir_fd, ent->d_name, &st, 0) && S_ISDIR(st.st_mode));
+      } else if(DT_UNKNOWN == type && 0 == ::fstatat(dir_fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+        if(S_ISLNK(st.st_mode)) {
+          e.is_symlink = true;
+          e.is_directory = (0 == ::fstatat(dir_fd, ent->d_name, &st, 0) && S_ISDIR(st.st_mode));
+        } else {
+          e.is_directory = S_ISDIR(st.st_mode);
+        }
+      }
+#else
+      mgz::io::file f(e.path);
+      e.is_directory = f.is_directory();
+      e.is_symlink = f.is_symlink();
+#endif
+    }
+
+    // Opens a directory ; dir_fd receives its descriptor when fdopendir is available, -1 otherwise
+    static DIR * open_dir(int parent_fd, const std::string & path, const char * name, int & dir_fd) {
+      dir_fd = -1;
+#if defined(HAVE_FSTATAT) && defined(HAVE_FDOPENDIR)
+      dir_fd = (NULL == name) ? ::open(path.c_str(), O_RDONLY | O_DIRECTORY) : ::openat(parent_fd, name, O_RDONLY | O_DIRECTORY);
+      if(-1 == dir_fd) {
+        return NULL;
+      }
+      DIR * dp = ::fdopendir(dir_fd);
+      if(NULL == dp) {
+        ::close(dir_fd);
+        dir_fd = -1;
+      }
+      return dp;
+#else
+      return ::opendir(path.c_str());
+#endif
+    }
+
+    walker::walker(const std::string & root, unsigned int threads) : root_(root), threads_(threads), recursive_(true),
+      read_status_(false), callback_(NULL), pool_(NULL), generation_(0), pending_(0), failed_(false) {
+      if(0 == threads_) {
+        threads_ = mgz::util::thread_pool::cpu_count();
+      }
+    }
+
+    bool walker::walk(walk_callback & callback, bool recursive) {
+      callback_ = &callback;
+      recursive_ = recursive;
+      failed_ = false;
+      generation_ = 0;
+      pending_ = 1;
+
+      unsigned int threads = recursive ? threads_ : 1;
+      for(unsigned int i = 0; i < threads; i++) {
+        queues_.push_back(new queue());
+      }
+      pending_dir root;
+      root.path = root_;
+      queues_[0]->dirs.push_back(root);
+
+      // The calling thread is the first worker
+      work(0);
+      if(NULL != pool_) {
+        pool_->wait();
+        delete pool_;
+        pool_ = NULL;
+        tasks_.clear();
+      }
+
+      for(unsigned int i = 0; i < queues_.size(); i++) {
+        delete queues_[i];
+      }
+      queues_.clear();
+      callback_ = NULL;
+      return !failed_;
+    }
+
+    void walker::set_read_status(bool read) {
+      read_status_ = read;
+    }
+
+    void walker::start_workers() {
+      for(unsigned int i = 1; i < queues_.size(); i++) {
+        tasks_.push_back(worker_task(this, i));
+      }
+      pool_ = new mgz::util::thread_pool(tasks_.size());
+      for(unsigned int i = 0; i < tasks_.size(); i++) {
+        pool_->submit(&tasks_[i]);
+      }
+    }
+
+    void walker::work(unsigned int index) {
+      for(;;) {
+        unsigned long seen;
+        {
+          mgz::util::scoped_lock lock(idle_lock_);
+          seen = generation_;
+        }
+        pending_dir dir;
+        if(next(index, dir)) {
+          list(index, dir);
+          bool spread;
+          {
+            mgz::util::scoped_lock lock(idle_lock_);
+            if(0 == --pending_) {
+              idle_.broadcast();
+            }
+            spread = (0 == index && NULL == pool_ && 1 < queues_.size() && WALKER_PARALLEL_THRESHOLD < pending_);
+          }
+          if(spread) {
+            start_workers();
+          }
+          continue;
+        }
+
+        // Nothing to list or to steal : sleep until a directory is queued or the walk is over
+        mgz::util::scoped_lock lock(idle_lock_);
+        while(0 < pending_ && seen == generation_) {
+          idle_.wait(idle_lock_);
+        }
+        if(0 == pending_) {
+          return;
+        }
+      }
+    }
+
+    bool walker::next(unsigned int index, pending_dir & dir) {
+      {
+        // Own queue is used as a stack : depth first, and directories stay warm in the cache
+        queue & own = *queues_[index];
+        mgz::util::scoped_lock lock(own.lock);
+        if(!own.dirs.empty()) {
+          dir = own.dirs.back();
+          own.dirs.pop_back();
+          return true;
+        }
+      }
+      // Steal the oldest (and likely biggest) pending subtree of another thread
+      for(unsigned int i = 1; i < queues_.size(); i++) {
+        queue & victim = *queues_[(index + i) % queues_.size()];
+        mgz::util::scoped_lock lock(victim.lock);
+        if(!victim.dirs.empty()) {
+          dir = victim.dirs.front();
+          victim.dirs.pop_front();
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void walker::push(unsigned int index, const pending_dir & dir) {
+      {
+        queue & own = *queues_[index];
+        mgz::util::scoped_lock lock(own.lock);
+        own.dirs.push_back(dir);
+      }
+      mgz::util::scoped_lock lock(idle_lock_);
+      pending_++;
+      generation_++;
+      idle_.signal();
+    }
+
+    bool walker::report(const walk_entry & e) {
+      mgz::util::scoped_lock lock(callback_lock_);
+      return callback_->entry(e);
+    }
+
+    void walker::list(unsigned int index, const pending_dir & dir) {
+      int dir_fd;
+      DIR * dp = open_dir(-1, dir.path, NULL, dir_fd);
+      if(NULL == dp) {
+        mgz::util::scoped_lock lock(idle_lock_);
+        failed_ = true;
+        return;
+      }
+
+      struct dirent * ent;
+      while(NULL != (ent = ::readdir(dp))) {
+        if(0 == strcmp(ent->d_name, ".") || 0 == strcmp(ent->d_name, "..")) {
+          continue;
+        }
+        walk_entry e;
+        make_entry(dir_fd, dir.path, dir.relative, ent, read_status_, e);
+
+        bool descend = report(e);
+        if(e.is_directory && !e.is_symlink && recursive_ && descend) {
+          pending_dir sub;
+          sub.path = e.path;
+          sub.relative = e.relative;
+          push(index, sub);
+        }
+      }
+      ::closedir(dp);
+    }
+
+    struct fs_iterator::state {
+      struct frame {
+        DIR * dir;
+        int fd;
+        std::string path;
+        std::string relative;
+      };
+
+      std::vector<frame> stack; // Directories being read, from the root to the current one
+      std::string root;
+      bool recursive;
+      bool relative;
+      bool keep_dir;
+      fsfilter * filter;
+      walk_entry entry;
+      file current;
+      bool descend; // Descend into the current entry on the next increment
+      bool failed;
+      int refs;
+
+      bool push(const std::string & path, const std::string & rel, const char * name) {
+        frame f;
+        f.dir = open_dir(stack.empty() ? -1 : stack.back().fd, path, name, f.fd);
+        if(NULL == f.dir) {
+          failed = true;
+          return false;
+        }
+        f.path = path;
+        f.relative = rel;
+        stack.push_back(f);
+        return true;
+      }
+
+      void pop() {
+        ::closedir(stack.back().dir);
+        stack.pop_back();
+      }
+
+      bool accept(const walk_entry & e) {
+        if(NULL == filter) {
+          return true;
+        }
+        fs_diff d;
+        d.status = RIGHT_ONLY;
+        d.right = file(e.path);
+        d.right_root = file(root);
+        return filter->filter(d);
+      }
+
+      // Moves to the next returned entry ; the stack is empty at the end
+      void advance() {
+        if(descend) {
+          descend = false;
+          std::string name = entry.path.substr(stack.back().path.size() + 1);
+          push(entry.path, entry.relative, name.c_str());
+        }
+        while(!stack.empty()) {
+          struct dirent * ent = ::readdir(stack.back().dir);
+          if(NULL == ent) {
+            pop();
+            continue;
+          }
+          if(0 == strcmp(ent->d_name, ".") || 0 == strcmp(ent->d_name, "..")) {
+            continue;
+          }
+          walk_entry e;
+          make_entry(stack.back().fd, stack.back().path, stack.back().relative, ent, false, e);
+          if(!accept(e)) {
+            continue;
+          }
+          bool subtree = e.is_directory && !e.is_symlink && recursive;
+          if(e.is_directory && !keep_dir) {
+            if(subtree) {
+              push(e.path, e.relative, ent->d_name);
+            }
+            continue;
+          }
+          entry = e;
+          current = file(relative ? e.relative : e.path);
+          descend = subtree;
+          return;
+        }
+      }
+    };
+
+    fs_iterator::fs_iterator() : state_(NULL) {}
+
+    fs_iterator::fs_iterator(const std::string & root, bool recursive, bool relative, bool keep_dir, fsfilter * filter) : state_(new state()) {
+      state_->root = root;
+      state_->recursive = recursive;
+      state_->relative = relative;
+      state_->keep_dir = keep_dir;
+      state_->filter = filter;
+      state_->descend = false;
+      state_->failed = false;
+      state_->refs = 1;
+      if(state_->push(root, "", NULL)) {
+        state_->advance();
+      }
+    }
+
+    fs_iterator::fs_iterator(const fs_iterator & other) : state_(other.state_) {
+      if(NULL != state_) {
+        state_->refs++;
+      }
+    }
+
+    fs_iterator & fs_iterator::operator=(const fs_iterator & other) {
+      if(state_ != other.state_) {
+        release();
+        state_ = other.state_;
+        if(NULL != state_) {
+          state_->refs++;
+        }
+      }
+      return *this;
+    }
+
+    fs_iterator::~fs_iterator() {
+      release();
+    }
+
+    void fs_iterator::release() {
+      if(NULL != state_ && 0 == --state_->refs) {
+        while(!state_->stack.empty()) {
+          state_->pop();
+        }
+        delete state_;
+      }
+      state_ = NULL;
+    }
+
+    bool fs_iterator::at_end() const {
+      return NULL == state_ || state_->stack.empty();
+    }
+
+    file & fs_iterator::operator*() {
+      return state_->current;
+    }
+
+    file * fs_iterator::operator->() {
+      return &state_->current;
+    }
+
+    fs_iterator & fs_iterator::operator++() {
+      if(!at_end()) {
+        state_->advance();
+      }
+      return *this;
+    }
+
+    bool fs_iterator::operator==(const fs_iterator & other) const {
+      if(at_end() || other.at_end()) {
+        return at_end() && other.at_end();
+      }
+      return state_ == other.state_;
+    }
+
+    bool fs_iterator::operator!=(const fs_iterator & other) const {
+      return !(*this == other);
+    }
+
+    const walk_entry & fs_iterator::entry() const {
+      return state_->entry;
+    }
+
+    void fs_iterator::prune() {
+      if(NULL != state_) {
+        state_->descend = false;
+      }
+    }
+
+    bool fs_iterator::failed() const {
+      return NULL != state_ && state_->failed;
+    }
+  }
+}
@@ -119,7 +119,7 @@ namespace mgz {
       while(length > 0) {
         if(curlen == 0 && length >= block_size) {
           sha_compress(src);
-          length += block_size * 8;
+          this->length += block_size * 8;
           src += block_size;
           length -= block_size;
         } else {
@@ -131,7 +131,7 @@ namespace mgz {
 
           if(curlen == block_size) {
             sha_compress(buf);
-            length += 8*block_size;
+            this->length += 8*block_size;
             curlen = 0;
           }
         }
@@ -259,7 +259,7 @@ namespace mgz {
       while(length > 0) {
         if(curlen == 0 && length >= block_size) {
           sha_compress(src);
-          length += block_size * 8;
+          this->length += block_size * 8;
           src += block_size;
           length -= block_size;
         } else {
@@ -271,7 +271,7 @@ namespace mgz {
 
           if(curlen == block_size) {
             sha_compress(buf);
-            length += 8*block_size;
+            this->length += 8*block_size;
             curlen = 0;
           }
         }
@@ -0,0 +1,185 @@
+#include "util/thread.h"
+#ifndef __WIN32__
+#include <unistd.h>
+#endif
+
+namespace mgz {
+  namespace util {
+#ifdef __WIN32__
+    mutex::mutex() {
+      InitializeCriticalSection(&mutex_);
+    }
+
+    mutex::~mutex() {
+      DeleteCriticalSection(&mutex_);
+    }
+
+    void mutex::lock() {
+      EnterCriticalSection(&mutex_);
+    }
+
+    void mutex::unlock() {
+      LeaveCriticalSection(&mutex_);
+    }
+
+    condition::condition() {
+      InitializeConditionVariable(&condition_);
+    }
+
+    condition::~condition() {}
+
+    void condition::wait(mutex & m) {
+      SleepConditionVariableCS(&condition_, &m.mutex_, INFINITE);
+    }
+
+    void condition::signal() {
+      WakeConditionVariable(&condition_);
+    }
+
+    void condition::broadcast() {
+      WakeAllConditionVariable(&condition_);
+    }
+#else
+    mutex::mutex() {
+      pthread_mutex_init(&mutex_, NULL);
+    }
+
+    mutex::~mutex() {
+      pthread_mutex_destroy(&mutex_);
+    }
+
+    void mutex::lock() {
+      pthread_mutex_lock(&mutex_);
+    }
+
+    void mutex::unlock() {
+      pthread_mutex_unlock(&mutex_);
+    }
+
+    condition::condition() {
+      pthread_cond_init(&condition_, NULL);
+    }
+
+    condition::~condition() {
+      pthread_cond_destroy(&condition_);
+    }
+
+    void condition::wait(mutex & m) {
+      pthread_cond_wait(&condition_, &m.mutex_);
+    }
+
+    void condition::signal() {
+      pthread_cond_signal(&condition_);
+    }
+
+    void condition::broadcast() {
+      pthread_cond_broadcast(&condition_);
+    }
+#endif
+
+    unsigned int thread_pool::cpu_count() {
+#ifdef __WIN32__
+      SYSTEM_INFO info;
+      GetSystemInfo(&info);
+      return 0 < info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+      long count = sysconf(_SC_NPROCESSORS_ONLN);
+      return 0 < count ? count : 1;
+#else
+      return 1;
+#endif
+    }
+
+    thread_pool::thread_pool(unsigned int threads) : pending_(0), stopping_(false) {
+      if(0 == threads) {
+        threads = cpu_count();
+      }
+      for(unsigned int i = 0; i < threads; i++) {
+#ifdef __WIN32__
+        HANDLE thread = CreateThread(NULL, 0, worker, this, 0, NULL);
+        if(NULL != thread) {
+          threads_.push_back(thread);
+        }
+#else
+        pthread_t thread;
+        if(0 == pthread_create(&thread, NULL, worker, this)) {
+          threads_.push_back(thread);
+        }
+#endif
+      }
+    }
+
+    thread_pool::~thread_pool() {
+      wait();
+      {
+        scoped_lock lock(lock_);
+        stopping_ = true;
+        available_.broadcast();
+      }
+      for(unsigned int i = 0; i < threads_.size(); i++) {
+#ifdef __WIN32__
+        WaitForSingleObject(threads_[i], INFINITE);
+        CloseHandle(threads_[i]);
+#else
+        pthread_join(threads_[i], NULL);
+#endif
+      }
+    }
+
+    void thread_pool::submit(task * t) {
+      if(threads_.empty()) { // No thread could be started
+        t->run();
+        return;
+      }
+      scoped_lock lock(lock_);
+      tasks_.push_back(t);
+      pending_++;
+      available_.signal();
+    }
+
+    void thread_pool::wait() {
+      scoped_lock lock(lock_);
+      while(0 < pending_) {
+        done_.wait(lock_);
+      }
+    }
+
+    unsigned int thread_pool::size() const {
+      return threads_.size();
+    }
+
+#ifdef __WIN32__
+    DWORD WINAPI thread_pool::worker(LPVOID pool) {
+      static_cast<thread_pool *>(pool)->work();
+      return 0;
+    }
+#else
+    void * thread_pool::worker(void * pool) {
+      static_cast<thread_pool *>(pool)->work();
+      return NULL;
+    }
+#endif
+
+    void thread_pool::work() {
+      for(;;) {
+        task * t;
+        {
+          scoped_lock lock(lock_);
+          while(tasks_.empty() && !stopping_) {
+            available_.wait(lock_);
+          }
+          if(tasks_.empty()) {
+            return;
+          }
+          t = tasks_.front();
+          tasks_.pop_front();
+        }
+        t->run();
+        scoped_lock lock(lock_);
+        if(0 == --pending_) {
+          done_.broadcast();
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,114 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sstream>
+#include <unistd.h>
+#include "io/async_io.h"
+#include "util/exception.h"
+
+#include "gtest/gtest.h"
+#include "config-test.h"
+
+class result_callback : public mgz::io::async_callback {
+  public:
+    result_callback() : result(-1), calls(0) {}
+    void completed(long r) {
+      result = r;
+      calls++;
+    }
+    long result;
+    int calls;
+};
+
+// Writes a file with an open, a write and a stat, each one queued by the previous callback
+class writer_callback : public mgz::io::async_callback {
+  public:
+    writer_callback(mgz::io::async_io & io, const std::string & path, const std::string & content) :
+      io_(io), path_(path), content_(content), step_(0), fd(-1), error(0) {
+      io_.open(path_, O_WRONLY | O_CREAT | O_TRUNC, 0644, this);
+    }
+
+    void completed(long result) {
+      if(0 > result) {
+        error = result;
+        return;
+      }
+      switch(step_++) {
+        case 0:
+          fd = result;
+          io_.write(fd, content_.c_str(), content_.size(), 0, this);
+          break;
+        case 1:
+          ::close(fd);
+          io_.stat(path_, &status, this);
+          break;
+      }
+    }
+
+    mgz::io::file_status status;
+  private:
+    mgz::io::async_io & io_;
+    std::string path_;
+    std::string content_;
+    int step_;
+  public:
+    int fd;
+    long error;
+};
+
+static void check_backend(mgz::io::async_backend backend) {
+  mgz::io::async_io io(4, backend);
+  EXPECT_EQ(4U, io.depth());
+
+  std::vector<writer_callback *> writers;
+  std::vector<mgz::io::file> files;
+  for(int i = 0; i < 20; i++) {
+    std::ostringstream path, content;
+    path << "async_" << i << ".txt";
+    for(int j = 0; j <= i * 1000; j++) {
+      content << j;
+    }
+    writers.push_back(new writer_callback(io, path.str(), content.str()));
+    files.push_back(mgz::io::file(path.str()));
+  }
+  io.wait();
+  EXPECT_EQ(0U, io.pending());
+  for(int i = 0; i < 20; i++) {
+    EXPECT_EQ(0, writers[i]->error);
+    EXPECT_TRUE(S_ISREG(writers[i]->status.st_mode));
+    EXPECT_EQ(files[i].size(), (long)writers[i]->status.st_size);
+    delete writers[i];
+  }
+
+  std::vector<uint32_t> crcs = mgz::io::file::crc32(files, io);
+  ASSERT_EQ(20U, crcs.size());
+  for(int i = 0; i < 20; i++) {
+    EXPECT_EQ(files[i].crc32(), crcs[i]);
+  }
+
+  result_callback missing;
+  io.open("async_nothere.txt", O_RDONLY, 0, &missing);
+  io.wait();
+  EXPECT_EQ(1, missing.calls);
+  EXPECT_EQ(-ENOENT, missing.result);
+
+  files.push_back(mgz::io::file("async_nothere.txt"));
+  EXPECT_THROW(mgz::io::file::crc32(files, io), Exception<FileShouldExistException>);
+  files.pop_back();
+  files.push_back(mgz::io::file("."));
+  EXPECT_THROW(mgz::io::file::crc32(files, io), Exception<FileShouldNotBeFolderException>);
+  files.pop_back();
+
+  for(int i = 0; i < 20; i++) {
+    files[i].remove();
+  }
+}
+
+TEST(AsyncIO, Default) {
+  check_backend(mgz::io::ASYNC_AUTO);
+}
+
+TEST(AsyncIO, Threads) {
+  mgz::io::async_io io(8, mgz::io::ASYNC_THREADS);
+  EXPECT_FALSE(io.uses_io_uring());
+  check_backend(mgz::io::ASYNC_THREADS);
+}
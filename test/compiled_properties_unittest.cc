@@ -0,0 +1,117 @@
+#include <time.h>
+#include <unistd.h>
+#include "io/compiled_properties.h"
+
+#include "gtest/gtest.h"
+#include "config-test.h"
+#include "file-test.h"
+
+TEST(CompiledProperties, TestCompile) {
+  mgz::io::properties properties;
+  properties.set_property("english", "hello");
+  properties.set_property("french", "bonjour");
+  properties.add_property("all", "hello");
+  properties.add_property("all", "bonjour");
+  std::vector<std::string> none;
+  properties.set_properties("empty", none);
+  ASSERT_TRUE(mgz::io::compiled_properties::compile(properties, "compiled.bin"));
+
+  mgz::io::compiled_properties compiled;
+  ASSERT_TRUE(compiled.open("compiled.bin"));
+  EXPECT_EQ(4UL, compiled.size());
+  EXPECT_EQ("hello", compiled.get_property("english"));
+  EXPECT_EQ("bonjour", compiled.get_property(" french "));
+  std::vector<mgz::io::property_view> values;
+  ASSERT_TRUE(compiled.find("all", values));
+  ASSERT_EQ(2U, values.size());
+  EXPECT_EQ("bonjour", values[1].str());
+  EXPECT_TRUE(compiled.find("empty", values));
+  EXPECT_TRUE(values.empty());
+  EXPECT_FALSE(compiled.find("spanish", values));
+  EXPECT_FALSE(compiled.find("", values));
+
+  mgz::io::properties loaded;
+  compiled.load(loaded);
+  EXPECT_EQ(4, loaded.count_all_props());
+  EXPECT_EQ(2U, loaded.get_properties("all").size());
+  EXPECT_EQ("hello", loaded.get_property("english"));
+
+  // Without a source, the file can't be checked against one
+  EXPECT_FALSE(compiled.open("compiled.bin", MGZ_TESTS_PATH(properties/sample.properties)));
+  EXPECT_FALSE(compiled.is_open());
+
+  write_file("compiled.bin", "not a compiled property list", time(NULL));
+  EXPECT_FALSE(compiled.open("compiled.bin"));
+  EXPECT_FALSE(compiled.open("path/to/nowhere.bin"));
+  EXPECT_FALSE(compiled.find("english", values));
+  unlink("compiled.bin");
+}
+
+TEST(CompiledProperties, TestTemporaryFiles) {
+  mgz::io::properties properties;
+  properties.set_property("english", "hello");
+  mgz::io::file dir("compiled_dir");
+  dir.force_remove();
+  mgz::io::file("compiled_dir/target.bin/busy").mkdirs();
+
+  // The compiled file can't replace a directory : its temporary file is removed
+  EXPECT_FALSE(mgz::io::compiled_properties::compile(properties, "compiled_dir/target.bin"));
+  std::vector<mgz::io::file> entries = mgz::io::file::list("compiled_dir");
+  ASSERT_EQ(1U, entries.size());
+  EXPECT_EQ("target.bin", entries[0].get_name());
+
+  mgz::io::file("compiled_dir/target.bin").force_remove();
+  ASSERT_TRUE(mgz::io::compiled_properties::compile(properties, "compiled_dir/target.bin"));
+  ASSERT_TRUE(mgz::io::compiled_properties::compile(properties, "compiled_dir/target.bin"));
+  entries = mgz::io::file::list("compiled_dir");
+  ASSERT_EQ(1U, entries.size());
+  EXPECT_EQ("target.bin", entries[0].get_name());
+  dir.force_remove();
+}
+
+TEST(CompiledProperties, TestCache) {
+  time_t past = time(NULL) - 3600;
+  write_file("cached.properties", "a=1\nb=2,3\n", past);
+  unlink("cached.bin");
+
+  mgz::io::properties first;
+  first.load(mgz::io::file("cached.properties"), mgz::io::file("cached.bin"));
+  EXPECT_EQ("1", first.get_property("a"));
+  mgz::io::compiled_properties compiled;
+  ASSERT_TRUE(compiled.open("cached.bin", "cached.properties"));
+  compiled.close();
+
+  // The cache is read while the file is unchanged
+  mgz::io::properties second;
+  second.load(mgz::io::file("cached.properties"), mgz::io::file("cached.bin"));
+  EXPECT_EQ(2U, second.get_properties("b").size());
+
+  // A changed file is parsed again, and the cache rewritten
+  write_file("cached.properties", "a=10\n", past + 1);
+  EXPECT_FALSE(compiled.open("cached.bin", "cached.properties"));
+  mgz::io::properties third;
+  third.load(mgz::io::file("cached.properties"), mgz::io::file("cached.bin"));
+  EXPECT_EQ("10", third.get_property("a"));
+  EXPECT_TRUE(third.get_properties("b").empty());
+  ASSERT_TRUE(compiled.open("cached.bin", "cached.properties"));
+  EXPECT_EQ("10", compiled.get_property("a"));
+  compiled.close();
+
+  // A recently modified file is parsed, but not cached
+  write_file("cached.properties", "a=11\n", time(NULL));
+  mgz::io::properties fourth;
+  fourth.load(mgz::io::file("cached.properties"), mgz::io::file("cached.bin"));
+  EXPECT_EQ("11", fourth.get_property("a"));
+  EXPECT_FALSE(compiled.open("cached.bin", "cached.properties"));
+  unlink("cached.properties");
+  unlink("cached.bin");
+
+  mgz::io::properties xml;
+  xml.load_xml(mgz::io::file(MGZ_TESTS_PATH(properties/sample.xml)), mgz::io::file("cached_xml.bin"));
+  EXPECT_EQ("bonjour", xml.get_property("french"));
+  mgz::io::properties cached_xml;
+  cached_xml.load_xml(mgz::io::file(MGZ_TESTS_PATH(properties/sample.xml)), mgz::io::file("cached_xml.bin"));
+  EXPECT_EQ("hola", cached_xml.get_property("spanish"));
+  EXPECT_EQ(xml.count_all_props(), cached_xml.count_all_props());
+  unlink("cached_xml.bin");
+}
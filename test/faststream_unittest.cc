@@ -1,5 +1,7 @@
 #include <map>
+#include <fstream>
 #include <limits.h>
+#include <string.h>
 #include "io/faststream.h"
 #include "gtest/gtest.h"
 #include "config-test.h"
@@ -35,6 +37,37 @@ TEST(Faststream, TestReadFile) {
   ASSERT_TRUE(f.close());
 }
 
+TEST(Faststream, TestView) {
+  std::string content;
+  for(int i = 0; i < 2000; i++) {
+    content += "0123456789";
+  }
+  {
+    std::ofstream os("view.txt", std::ios::out | std::ios::binary);
+    os << content;
+  }
+
+  mgz::io::faststream f("view.txt", mgz::io::out);
+  ASSERT_TRUE(f.open(1));
+  std::string result;
+  const unsigned char * previous = NULL;
+  int windows = 0;
+  for(mgz::io::faststream_view v = f.view(); 0 < v.size; v = f.view()) {
+    ASSERT_EQ(v.size, f.gcount());
+    if(NULL != previous) {
+      EXPECT_EQ(previous, v.data); // Windows are consecutive slices of one mapping
+    }
+    previous = v.data + v.size;
+    result.append(reinterpret_cast<const char *>(v.data), v.size);
+    windows++;
+  }
+  EXPECT_TRUE(1 < windows);
+  EXPECT_EQ(content, result);
+  EXPECT_EQ(0, f.view().size);
+  ASSERT_TRUE(f.close());
+  mgz::io::file("view.txt").remove();
+}
+
 TEST(Faststream, TestWritePath) {
   mgz::io::faststream f("test.txt", mgz::io::in);
   ASSERT_TRUE(f.open(1025));
@@ -46,4 +79,33 @@ TEST(Faststream, TestWritePath) {
   }
 
   ASSERT_TRUE(f.close());
+  EXPECT_EQ(13L * 500000, mgz::io::file("test.txt").size());
+}
+
+TEST(Faststream, TestReserve) {
+  mgz::io::faststream f("reserve.txt", mgz::io::in);
+  ASSERT_TRUE(f.open(1));
+
+  std::string expected;
+  for(int i = 0; i < 3000; i++) {
+    long size = 1 + (i * 7) % 5000; // Crosses page and extent boundaries
+    unsigned char * p = f.reserve(size);
+    memset(p, 'a' + i % 26, size);
+    f.commit(size);
+    expected.append(size, 'a' + i % 26);
+  }
+  unsigned char * p = f.reserve(100);
+  memset(p, '!', 100); // Never committed
+  ASSERT_TRUE(f.close());
+
+  mgz::io::faststream r("reserve.txt", mgz::io::out);
+  ASSERT_TRUE(r.open(1024));
+  std::string result;
+  for(mgz::io::faststream_view v = r.view(); 0 < v.size; v = r.view()) {
+    result.append(reinterpret_cast<const char *>(v.data), v.size);
+  }
+  ASSERT_TRUE(r.close());
+  EXPECT_EQ(expected.size(), result.size());
+  EXPECT_TRUE(expected == result);
+  mgz::io::file("reserve.txt").remove();
 }
@@ -0,0 +1,43 @@
+#ifndef __MGZ_FILE_TEST_H
+#define __MGZ_FILE_TEST_H
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <stdio.h>
+#include <time.h>
+#include <utime.h>
+#include "io/file.h"
+
+// Returns the content of path, as is.
+static inline std::string read_all(const std::string &path) {
+  std::ifstream is(path.c_str(), std::ios::in | std::ios::binary);
+  std::ostringstream os;
+  os << is.rdbuf();
+  return os.str();
+}
+
+// Writes content to path, as is.
+static inline void write_file(const std::string &path, const std::string &content) {
+  std::ofstream os(path.c_str(), std::ios::out | std::ios::binary);
+  os << content;
+}
+
+// Writes content to path, creating its parent directories, and sets its modification time.
+static inline void write_file(const std::string &path, const std::string &content, time_t mtime) {
+  mgz::io::file(path).get_parent_file().mkdirs();
+  write_file(path, content);
+  struct utimbuf times;
+  times.actime = mtime;
+  times.modtime = mtime;
+  utime(path.c_str(), &times);
+}
+
+// Writes content aside and renames it to path, as editors do : readers never see a partial file.
+static inline void write_file_atomically(const std::string &path, const std::string &content) {
+  std::string temp = path + ".tmp";
+  write_file(temp, content);
+  rename(temp.c_str(), path.c_str());
+}
+
+#endif // __MGZ_FILE_TEST_H
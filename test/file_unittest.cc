@@ -1,6 +1,12 @@
 #include <map>
+#include <fstream>
 #include <limits.h>
 #include "io/file.h"
+#include "security/crc32.h"
+#include "security/md5.h"
+#include "security/sha1.h"
+#include "security/sha2.h"
+#include "security/ripem.h"
 #include "util/exception.h"
 #include "gtest/gtest.h"
 #include "config-test.h"
@@ -553,6 +559,91 @@ TEST(FileUtil, TestNormalize) {
 #endif
 }
 
+TEST(FileUtil, TestStatusSnapshot) {
+  mgz::io::file d("snapshot");
+  mgz::io::file f = d.join("data.txt");
+  ASSERT_FALSE(d.exist());
+  ASSERT_TRUE(d.mkdirs());
+  ASSERT_TRUE(d.is_directory());
+
+  // Missing files are checked again on each call
+  ASSERT_FALSE(f.exist());
+  {
+    std::ofstream os(f.get_path().c_str());
+    os << "12345";
+  }
+  ASSERT_TRUE(f.exist());
+  EXPECT_EQ(5L, f.size());
+
+  // External changes are only seen after a refresh
+  {
+    std::ofstream os(f.get_path().c_str(), std::ios::app);
+    os << "6789";
+  }
+  EXPECT_EQ(5L, f.size());
+  f.refresh();
+  EXPECT_EQ(9L, f.size());
+
+  mgz::io::file sub = d.join("sub");
+  ASSERT_TRUE(sub.mkdir());
+#ifndef __WIN32__
+  mgz::io::file link = d.join("link");
+  ASSERT_TRUE(link.relative_link(f));
+#endif
+
+  std::vector<mgz::io::file> entries = mgz::io::file::list(d.get_path());
+#ifndef __WIN32__
+  ASSERT_EQ(3U, entries.size());
+  EXPECT_EQ(link.get_path(), entries[1].get_path());
+  EXPECT_TRUE(entries[1].is_symlink());
+  EXPECT_TRUE(entries[1].is_file());
+  EXPECT_EQ(9L, entries[1].size());
+  entries.erase(entries.begin() + 1);
+#endif
+  ASSERT_EQ(2U, entries.size());
+  EXPECT_EQ(f.get_path(), entries[0].get_path());
+  EXPECT_TRUE(entries[0].is_file());
+  EXPECT_EQ(9L, entries[0].size());
+  EXPECT_EQ(sub.get_path(), entries[1].get_path());
+  EXPECT_TRUE(entries[1].is_directory());
+  EXPECT_TRUE(mgz::io::file::list(f.get_path()).empty());
+
+  ASSERT_TRUE(d.force_remove());
+  EXPECT_FALSE(d.exist());
+}
+
+TEST(FileUtil, DigestShouldReadFileOnce) {
+  std::string content;
+  for(int i = 0; content.size() < 3 * 1024 * 1024 + 17; i++) { // Several blocks, the last one partial
+    content += mgz::security::sha1(std::string(1, (char)i));
+  }
+  {
+    std::ofstream os("digest.bin", std::ios::out | std::ios::binary);
+    os << content;
+  }
+  mgz::io::file f("digest.bin");
+
+  std::map<mgz::io::file_digest, std::string> all = f.digest(mgz::io::DIGEST_CRC32 | mgz::io::DIGEST_ADLER32 |
+      mgz::io::DIGEST_MD5 | mgz::io::DIGEST_SHA1 | mgz::io::DIGEST_SHA256 | mgz::io::DIGEST_RIPEMD160);
+  ASSERT_EQ(6U, all.size());
+  mgz::security::crc32sum crc;
+  crc.update(content);
+  EXPECT_EQ(crc.finalize().hexdigest(), all[mgz::io::DIGEST_CRC32]);
+  EXPECT_EQ(mgz::security::md5(content), all[mgz::io::DIGEST_MD5]);
+  EXPECT_EQ(mgz::security::sha1(content), all[mgz::io::DIGEST_SHA1]);
+  EXPECT_EQ(mgz::security::sha256(content), all[mgz::io::DIGEST_SHA256]);
+  EXPECT_EQ(mgz::security::ripem160(content), all[mgz::io::DIGEST_RIPEMD160]);
+
+  // A single algorithm is computed without threads
+  EXPECT_EQ(all[mgz::io::DIGEST_ADLER32], f.digest(mgz::io::DIGEST_ADLER32)[mgz::io::DIGEST_ADLER32]);
+  EXPECT_EQ(mgz::security::crc32(content), f.crc32());
+  EXPECT_TRUE(f.digest(0).empty());
+  f.remove();
+
+  EXPECT_THROW(f.digest(mgz::io::DIGEST_MD5), Exception<FileShouldExistException>);
+  EXPECT_THROW(mgz::io::file(MGZ_TESTS_PATH(file)).digest(mgz::io::DIGEST_MD5), Exception<FileShouldNotBeFolderException>);
+}
+
 TEST(FileUtil, Crc32ShouldWorkOnFile) {
   mgz::io::file f(MGZ_TESTS_PATH(file/example.txt));
   ASSERT_TRUE(f.exist());
@@ -1,10 +1,16 @@
 #include <iostream>
 #include <map>
 #include <limits.h>
+#include <fstream>
+#include <time.h>
+#include <sstream>
+#include <unistd.h>
 #include "io/filesystem.h"
+#include "io/walker.h"
 
 #include "gtest/gtest.h"
 #include "config-test.h"
+#include "file-test.h"
 
 TEST(Filesystem, DiskSpace) {
 #ifdef __WIN32__
@@ -54,6 +60,230 @@ TEST(Filesystem,TestDoesntExist) {
   EXPECT_FALSE(f.exist());
 }
 
+static void touch(const std::string &path) {
+  mgz::io::file(path).get_parent_file().mkdirs();
+  std::ofstream os(path.c_str());
+  os << path;
+}
+
+static std::map<std::string, int> diff_statuses(std::vector<mgz::io::fs_diff> diff) {
+  std::map<std::string, int> statuses;
+  for(std::vector<mgz::io::fs_diff>::iterator it = diff.begin(); it != diff.end(); it++) {
+    mgz::io::file f = (mgz::io::RIGHT_ONLY == it->status) ? it->right : it->left;
+    statuses[f.get_name()] = it->status;
+  }
+  return statuses;
+}
+
+TEST(Filesystem, TestGetDiff) {
+  mgz::io::file root("fsdiff");
+  root.force_remove();
+  touch("fsdiff/left/same.txt");
+  touch("fsdiff/left/lib/tool-1.2.jar");
+  touch("fsdiff/left/left.txt");
+  touch("fsdiff/right/same.txt");
+  touch("fsdiff/right/lib/tool-1.3.jar");
+  touch("fsdiff/right/right.txt");
+  mgz::io::fs left("fsdiff/left");
+  mgz::io::fs right("fsdiff/right");
+
+  std::vector<mgz::io::fs_diff> diff = left.get_diff(right);
+  ASSERT_EQ(5U, diff.size());
+  std::map<std::string, int> statuses = diff_statuses(diff);
+  EXPECT_EQ(mgz::io::BOTH, statuses["same.txt"]);
+  EXPECT_EQ(mgz::io::LEFT_ONLY, statuses["tool-1.2.jar"]);
+  EXPECT_EQ(mgz::io::LEFT_ONLY, statuses["left.txt"]);
+  EXPECT_EQ(mgz::io::RIGHT_ONLY, statuses["tool-1.3.jar"]);
+  EXPECT_EQ(mgz::io::RIGHT_ONLY, statuses["right.txt"]);
+
+  diff = left.get_diff(right, false);
+  ASSERT_EQ(4U, diff.size());
+  statuses = diff_statuses(diff);
+  EXPECT_EQ(mgz::io::BOTH, statuses["tool-1.2.jar"]);
+  EXPECT_EQ(0U, statuses.count("tool-1.3.jar"));
+  root.force_remove();
+}
+
+TEST(Filesystem, TestGetContentDiff) {
+  time_t past = time(NULL) - 3600;
+  mgz::io::file root("fsdiff");
+  root.force_remove();
+  write_file("fsdiff/left/same.txt", "same content", past);
+  write_file("fsdiff/right/same.txt", "same content", past + 10);
+  write_file("fsdiff/left/changed.txt", "content 1", past);
+  write_file("fsdiff/right/changed.txt", "content 2", past + 10);
+  write_file("fsdiff/left/grown.txt", "short", past);
+  write_file("fsdiff/right/grown.txt", "longer", past);
+  write_file("fsdiff/left/touched.txt", "content 1", past);
+  write_file("fsdiff/right/touched.txt", "content 2", past); // Same size and time : not hashed
+  write_file("fsdiff/left/left.txt", "left", past);
+  mgz::io::fs left("fsdiff/left");
+  mgz::io::fs right("fsdiff/right");
+
+  mgz::io::checksum_cache cache("fsdiff/checksums");
+  std::vector<mgz::io::fs_diff> diff = left.get_content_diff(right, true, mgz::io::CHECKSUM_SHA1, &cache);
+  ASSERT_EQ(5U, diff.size());
+  std::map<std::string, int> statuses = diff_statuses(diff);
+  EXPECT_EQ(mgz::io::IDENTICAL, statuses["same.txt"]);
+  EXPECT_EQ(mgz::io::MODIFIED, statuses["changed.txt"]);
+  EXPECT_EQ(mgz::io::MODIFIED, statuses["grown.txt"]);
+  EXPECT_EQ(mgz::io::IDENTICAL, statuses["touched.txt"]);
+  EXPECT_EQ(mgz::io::LEFT_ONLY, statuses["left.txt"]);
+  EXPECT_EQ(4U, cache.size());
+  EXPECT_TRUE(cache.save());
+
+  // Reloaded checksums are only used while files are unchanged
+  mgz::io::checksum_cache reloaded("fsdiff/checksums");
+  EXPECT_EQ(4U, reloaded.size());
+  write_file("fsdiff/left/changed.txt", "content 2", past + 1);
+  diff = left.get_content_diff(right, true, mgz::io::CHECKSUM_SHA1, &reloaded);
+  statuses = diff_statuses(diff);
+  EXPECT_EQ(mgz::io::IDENTICAL, statuses["changed.txt"]);
+  EXPECT_EQ(mgz::io::IDENTICAL, statuses["same.txt"]);
+  EXPECT_EQ(5U, reloaded.size());
+
+  // Recently modified files are hashed, but not cached
+  write_file("fsdiff/left/same.txt", "SAME content", time(NULL));
+  diff = left.get_content_diff(right, true, mgz::io::CHECKSUM_CRC32, &reloaded);
+  statuses = diff_statuses(diff);
+  EXPECT_EQ(mgz::io::MODIFIED, statuses["same.txt"]);
+  EXPECT_EQ(8U, reloaded.size());
+  root.force_remove();
+}
+
+class collect_callback : public mgz::io::walk_callback {
+  public:
+    collect_callback(const std::string &prune) : prune_(prune) {}
+    bool entry(const mgz::io::walk_entry &e) {
+      entries[e.relative] = e;
+      return e.relative != prune_;
+    }
+    std::map<std::string, mgz::io::walk_entry> entries;
+  private:
+    std::string prune_;
+};
+
+class no_d_filter : public mgz::io::fsfilter {
+  public:
+    bool filter(mgz::io::fs_diff &d) {
+      return 0 != d.right.get_name().find("d");
+    }
+};
+
+TEST(Filesystem, TestWalker) {
+  mgz::io::file root("fswalk");
+  root.force_remove();
+  for(int i = 0; i < 10; i++) {
+    for(int j = 0; j < 10; j++) {
+      std::ostringstream path;
+      path << "fswalk/d" << i << "/e" << j << "/file.txt";
+      touch(path.str());
+    }
+  }
+  touch("fswalk/top.txt");
+  symlink("d1", "fswalk/link");
+
+  collect_callback all("");
+  EXPECT_TRUE(mgz::io::walker("fswalk", 4).walk(all));
+  EXPECT_EQ(10U + 100U + 100U + 2U, all.entries.size());
+  EXPECT_TRUE(all.entries["d3/e4"].is_directory);
+  EXPECT_FALSE(all.entries["d3/e4/file.txt"].is_directory);
+  EXPECT_EQ(std::string("fswalk/d3/e4/file.txt"), all.entries["d3/e4/file.txt"].path);
+  EXPECT_TRUE(all.entries["link"].is_symlink);
+  EXPECT_TRUE(all.entries["link"].is_directory);
+  EXPECT_EQ(0U, all.entries.count("link/e0")); // Links are not followed
+
+  collect_callback pruned("d2");
+  EXPECT_TRUE(mgz::io::walker("fswalk", 3).walk(pruned));
+  EXPECT_EQ(all.entries.size() - 20U, pruned.entries.size());
+
+  collect_callback top("");
+  EXPECT_TRUE(mgz::io::walker("fswalk").walk(top, false));
+  EXPECT_EQ(12U, top.entries.size());
+
+  collect_callback none("");
+  EXPECT_FALSE(mgz::io::walker("fswalk/nothere").walk(none));
+
+  // Lazy iteration
+  unsigned long count = 0;
+  EACH_RFILES_R(f, "fswalk") {
+    EXPECT_FALSE(f.entry().is_directory && !f.entry().is_symlink);
+    EXPECT_EQ(f.entry().relative, f->get_path());
+    count++;
+  }
+  EXPECT_EQ(101U, count);
+
+  count = 0;
+  mgz::io::fs tree("fswalk");
+  for(mgz::io::fs_iterator it = mgz::io::fs_iterator("fswalk", true, false, true); it != tree.end(); ++it) {
+    if(it.entry().is_directory && it.entry().relative.find("/") != std::string::npos) {
+      it.prune(); // Do not descend into d*/e*
+    }
+    count++;
+  }
+  EXPECT_EQ(10U + 100U + 2U, count);
+
+  no_d_filter filter;
+  count = 0;
+  for(mgz::io::fs_iterator it = tree.begin(true, true, &filter); it != tree.end(); ++it) {
+    count++;
+  }
+  EXPECT_EQ(1U, count); // top.txt (d* are pruned, the link is a directory)
+
+  mgz::io::fs_iterator first = tree.begin(true, true);
+  EXPECT_TRUE(first != tree.end()); // Early termination closes the open directories
+  EXPECT_TRUE(mgz::io::fs("fswalk/nothere").begin() == tree.end());
+
+  std::vector<mgz::io::file> files = mgz::io::fs("fswalk").all_files(true, true);
+  ASSERT_EQ(101U, files.size()); // Directories, and the link to a directory, are not listed
+  EXPECT_EQ(std::string("d0/e0/file.txt"), files[0].get_path());
+  EXPECT_EQ(std::string("top.txt"), files[100].get_path());
+
+  std::vector<mgz::io::file> parallel = mgz::io::fs("fswalk").all_files(true, true, 4);
+  ASSERT_EQ(files.size(), parallel.size());
+  for(unsigned int i = 0; i < files.size(); i++) {
+    EXPECT_EQ(files[i].get_path(), parallel[i].get_path());
+  }
+
+  // The metadata is read while listing : the files are not stat'ed again
+  unlink("fswalk/top.txt");
+  EXPECT_TRUE(parallel[100].exist());
+  EXPECT_TRUE(parallel[100].is_file());
+  root.force_remove();
+}
+
+TEST(Filesystem, TestCopyContent) {
+  mgz::io::file root("fscopy");
+  root.force_remove();
+  for(int i = 0; i < 20; i++) {
+    std::ostringstream path;
+    path << "fscopy/src/d" << (i % 4) << "/f" << i << ".txt";
+    touch(path.str());
+  }
+  std::string big(300 * 1024, 'x'); // Several copy chunks
+  write_file("fscopy/src/big.bin", big, time(NULL));
+  mgz::io::file("fscopy/src/big.bin").set_permissions(0750);
+
+  mgz::io::fs src("fscopy/src");
+  mgz::io::fs dst("fscopy/dst");
+  ASSERT_TRUE(src.copy_content(dst, 4));
+
+  std::vector<mgz::io::file> files = dst.all_files(true, true);
+  ASSERT_EQ(21U, files.size());
+  mgz::io::file copy("fscopy/dst/big.bin");
+  EXPECT_EQ((long)big.size(), copy.size());
+  EXPECT_EQ(0750U, copy.get_mode() & 0777);
+  std::ifstream is("fscopy/dst/d3/f7.txt");
+  std::string content;
+  is >> content;
+  EXPECT_EQ(std::string("fscopy/src/d3/f7.txt"), content);
+
+  mgz::io::fs serial("fscopy/serial");
+  ASSERT_TRUE(src.copy_content(serial, 1));
+  EXPECT_EQ(21U, serial.all_files(true, true).size());
+  root.force_remove();
+}
+
 //TEST(Filesystem, TestAllFilesFiltered) {
 //  mgz::io::fs f(MGZ_TESTS_PATH(vfsfilter/v1));
 //  Glow::vfsfilter filter(mgz::io::file(MGZ_TESTS_PATH(vfsfilter/vfsfilter.properties)));
@@ -0,0 +1,85 @@
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include "io/line_reader.h"
+#include "io/stream.h"
+
+#include "gtest/gtest.h"
+#include "config-test.h"
+#include "file-test.h"
+
+static std::vector<std::string> read_lines(const std::string &path) {
+  std::vector<std::string> lines;
+  mgz::io::line_reader reader(path);
+  mgz::io::line_view line;
+  while(reader.next(line)) {
+    lines.push_back(line.str());
+  }
+  EXPECT_FALSE(reader.failed());
+  return lines;
+}
+
+TEST(LineReader, TestLines) {
+  write_file("lines.txt", "first\nsecond\r\n\nlast");
+  std::vector<std::string> lines = read_lines("lines.txt");
+  ASSERT_EQ(4U, lines.size());
+  EXPECT_EQ("first", lines[0]);
+  EXPECT_EQ("second", lines[1]);
+  EXPECT_EQ("", lines[2]);
+  EXPECT_EQ("last", lines[3]);
+
+  write_file("lines.txt", "one\ntwo\n");
+  lines = read_lines("lines.txt");
+  ASSERT_EQ(2U, lines.size());
+  EXPECT_EQ("two", lines[1]);
+
+  write_file("lines.txt", "");
+  EXPECT_TRUE(read_lines("lines.txt").empty());
+  unlink("lines.txt");
+
+  mgz::io::line_reader missing("path/to/nowhere.txt");
+  mgz::io::line_view line;
+  EXPECT_FALSE(missing.is_open());
+  EXPECT_FALSE(missing.next(line));
+  EXPECT_TRUE(missing.failed());
+}
+
+TEST(LineReader, TestLongLines) {
+  // Lines crossing the buffer, and a line bigger than the buffer
+  std::ostringstream content;
+  for(int i = 0; i < 20000; i++) {
+    content << "line " << i << "\n";
+  }
+  std::string longest(200 * 1024, 'x');
+  content << longest << "\r\nend";
+  write_file("lines.txt", content.str());
+
+  std::vector<std::string> lines = read_lines("lines.txt");
+  ASSERT_EQ(20002U, lines.size());
+  EXPECT_EQ("line 0", lines[0]);
+  EXPECT_EQ("line 12345", lines[12345]);
+  EXPECT_EQ(longest, lines[20000]);
+  EXPECT_EQ("end", lines[20001]);
+
+  // Same lines as get_line
+  std::ifstream is("lines.txt", std::ios::in | std::ios::binary);
+  std::string line;
+  for(unsigned int i = 0; i < lines.size(); i++) {
+    ASSERT_TRUE(mgz::io::get_line(is, line).good() || i == lines.size() - 1);
+    EXPECT_EQ(lines[i], line);
+  }
+  is.close();
+
+  // From a descriptor, which is left open
+  int fd = open("lines.txt", O_RDONLY);
+  ASSERT_NE(-1, fd);
+  {
+    mgz::io::line_reader reader(fd);
+    mgz::io::line_view view;
+    ASSERT_TRUE(reader.next(view));
+    EXPECT_EQ("line 0", view.str());
+  }
+  EXPECT_EQ(0, close(fd));
+  unlink("lines.txt");
+}
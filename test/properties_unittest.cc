@@ -1,6 +1,8 @@
 #include <limits.h>
+#include <sstream>
 #include "io/properties.h"
 #include "io/file.h"
+#include "util/exception.h"
 #include "gtest/gtest.h"
 #include "config-test.h"
 
@@ -94,3 +96,108 @@ TEST(Properties, LoadXML) {
 
    EXPECT_TRUE(x2.exist());
 }
+
+TEST(Properties, LoadSyntax) {
+   {
+      std::ofstream os("syntax.properties", std::ios::out | std::ios::binary);
+      os << "# comment=ignored\r\n"
+         << "  \r\n"
+         << "list = a, b ,c,\r\n"
+         << "empty=\n"
+         << "list=d\n"
+         << "url=http://host/?a=b\n"
+         << "blank_tail=x, \n"
+         << "blank= \n"
+         << "last=value";
+   }
+   mgz::io::properties properties(mgz::io::file("syntax.properties"));
+
+   EXPECT_EQ(6, properties.count_all_props());
+   std::vector<std::string> list = properties.get_properties("list");
+   ASSERT_EQ(4U, list.size());
+   EXPECT_EQ("a", list[0]);
+   EXPECT_EQ("b", list[1]);
+   EXPECT_EQ("c", list[2]);
+   EXPECT_EQ("d", list[3]);
+   EXPECT_TRUE(properties.get_properties("empty").empty());
+   EXPECT_EQ("http://host/?a=b", properties.get_property("url"));
+   EXPECT_EQ("value", properties.get_property("last"));
+   std::vector<std::string> blank_tail = properties.get_properties("blank_tail");
+   ASSERT_EQ(2U, blank_tail.size()); // Like mgz::util::split("x, ")
+   EXPECT_EQ("x", blank_tail[0]);
+   EXPECT_EQ("", blank_tail[1]);
+   EXPECT_EQ("", properties.get_property("blank_tail"));
+   std::vector<std::string> blank = properties.get_properties("blank");
+   ASSERT_EQ(1U, blank.size());
+   EXPECT_EQ("", blank[0]);
+   EXPECT_TRUE(properties.get_property("# comment").empty());
+
+   mgz::io::file("syntax.properties").remove();
+   EXPECT_THROW(properties.load(mgz::io::file("syntax.properties")), Exception<mgz::io::PropertyFileNotFoundException>);
+}
+
+TEST(Properties, ManyKeys) {
+   mgz::io::properties properties;
+   properties.reserve(100);
+   for (int i = 0; i < 5000; i++) {
+      std::ostringstream key;
+      key << "key." << i;
+      properties.add_property(key.str(), "a");
+      properties.add_property(key.str(), " b ");
+   }
+   EXPECT_EQ(5000, properties.count_all_props());
+
+   const std::vector<mgz::io::property_view> * values = properties.find(" key.1234 ");
+   ASSERT_TRUE(NULL != values);
+   ASSERT_EQ(2U, values->size());
+   EXPECT_EQ("b", (*values)[1].str());
+   EXPECT_TRUE(NULL == properties.find("key.5000"));
+
+   // Removed keys leave no hole in the probe sequences of the others
+   for (int i = 0; i < 5000; i += 2) {
+      std::ostringstream key;
+      key << "key." << i;
+      EXPECT_TRUE(properties.remove(key.str()));
+   }
+   EXPECT_FALSE(properties.remove("key.0"));
+   EXPECT_EQ(2500, properties.count_all_props());
+   for (int i = 0; i < 5000; i++) {
+      std::ostringstream key;
+      key << "key." << i;
+      EXPECT_EQ(i % 2 == 1, NULL != properties.find(key.str()));
+   }
+
+   // Values replaced many times do not keep the arena growing
+   std::string big(1000, 'x');
+   for (int i = 0; i < 1000; i++) {
+      properties.set_property("big", big);
+   }
+   EXPECT_EQ(big, properties.get_property("big"));
+   EXPECT_EQ(2U, properties.get_properties("key.4999").size());
+
+   mgz::io::properties copy(properties);
+   properties.set_property("big", "small");
+   EXPECT_EQ(big, copy.get_property("big"));
+   EXPECT_EQ(2501, copy.count_all_props());
+   copy = properties;
+   EXPECT_EQ("small", copy.get_property("big"));
+}
+
+TEST(Properties, StoreSorted) {
+   mgz::io::properties properties;
+   properties.set_property("b", "2");
+   properties.set_property("a", "1");
+   properties.add_property("c", "3");
+   properties.add_property("c", "4");
+   properties.store(mgz::io::file("sorted.properties"));
+
+   std::ifstream is("sorted.properties");
+   std::stringstream content;
+   content << is.rdbuf();
+   is.close();
+   EXPECT_EQ("a=1\nb=2\nc=3,4\n", content.str());
+
+   mgz::io::properties reloaded(mgz::io::file("sorted.properties"));
+   EXPECT_EQ(2U, reloaded.get_properties("c").size());
+   mgz::io::file("sorted.properties").remove();
+}
@@ -0,0 +1,111 @@
+#include <sstream>
+#include <unistd.h>
+#include "io/reloadable_properties.h"
+#include "util/exception.h"
+
+#include "gtest/gtest.h"
+#include "config-test.h"
+#include "file-test.h"
+
+class record_listener : public mgz::io::property_listener {
+  public:
+    void changed(const std::string &key, const std::vector<mgz::io::property_view> *values) {
+      std::string value = (NULL == values) ? "<removed>" : (values->empty() ? "" : (*values)[0].str());
+      changes.push_back(key + "=" + value);
+    }
+    std::vector<std::string> changes;
+};
+
+TEST(ReloadableProperties, TestReload) {
+  write_file_atomically("reload.properties", "a=1\nb=2\nc=3\n");
+  mgz::io::reloadable_properties properties(mgz::io::file("reload.properties"));
+  EXPECT_EQ(1UL, properties.version());
+  EXPECT_EQ("1", properties.get_property("a"));
+  {
+    mgz::io::reloadable_properties::reader r(properties);
+    EXPECT_EQ(3, r->count_all_props());
+  }
+
+  record_listener listener;
+  properties.subscribe("a", &listener);
+  properties.subscribe("b", &listener);
+  properties.subscribe("c", &listener);
+  write_file_atomically("reload.properties", "a=1\nb=20\n");
+  EXPECT_TRUE(properties.reload());
+  EXPECT_EQ(2UL, properties.version());
+  EXPECT_EQ("20", properties.get_property("b"));
+  ASSERT_EQ(2U, listener.changes.size());
+  EXPECT_EQ("b=20", listener.changes[0]);
+  EXPECT_EQ("c=<removed>", listener.changes[1]);
+
+  // A file that can't be read keeps the current version
+  unlink("reload.properties");
+  EXPECT_FALSE(properties.reload());
+  EXPECT_EQ(2UL, properties.version());
+  EXPECT_EQ("20", properties.get_property("b"));
+
+  properties.unsubscribe(&listener);
+  write_file_atomically("reload.properties", "a=10\n");
+  EXPECT_TRUE(properties.reload());
+  EXPECT_EQ(2U, listener.changes.size());
+  unlink("reload.properties");
+
+  EXPECT_THROW(mgz::io::reloadable_properties(mgz::io::file("reload.properties")), Exception<mgz::io::PropertyFileNotFoundException>);
+}
+
+// Both values of a version are always equal : a reader seeing different values saw a mix of versions
+class consistent_reader : public mgz::util::task {
+  public:
+    consistent_reader(mgz::io::reloadable_properties *p, volatile bool *stop) : properties_(p), stop_(stop), reads(0), errors(0) {}
+    void run() {
+      while(!*stop_) {
+        mgz::io::reloadable_properties::reader r(*properties_);
+        const std::vector<mgz::io::property_view> *a = r->find("a");
+        const std::vector<mgz::io::property_view> *b = r->find("b");
+        if(NULL == a || NULL == b || (*a)[0].str() != (*b)[0].str()) {
+          errors++;
+        }
+        reads++;
+      }
+    }
+    mgz::io::reloadable_properties *properties_;
+    volatile bool *stop_;
+    unsigned long reads;
+    unsigned long errors;
+};
+
+TEST(ReloadableProperties, TestWatch) {
+  write_file_atomically("watch.properties", "a=0\nb=0\n");
+  mgz::io::reloadable_properties properties(mgz::io::file("watch.properties"));
+  properties.start(20);
+
+  volatile bool stop = false;
+  std::vector<consistent_reader> readers(2, consistent_reader(&properties, &stop));
+  mgz::util::thread_pool pool(readers.size());
+  for(unsigned int i = 0; i < readers.size(); i++) {
+    pool.submit(&readers[i]);
+  }
+
+  // Each new version is picked up by the watcher
+  for(int version = 1; version <= 5; version++) {
+    std::ostringstream content;
+    content << "a=" << version << "\nb=" << version << "\n";
+    write_file_atomically("watch.properties", content.str());
+    std::ostringstream expected;
+    expected << version;
+    for(int i = 0; i < 500 && expected.str() != properties.get_property("a"); i++) {
+      usleep(10000);
+    }
+    EXPECT_EQ(expected.str(), properties.get_property("a"));
+  }
+  stop = true;
+  pool.wait();
+  properties.stop();
+
+  for(unsigned int i = 0; i < readers.size(); i++) {
+    EXPECT_LT(0UL, readers[i].reads);
+    EXPECT_EQ(0UL, readers[i].errors);
+  }
+  EXPECT_LE(6UL, properties.version());
+  unlink("watch.properties");
+}
@@ -56,3 +56,9 @@ TEST(Hash, TestSha512_direct) {
   std::string n = mgz::security::sha512("Hello World!");
   EXPECT_EQ("861844d6704e8573fec34d967e20bcfef3d424cf48be04e6dc08f2bd58c729743371015ead891cc3cf1c9d34b49264b510751b1ff9e537937bc46b5d6ff4ecc8", n);
 }
+
+TEST(Hash, TestLongInput) {
+  std::string million(1000000, 'a');
+  EXPECT_EQ("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0", mgz::security::sha256(million));
+  EXPECT_EQ("e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973ebde0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b", mgz::security::sha512(million));
+}
@@ -0,0 +1,35 @@
+#include "util/thread.h"
+
+#include "gtest/gtest.h"
+
+class counting_task : public mgz::util::task {
+  public:
+    counting_task() : count(0) {}
+    void run() {
+      mgz::util::scoped_lock lock(mutex_);
+      count++;
+    }
+    int count;
+  private:
+    mgz::util::mutex mutex_;
+};
+
+TEST(Thread, ThreadPool) {
+  counting_task t;
+  {
+    mgz::util::thread_pool pool(4);
+    EXPECT_EQ(4U, pool.size());
+    for(int i = 0; i < 1000; i++) {
+      pool.submit(&t);
+    }
+    pool.wait();
+    EXPECT_EQ(1000, t.count);
+
+    pool.submit(&t);
+  } // The destructor waits for the last task
+  EXPECT_EQ(1001, t.count);
+
+  EXPECT_LE(1U, mgz::util::thread_pool::cpu_count());
+  mgz::util::thread_pool defaults;
+  EXPECT_EQ(mgz::util::thread_pool::cpu_count(), defaults.size());
+}
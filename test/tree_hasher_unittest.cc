@@ -0,0 +1,61 @@
+#include <time.h>
+#include "io/tree_hasher.h"
+#include "security/crc32.h"
+#include "security/sha2.h"
+
+#include "gtest/gtest.h"
+#include "config-test.h"
+#include "file-test.h"
+
+static std::string crc32hex(const std::string &content) {
+  mgz::security::crc32sum crc;
+  crc.update(content);
+  return crc.finalize().hexdigest();
+}
+
+TEST(TreeHasher, TestHash) {
+  time_t past = time(NULL) - 3600;
+  mgz::io::file root("treehash");
+  root.force_remove();
+  write_file("treehash/tree/b.txt", "content b", past);
+  write_file("treehash/tree/a.txt", "content a", past);
+  write_file("treehash/tree/sub/c.txt", "content c", past);
+
+  std::vector<mgz::io::fs_checksum> algorithms;
+  algorithms.push_back(mgz::io::CHECKSUM_CRC32);
+  algorithms.push_back(mgz::io::CHECKSUM_SHA256);
+
+  mgz::io::checksum_cache cache("treehash/checksums");
+  mgz::io::tree_hasher hasher(&cache, 2);
+  std::vector<mgz::io::tree_checksum> manifest;
+  ASSERT_TRUE(hasher.hash("treehash/tree", algorithms, manifest));
+  ASSERT_EQ(3U, manifest.size());
+  EXPECT_EQ("a.txt", manifest[0].path);
+  EXPECT_EQ("b.txt", manifest[1].path);
+  EXPECT_EQ(std::string("sub") + FILE_SEPARATOR + "c.txt", manifest[2].path);
+  ASSERT_EQ(2U, manifest[0].digests.size());
+  EXPECT_EQ(crc32hex("content a"), manifest[0].digests[0]);
+  EXPECT_EQ(mgz::security::sha256("content a"), manifest[0].digests[1]);
+  EXPECT_EQ(mgz::security::sha256("content c"), manifest[2].digests[1]);
+  EXPECT_EQ(3UL, hasher.hashed());
+  EXPECT_EQ(6UL, cache.size());
+  EXPECT_TRUE(cache.save());
+
+  // Only the changed file is read again, with a reloaded cache
+  write_file("treehash/tree/b.txt", "content B", past + 1);
+  mgz::io::checksum_cache reloaded("treehash/checksums");
+  mgz::io::tree_hasher rehasher(&reloaded);
+  ASSERT_TRUE(rehasher.hash("treehash/tree", algorithms, manifest));
+  ASSERT_EQ(3U, manifest.size());
+  EXPECT_EQ(1UL, rehasher.hashed());
+  EXPECT_EQ(mgz::security::sha256("content B"), manifest[1].digests[1]);
+  EXPECT_EQ(crc32hex("content a"), manifest[0].digests[0]);
+
+  // Without a cache, every file is read
+  mgz::io::tree_hasher uncached;
+  ASSERT_TRUE(uncached.hash("treehash/tree", algorithms, manifest));
+  EXPECT_EQ(3UL, uncached.hashed());
+  EXPECT_FALSE(uncached.hash("treehash/missing", algorithms, manifest));
+  EXPECT_TRUE(manifest.empty());
+  root.force_remove();
+}
@@ -2,11 +2,18 @@
 #include "compress/archive/lib_zip.h"
 #include "compress/archive/unzip.h"
 #include "compress/archive/zip.h"
+#include "compress/archive/unzip_stream.h"
 #include "compress/compressor.h"
 #include "io/filesystem.h"
 
+#include <sstream>
+#include <fstream>
+#include <unistd.h>
+#include <pthread.h>
+
 #include "gtest/gtest.h"
 #include "config-test.h"
+#include "file-test.h"
 
 unsigned int filter_DS_Store(const std::map<std::string, central_directory_header>& catalog) {
   unsigned int count=0;
@@ -50,6 +57,99 @@ TEST(Zip, UncompressDeflate) {
   ASSERT_TRUE(file2.exist());
 }
 
+TEST(Zip, ReadCentralDirectory) {
+  mgz::io::file zip(MGZ_TESTS_PATH(zip/test_deflate.zip));
+  mgz::compress::archive::unzip uz(zip);
+
+  ASSERT_EQ(2, uz.number_of_entries());
+
+  entry e1 = uz.file_stat_at_index(0);
+  EXPECT_EQ(std::string("file1.txt"), e1.file_name);
+  EXPECT_EQ(CM_DEFLAT, e1.compression_method);
+  EXPECT_EQ(80U, e1.uncompressed_size);
+  EXPECT_EQ(21U, e1.compressed_size);
+  EXPECT_EQ(0x06cf3416U, e1.crc32);
+
+  entry e2 = uz.file_stat_at_index(1);
+  EXPECT_EQ(std::string("pipo/file2.txt"), e2.file_name);
+  EXPECT_EQ(0x0a7cdc87U, e2.crc32);
+
+  EXPECT_THROW(uz.file_stat_at_index(2), Exception<UncompressError>);
+}
+
+TEST(Zip, StoredView) {
+  mgz::io::file zip(MGZ_TESTS_PATH(zip/test_store.zip));
+  mgz::compress::archive::unzip uz(zip);
+
+  entry_view view = uz.stored_view_at_index(1);
+  ASSERT_EQ(80UL, view.size);
+  mgz::security::crc32sum crc;
+  crc.update(view.data, view.size);
+  crc.finalize();
+  EXPECT_EQ(0x0a7cdc87UL, crc.crc);
+
+  mgz::io::file deflated(MGZ_TESTS_PATH(zip/test_deflate.zip));
+  mgz::compress::archive::unzip uzd(deflated);
+  EXPECT_THROW(uzd.stored_view_at_index(0), Exception<UnsupportedCompressionMethod>);
+}
+
+static void *open_archive_repeatedly(void *path) {
+  mgz::io::file zip(*static_cast<std::string *>(path));
+  for (int i=0; i<200; i++) {
+    mgz::compress::archive::unzip uz(zip);
+    if (1!=uz.index_of("pipo/file2.txt")) return path;
+  }
+  return NULL;
+}
+
+TEST(Zip, CentralDirectoryCache) {
+  mgz::compress::archive::central_directory_cache &cache=mgz::compress::archive::central_directory_cache::instance();
+  cache.clear();
+  mgz::io::file zip(MGZ_TESTS_PATH(zip/test_deflate.zip));
+  {
+    mgz::compress::archive::unzip uz1(zip);
+    mgz::compress::archive::unzip uz2(zip);
+    EXPECT_EQ(1U, cache.number_of_archives());
+    EXPECT_EQ(0, uz2.index_of("file1.txt"));
+    EXPECT_EQ(-1, uz2.index_of("nothere.txt"));
+  }
+
+  std::string path=zip.get_path();
+  pthread_t threads[4];
+  for (int i=0; i<4; i++) pthread_create(&threads[i], NULL, open_archive_repeatedly, &path);
+  for (int i=0; i<4; i++) {
+    void *result;
+    pthread_join(threads[i], &result);
+    EXPECT_TRUE(NULL==result);
+  }
+  EXPECT_EQ(1U, cache.number_of_archives());
+
+  // LRU eviction, while a reader still holds the evicted directory
+  mgz::io::file stored(MGZ_TESTS_PATH(zip/test_store.zip));
+  mgz::compress::archive::unzip held(zip);
+  cache.set_limits(1, CD_CACHE_MAX_BYTES);
+  mgz::compress::archive::unzip other(stored);
+  EXPECT_EQ(1U, cache.number_of_archives());
+  EXPECT_EQ(2, held.number_of_entries());
+  EXPECT_EQ(1, held.index_of("pipo/file2.txt"));
+  cache.set_limits(CD_CACHE_MAX_ARCHIVES, CD_CACHE_MAX_BYTES);
+
+  // Rewritten archives are parsed again
+  mgz::io::file archive("test_cache.zip");
+  archive.force_remove();
+  mgz::io::file f(MGZ_TESTS_PATH(zip/test.txt));
+  mgz::io::file f2(MGZ_TESTS_PATH(zip/test2.txt));
+  mgz::io::file base_dir(MGZ_TESTS_PATH(zip));
+  mgz::compress::archive::zip comp(archive);
+  comp.add_file(f,base_dir);
+  comp.deflate();
+  EXPECT_EQ(1, mgz::compress::archive::unzip(archive).number_of_entries());
+  mgz::compress::archive::zip more(archive);
+  more.add_file(f2,base_dir);
+  more.append();
+  EXPECT_EQ(2, mgz::compress::archive::unzip(archive).number_of_entries());
+}
+
 TEST(Zip, add_one_file) {
   mgz::io::file f(MGZ_TESTS_PATH(zip/test.txt));
   mgz::io::file base_dir(MGZ_TESTS_PATH(zip));
@@ -180,6 +280,459 @@ TEST(Zip, zip_two_files) {
   EXPECT_EQ(56U,check2.size());
 }
 
+TEST(Zip, append_remove_and_compact) {
+  mgz::io::file f(MGZ_TESTS_PATH(zip/test.txt));
+  mgz::io::file f2(MGZ_TESTS_PATH(zip/test2.txt));
+  mgz::io::file base_dir(MGZ_TESTS_PATH(zip));
+  mgz::io::file archive("test_append.zip");
+  archive.force_remove();
+
+  mgz::compress::archive::zip comp(archive);
+  comp.add_file(f,base_dir);
+  comp.deflate();
+
+  mgz::compress::archive::zip more(archive);
+  more.add_file(f2,base_dir);
+  more.append();
+  {
+    mgz::compress::archive::unzip uz(archive);
+    ASSERT_EQ(2, uz.number_of_entries());
+    mgz::io::file out("./ziptest");
+    out.force_remove();
+    uz.inflate(out);
+    EXPECT_EQ(57U,mgz::io::file("./ziptest/test.txt").size());
+    EXPECT_EQ(56U,mgz::io::file("./ziptest/test2.txt").size());
+  }
+
+  mgz::compress::archive::zip less(archive);
+  less.remove_file("test.txt");
+  less.append();
+  archive.refresh();
+  long size_before_compact=archive.size();
+  {
+    mgz::compress::archive::unzip uz(archive);
+    ASSERT_EQ(1, uz.number_of_entries());
+  }
+
+  less.compact();
+  archive.refresh();
+  EXPECT_TRUE(archive.size() < size_before_compact);
+  mgz::compress::archive::unzip uz(archive);
+  ASSERT_EQ(1, uz.number_of_entries());
+  mgz::io::file out("./ziptest");
+  out.force_remove();
+  uz.inflate(out);
+  EXPECT_FALSE(mgz::io::file("./ziptest/test.txt").exist());
+  EXPECT_EQ(56U,mgz::io::file("./ziptest/test2.txt").size());
+}
+
+TEST(Zip, append_after_stale_size) {
+  mgz::io::file f(MGZ_TESTS_PATH(zip/test.txt));
+  mgz::io::file f2(MGZ_TESTS_PATH(zip/test2.txt));
+  mgz::io::file base_dir(MGZ_TESTS_PATH(zip));
+  mgz::io::file archive("test_stale.zip");
+  archive.force_remove();
+
+  mgz::compress::archive::zip comp(archive);
+  comp.add_file(f,base_dir);
+  comp.deflate();
+  archive.refresh();
+  EXPECT_LT(0L, archive.size()); // The caller's snapshot now holds the size of the first archive
+
+  // Each zip copies the stale snapshot : appends must read the archive as it is on disk
+  mgz::compress::archive::zip first(archive);
+  first.add_file(f2,base_dir);
+  first.append();
+  mgz::compress::archive::zip second(archive);
+  second.remove_file("test.txt");
+  second.append();
+  second.compact();
+
+  mgz::compress::archive::unzip uz(archive);
+  ASSERT_EQ(1, uz.number_of_entries());
+  mgz::io::file out("./ziptest");
+  out.force_remove();
+  uz.inflate(out);
+  EXPECT_EQ(56U,mgz::io::file("./ziptest/test2.txt").size());
+  archive.force_remove();
+}
+
+TEST(Zip, append_keeps_archive_comment) {
+  mgz::io::file f(MGZ_TESTS_PATH(zip/test.txt));
+  mgz::io::file f2(MGZ_TESTS_PATH(zip/test2.txt));
+  mgz::io::file base_dir(MGZ_TESTS_PATH(zip));
+  mgz::io::file archive("test_comment.zip");
+  archive.force_remove();
+
+  mgz::compress::archive::zip comp(archive);
+  comp.add_file(f,base_dir);
+  comp.deflate();
+
+  // Add a comment, as other tools do : its length ends the end of central directory record
+  const std::string comment("made elsewhere");
+  {
+    std::fstream fs(archive.get_path().c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    fs.seekp(-2, std::ios::end);
+    unsigned short length=comment.size();
+    fs.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    fs.seekp(0, std::ios::end);
+    fs << comment;
+  }
+
+  mgz::compress::archive::zip more(archive);
+  more.add_file(f2,base_dir);
+  more.append();
+
+  std::string content=read_all(archive.get_path());
+  ASSERT_LT(comment.size(), content.size());
+  EXPECT_EQ(comment, content.substr(content.size()-comment.size()));
+  mgz::compress::archive::unzip uz(archive);
+  EXPECT_EQ(2, uz.number_of_entries());
+  archive.force_remove();
+}
+
+TEST(Zip, failed_update_keeps_archive) {
+  mgz::io::file f(MGZ_TESTS_PATH(zip/test.txt));
+  mgz::io::file base_dir(MGZ_TESTS_PATH(zip));
+  mgz::io::file archive("test_failed_update.zip");
+  archive.force_remove();
+  mgz::compress::archive::zip comp(archive);
+  comp.add_file(f,base_dir);
+  comp.deflate();
+  std::string original=read_all(archive.get_path());
+
+  // The source vanishes before it is compressed : the old central directory is put back
+  mgz::io::file vanishing("vanishing.txt");
+  write_file(vanishing.get_path(), "soon gone");
+  mgz::compress::archive::zip more(archive);
+  more.add_file(vanishing,mgz::io::file("."));
+  vanishing.remove();
+  EXPECT_ANY_THROW(more.append());
+  EXPECT_TRUE(original==read_all(archive.get_path()));
+  {
+    mgz::compress::archive::unzip uz(archive);
+    EXPECT_EQ(1, uz.number_of_entries());
+  }
+
+  // A broken local header stops the compaction : its temporary archive is removed
+  std::string broken=original;
+  broken[0]='X';
+  write_file(archive.get_path(), broken);
+  mgz::compress::archive::zip compacted(archive);
+  EXPECT_THROW(compacted.compact(),Exception<CantUpdateArchiveException>);
+  EXPECT_FALSE(mgz::io::file(archive.get_path()+".compact").exist());
+  EXPECT_TRUE(broken==read_all(archive.get_path()));
+  archive.force_remove();
+}
+
+TEST(Zip, auto_store_incompressible) {
+  mgz::io::file base_dir(".");
+  mgz::io::file noise("noise.bin");
+  {
+    std::ofstream os(noise.get_path().c_str(), std::ios::out | std::ios::binary);
+    unsigned int seed=0x2545F491;
+    for (int i=0; i<100000; i++) {
+      seed=seed*1103515245+12345;
+      os.put((char)(seed>>16));
+    }
+  }
+  mgz::io::file archive("test_auto_store.zip");
+  archive.force_remove();
+
+  mgz::compress::archive::zip comp(archive);
+  comp.set_auto_store(true);
+  comp.add_file(noise,base_dir);
+  central_directory_header_static hdr=comp.catalog[noise.get_absolute_path()].static_part;
+  EXPECT_EQ(CM_STORE,hdr.compression_method);
+  EXPECT_EQ(NO_FLAGS,hdr.flags);
+  comp.deflate();
+  EXPECT_TRUE(archive.size() < 100000+200);
+
+  mgz::compress::archive::unzip uz(archive);
+  entry e=uz.file_stat_at_index(0);
+  EXPECT_EQ(CM_STORE,e.compression_method);
+  EXPECT_EQ(100000U,e.compressed_size);
+  mgz::io::file out("./ziptest");
+  out.force_remove();
+  uz.inflate(out);
+  EXPECT_EQ(100000U,mgz::io::file("./ziptest/noise.bin").size());
+
+  mgz::compress::archive::zip forced(mgz::io::file("osef.zip")); // Off by default
+  forced.add_file(noise,base_dir);
+  EXPECT_EQ(CM_DEFLAT,forced.catalog[noise.get_absolute_path()].static_part.compression_method);
+  noise.remove();
+
+  // Compressed formats are stored without trial ; uncompressed audio goes through it
+  mgz::io::file song("song.mp3");
+  mgz::io::file sound("sound.wav");
+  {
+    std::ofstream mp3(song.get_path().c_str(), std::ios::out | std::ios::binary);
+    std::ofstream wav(sound.get_path().c_str(), std::ios::out | std::ios::binary);
+    std::string silence(100000,'\0');
+    mp3 << silence;
+    wav << silence;
+  }
+  mgz::compress::archive::zip media(mgz::io::file("osef.zip"));
+  media.set_auto_store(true);
+  media.add_file(song,base_dir);
+  media.add_file(sound,base_dir);
+  EXPECT_EQ(CM_STORE,media.catalog[song.get_absolute_path()].static_part.compression_method);
+  EXPECT_EQ(CM_DEFLAT,media.catalog[sound.get_absolute_path()].static_part.compression_method);
+  song.remove();
+  sound.remove();
+}
+
+class no_subdir_filter : public mgz::io::fsfilter {
+  public:
+    bool filter(mgz::io::fs_diff& d) {
+      return d.right.get_name()!="subdir";
+    }
+};
+
+TEST(Zip, zip_tree) {
+  mgz::io::file f(MGZ_TESTS_PATH(zip/to_zip_dir));
+  mgz::io::file base_dir(MGZ_TESTS_PATH(zip));
+  mgz::io::file archive("test_tree.zip");
+  archive.force_remove();
+  mgz::compress::archive::zip comp(archive);
+  comp.add_tree(f,base_dir);
+  unsigned int count=0;
+  for (unsigned int i=0; i<comp.tree_catalog.size(); i++) {
+    if (comp.tree_catalog[i].second.data_part.file_name.find(".DS_Store")==std::string::npos)
+      count++;
+  }
+  EXPECT_EQ(5U,count);
+  EXPECT_EQ(std::string("to_zip_dir/"),comp.tree_catalog[0].second.data_part.file_name);
+  comp.deflate();
+
+  mgz::io::file out("./ziptest");
+  out.force_remove();
+  mgz::compress::archive::unzip uz(archive);
+  uz.inflate(out);
+  mgz::io::file file1("ziptest/to_zip_dir/subdir/file2-1.0.0.txt");
+  mgz::io::file file2("ziptest/to_zip_dir/test.txt");
+  EXPECT_EQ(26U,file1.size());
+  EXPECT_EQ(57U,file2.size());
+
+  no_subdir_filter filter;
+  mgz::compress::archive::zip filtered(mgz::io::file("osef.zip"));
+  filtered.add_tree(f,base_dir,&filter);
+  for (unsigned int i=0; i<filtered.tree_catalog.size(); i++) {
+    EXPECT_EQ(std::string::npos,filtered.tree_catalog[i].second.data_part.file_name.find("subdir"));
+  }
+}
+
+// An output which cannot seek, like a pipe or a socket
+class unseekable_buf : public std::stringbuf {
+  protected:
+    std::streampos seekoff(std::streamoff, std::ios_base::seekdir, std::ios_base::openmode) {
+      return std::streampos(-1);
+    }
+    std::streampos seekpos(std::streampos, std::ios_base::openmode) {
+      return std::streampos(-1);
+    }
+};
+
+class throwing_filter : public mgz::io::fsfilter {
+  public:
+    bool filter(mgz::io::fs_diff &d) {
+      if (std::string::npos!=d.right.get_path().find("file.txt")) {
+        throw std::string("rejected");
+      }
+      return true;
+    }
+};
+
+TEST(Zip, zip_tree_symlinks) {
+  mgz::io::file dir("loop_dir");
+  dir.force_remove();
+  mgz::io::file("loop_dir/a").mkdirs();
+  {
+    std::ofstream os("loop_dir/a/file.txt");
+    os << "content";
+  }
+  ASSERT_EQ(0, symlink("..", "loop_dir/a/loop")); // Cycle : loop_dir/a/loop/a/loop/...
+  ASSERT_EQ(0, symlink("file.txt", "loop_dir/a/link.txt"));
+
+  mgz::compress::archive::zip comp(mgz::io::file("osef.zip"));
+  comp.add_tree(dir,mgz::io::file("."));
+  ASSERT_EQ(4U,comp.tree_catalog.size());
+  EXPECT_EQ(std::string("loop_dir/"),comp.tree_catalog[0].second.data_part.file_name);
+  EXPECT_EQ(std::string("loop_dir/a/"),comp.tree_catalog[1].second.data_part.file_name);
+  EXPECT_EQ(std::string("loop_dir/a/file.txt"),comp.tree_catalog[2].second.data_part.file_name);
+  EXPECT_EQ(std::string("loop_dir/a/link.txt"),comp.tree_catalog[3].second.data_part.file_name);
+  EXPECT_EQ(7U,comp.tree_catalog[3].second.static_part.descriptor.uncompressed_size);
+
+  // Directories being walked are closed when a filter throws
+  throwing_filter filter;
+  mgz::compress::archive::zip failing(mgz::io::file("osef.zip"));
+  EXPECT_THROW(failing.add_tree(dir,mgz::io::file("."),&filter), std::string);
+  dir.force_remove();
+}
+
+TEST(Zip, zip_to_stream) {
+  mgz::io::file f(MGZ_TESTS_PATH(zip/to_zip_dir));
+  mgz::io::file base_dir(MGZ_TESTS_PATH(zip));
+  mgz::io::file png("stream.png"); // Stored, as already compressed
+  {
+    std::ofstream os(png.get_path().c_str(), std::ios::out | std::ios::binary);
+    os << "Not really a PNG";
+  }
+  unseekable_buf buf;
+  std::ostream sink(&buf);
+  mgz::compress::archive::zip comp(sink);
+  comp.set_auto_store(true);
+  comp.add_tree(f,base_dir);
+  comp.add_file(png,mgz::io::file("."));
+  comp.deflate();
+  EXPECT_EQ(CM_STORE,comp.catalog[png.get_absolute_path()].static_part.compression_method);
+  EXPECT_THROW(comp.append(),Exception<CantUpdateArchiveException>);
+
+  mgz::io::file archive("test_stream.zip");
+  archive.force_remove();
+  {
+    std::ofstream os(archive.get_path().c_str(), std::ios::out | std::ios::binary);
+    os << buf.str();
+  }
+  mgz::io::file out("./ziptest");
+  out.force_remove();
+  mgz::compress::archive::unzip uz(archive);
+  uz.inflate(out);
+  EXPECT_EQ(26U,mgz::io::file("ziptest/to_zip_dir/subdir/file2-1.0.0.txt").size());
+  EXPECT_EQ(57U,mgz::io::file("ziptest/to_zip_dir/test.txt").size());
+  EXPECT_EQ(16U,mgz::io::file("ziptest/stream.png").size());
+  png.remove();
+}
+
+// An input which cannot seek, and delivers data in small chunks, like a pipe
+class trickle_buf : public std::streambuf {
+  public:
+    trickle_buf(const std::string &data) : data_(data), pos_(0) {}
+  protected:
+    int_type underflow() {
+      if (pos_>=data_.size()) return traits_type::eof();
+      size_t n=std::min((size_t)7,data_.size()-pos_);
+      char *p=const_cast<char *>(data_.data())+pos_;
+      setg(p,p,p+n);
+      pos_+=n;
+      return traits_type::to_int_type(*p);
+    }
+  private:
+    std::string data_;
+    size_t pos_;
+};
+
+TEST(Zip, unzip_stream) {
+  trickle_buf deflated(read_all(MGZ_TESTS_PATH(zip/test_deflate.zip)));
+  std::istream in(&deflated);
+  mgz::compress::archive::unzip_stream uzs(in);
+  entry e;
+  ASSERT_TRUE(uzs.next_entry(e));
+  EXPECT_EQ(std::string("file1.txt"), e.file_name);
+  std::ostringstream content;
+  entry done=uzs.inflate_entry(content);
+  EXPECT_EQ(80U, content.str().size());
+  EXPECT_EQ(0x06cf3416U, done.crc32);
+  ASSERT_TRUE(uzs.next_entry(e)); // Not inflated : skipped by the next call
+  EXPECT_EQ(std::string("pipo/file2.txt"), e.file_name);
+  EXPECT_FALSE(uzs.next_entry(e));
+
+  trickle_buf stored(read_all(MGZ_TESTS_PATH(zip/test_store.zip)));
+  std::istream in_store(&stored);
+  mgz::io::file out("./ziptest");
+  out.force_remove();
+  mgz::compress::archive::unzip_stream(in_store).inflate(out);
+  EXPECT_EQ(80U, mgz::io::file("ziptest/pipo/file2.txt").size());
+
+  // Data descriptors after deflated data
+  mgz::io::file f(MGZ_TESTS_PATH(zip/to_zip_dir));
+  mgz::io::file base_dir(MGZ_TESTS_PATH(zip));
+  std::ostringstream zipped;
+  mgz::compress::archive::zip comp(zipped);
+  comp.add_tree(f,base_dir);
+  comp.deflate();
+  trickle_buf ours(zipped.str());
+  std::istream in_ours(&ours);
+  out.force_remove();
+  mgz::compress::archive::unzip_stream(in_ours).inflate(out);
+  EXPECT_EQ(26U,mgz::io::file("ziptest/to_zip_dir/subdir/file2-1.0.0.txt").size());
+  EXPECT_EQ(57U,mgz::io::file("ziptest/to_zip_dir/test.txt").size());
+
+  // Names leaving the target directory are rejected
+  const char *unsafe[]={"pipo/../../u.t","/tmp/mgz_u.txt"};
+  for (int i=0; i<2; i++) {
+    std::string crafted=read_all(MGZ_TESTS_PATH(zip/test_store.zip));
+    std::string::size_type at;
+    while (std::string::npos!=(at=crafted.find("pipo/file2.txt"))) {
+      crafted.replace(at,14,unsafe[i]);
+    }
+    trickle_buf evil(crafted);
+    std::istream in_evil(&evil);
+    out.force_remove();
+    EXPECT_THROW(mgz::compress::archive::unzip_stream(in_evil).inflate(out),Exception<UnsafeEntryName>);
+  }
+  EXPECT_FALSE(mgz::io::file("u.t").exist());
+  EXPECT_FALSE(mgz::io::file("/tmp/mgz_u.txt").exist());
+}
+
+TEST(Zip, zip_deduplicate) {
+  mgz::io::file dir("dedup_dir");
+  dir.force_remove();
+  dir.mkdirs();
+  std::string text;
+  unsigned int seed=42;
+  for (int i=0; i<20000; i++) {
+    seed=seed*1103515245+12345;
+    text+=(char)('a'+(seed>>16)%26);
+    if (0==i%12) text+=' ';
+  }
+  const char *names[]={"dedup_dir/a.txt","dedup_dir/b.txt","dedup_dir/c.txt"};
+  for (int i=0; i<3; i++) {
+    std::ofstream os(names[i], std::ios::out | std::ios::binary);
+    os << text;
+    if (2==i) os.seekp(-1, std::ios::end), os << '!'; // Same size, different content
+  }
+
+  mgz::io::file plain_archive("test_no_dedup.zip");
+  mgz::io::file archive("test_dedup.zip");
+  plain_archive.force_remove();
+  archive.force_remove();
+  mgz::compress::archive::zip plain(plain_archive);
+  plain.add_tree(dir,mgz::io::file("."));
+  plain.deflate();
+  mgz::compress::archive::zip comp(archive);
+  comp.set_deduplicate(true);
+  comp.add_tree(dir,mgz::io::file("."));
+  comp.deflate();
+  EXPECT_EQ(plain_archive.size(), archive.size()); // Same compressed data, computed once
+
+  mgz::compress::archive::unzip uz(archive);
+  ASSERT_EQ(4, uz.number_of_entries());
+  entry a=uz.file_stat_at_index(1);
+  entry b=uz.file_stat_at_index(2);
+  EXPECT_EQ(std::string("dedup_dir/a.txt"), a.file_name);
+  EXPECT_EQ(std::string("dedup_dir/b.txt"), b.file_name);
+  EXPECT_EQ(a.crc32, b.crc32);
+  ASSERT_EQ(a.compressed_size, b.compressed_size);
+  EXPECT_NE(a.crc32, uz.file_stat_at_index(3).crc32);
+
+  // b.txt reuses the compressed data of a.txt, byte for byte
+  std::string bytes=read_all(archive.get_path());
+  ASSERT_LE((size_t)b.file_offset+b.compressed_size, bytes.size());
+  EXPECT_NE(a.file_offset, b.file_offset);
+  EXPECT_TRUE(bytes.substr(a.file_offset, a.compressed_size)==bytes.substr(b.file_offset, b.compressed_size));
+
+  mgz::io::file out("./ziptest");
+  out.force_remove();
+  uz.inflate(out);
+  std::string changed=text;
+  changed[changed.size()-1]='!';
+  EXPECT_TRUE(text==read_all("ziptest/dedup_dir/a.txt"));
+  EXPECT_TRUE(text==read_all("ziptest/dedup_dir/b.txt"));
+  EXPECT_TRUE(changed==read_all("ziptest/dedup_dir/c.txt"));
+  dir.force_remove();
+}
+
 TEST(Zip, zip_one_empty_dir) {
   mgz::io::file f(MGZ_TESTS_PATH(zip/vide_dir));
   f.force_remove();
@@ -238,3 +791,25 @@ TEST(Zip, zip_one_empty_dir) {
   EXPECT_EQ(57U,file2.size());
  }
 
+TEST(Zip, UncompressDeflate64) {
+  // Uses a 65000 bytes long match (length code 285) and a 33001 bytes distance (distance code 30)
+  mgz::io::file zip(MGZ_TESTS_PATH(zip/test_deflate64.zip));
+  mgz::io::file out("./ziptest");
+  out.force_remove();
+  mgz::compress::archive::unzip uz(zip);
+  ASSERT_EQ(1, uz.number_of_entries());
+  EXPECT_EQ(CM_DEFLAT64, uz.file_stat_at_index(0).compression_method);
+  uz.inflate(out); // Checks the CRC32
+  EXPECT_EQ(66503U, mgz::io::file("ziptest/deflate64.bin").size());
+
+  trickle_buf deflated(read_all(MGZ_TESTS_PATH(zip/test_deflate64.zip)));
+  std::istream in(&deflated);
+  mgz::compress::archive::unzip_stream uzs(in);
+  entry e;
+  ASSERT_TRUE(uzs.next_entry(e));
+  std::ostringstream content;
+  entry done=uzs.inflate_entry(content);
+  EXPECT_EQ(66503U, content.str().size());
+  EXPECT_EQ(0xd931d1a7U, done.crc32);
+  EXPECT_FALSE(uzs.next_entry(e));
+}